@@ -0,0 +1,147 @@
+#include "benchmark.h"
+
+#include <cstdlib>
+
+namespace {
+
+std::atomic<qint64> alloc_count { 0 };
+std::atomic<qint64> alloc_bytes { 0 };
+std::atomic<qint64> signals_seen { 0 };
+
+inline void note_allocation(std::size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+} // namespace
+
+// Qt containers allocate through malloc rather than operator new, so the
+// allocator itself is wrapped. glibc lets the executable interpose these and
+// still reach the real implementation.
+#if defined(__GLIBC__)
+extern "C" {
+
+void* __libc_malloc(std::size_t) noexcept;
+void* __libc_calloc(std::size_t, std::size_t) noexcept;
+void* __libc_realloc(void*, std::size_t) noexcept;
+void  __libc_free(void*) noexcept;
+
+void* malloc(std::size_t size) noexcept {
+    note_allocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size) noexcept {
+    note_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, std::size_t size) noexcept {
+    note_allocation(size);
+    return __libc_realloc(p, size);
+}
+
+void free(void* p) noexcept {
+    __libc_free(p);
+}
+}
+#endif
+
+namespace bench {
+
+AllocationCount allocations() {
+    return { alloc_count.load(), alloc_bytes.load() };
+}
+
+bool counts_allocations() {
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+qint64 signal_count() {
+    return signals_seen.load();
+}
+
+void add_signals(qint64 count) {
+    signals_seen.fetch_add(count, std::memory_order_relaxed);
+}
+
+void reset_signals() {
+    signals_seen.store(0);
+}
+
+void count_signals(QAbstractItemModel* model) {
+    auto bump = []() { add_signals(1); };
+
+    QObject::connect(model, &QAbstractItemModel::dataChanged, bump);
+    QObject::connect(model, &QAbstractItemModel::rowsInserted, bump);
+    QObject::connect(model, &QAbstractItemModel::rowsRemoved, bump);
+    QObject::connect(model, &QAbstractItemModel::rowsMoved, bump);
+    QObject::connect(model, &QAbstractItemModel::layoutChanged, bump);
+    QObject::connect(model, &QAbstractItemModel::modelReset, bump);
+}
+
+Runner::Runner(QString filter, int repeats)
+    : m_filter(std::move(filter)), m_repeats(std::max(repeats, 1)) { }
+
+bool Runner::selected(QString const& name) const {
+    return m_filter.isEmpty() or name.contains(m_filter);
+}
+
+void Runner::record(QString const&       name,
+                    qint64               ops,
+                    std::vector<Sample> samples) {
+    std::sort(samples.begin(), samples.end(), [](auto const& a, auto const& b) {
+        return a.ns < b.ns;
+    });
+
+    auto const& median = samples[samples.size() / 2];
+
+    QJsonObject obj;
+    obj["name"]        = name;
+    obj["ops"]         = ops;
+    obj["runs"]        = qint64(samples.size());
+    obj["median_ns"]   = median.ns;
+    obj["min_ns"]      = samples.front().ns;
+    obj["max_ns"]      = samples.back().ns;
+    obj["ns_per_op"]   = ops > 0 ? double(median.ns) / ops : 0.0;
+    obj["allocations"] = median.allocations;
+    obj["alloc_bytes"] = median.bytes;
+    obj["signals"]     = median.notifications;
+
+    m_results.append(obj);
+
+    qInfo().noquote() << name << double(median.ns) / std::max<qint64>(ops, 1)
+                      << "ns/op" << median.allocations << "allocs"
+                      << median.notifications << "signals";
+}
+
+void Runner::check(QString const& name, bool passed, QJsonObject details) {
+    if (!selected(name)) return;
+
+    details["name"]   = name;
+    details["passed"] = passed;
+
+    m_checks.append(details);
+
+    if (!passed) {
+        m_failed = true;
+        qWarning().noquote() << "Check failed:" << name;
+    }
+}
+
+QJsonObject Runner::report(QJsonObject meta) const {
+    meta["counts_allocations"] = counts_allocations();
+    meta["repeats"]            = m_repeats;
+
+    QJsonObject ret;
+    ret["meta"]    = meta;
+    ret["results"] = m_results;
+    ret["checks"]  = m_checks;
+    return ret;
+}
+
+} // namespace bench
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <QAbstractItemModel>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace bench {
+
+/// Heap allocations made by the whole process so far. Only counted on glibc;
+/// elsewhere these stay at zero.
+struct AllocationCount {
+    qint64 count = 0;
+    qint64 bytes = 0;
+};
+
+AllocationCount allocations();
+
+/// Whether allocations are being counted on this platform
+bool counts_allocations();
+
+/// Signals observed through count_signals() since the last reset
+qint64 signal_count();
+void   add_signals(qint64 count);
+void   reset_signals();
+
+/// Count every change notification a model sends
+void count_signals(QAbstractItemModel* model);
+
+/// Stop the compiler from optimizing a computed value away
+template <class T>
+inline void keep(T const& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    (void)value;
+#endif
+}
+
+///
+/// \brief The Runner class times benchmark cases and collects the results as
+/// JSON.
+///
+/// Each case is run a number of times. A fresh fixture is made for every run,
+/// outside of the timed region. The run with the median time is reported,
+/// along with the allocations and model signals it caused.
+///
+class Runner {
+    QString    m_filter;
+    int        m_repeats = 5;
+    QJsonArray m_results;
+    QJsonArray m_checks;
+    bool       m_failed = false;
+
+    struct Sample {
+        qint64 ns;
+        qint64 allocations;
+        qint64 bytes;
+        qint64 notifications;
+    };
+
+    void record(QString const& name, qint64 ops, std::vector<Sample> samples);
+
+public:
+    Runner(QString filter, int repeats);
+
+    /// Check if the filter lets a case or check of this name run
+    bool selected(QString const& name) const;
+
+    /// Time a case. make() builds the fixture, body(fixture) does ops
+    /// operations on it.
+    template <class Make, class Body>
+    void run(QString const& name, qint64 ops, Make&& make, Body&& body) {
+        if (!selected(name)) return;
+
+        std::vector<Sample> samples;
+        samples.reserve(m_repeats);
+
+        for (int i = 0; i < m_repeats; i++) {
+            auto fixture = make();
+
+            reset_signals();
+            auto const before = allocations();
+
+            QElapsedTimer timer;
+            timer.start();
+
+            body(*fixture);
+
+            auto const ns    = timer.nsecsElapsed();
+            auto const after = allocations();
+
+            samples.push_back({ ns,
+                                after.count - before.count,
+                                after.bytes - before.bytes,
+                                signal_count() });
+        }
+
+        record(name, ops, std::move(samples));
+    }
+
+    /// Record a pass/fail check. Any failure makes the run fail.
+    void check(QString const& name, bool passed, QJsonObject details = {});
+
+    bool failed() const { return m_failed; }
+
+    /// All results and checks, with details of the run
+    QJsonObject report(QJsonObject meta) const;
+};
+
+} // namespace bench
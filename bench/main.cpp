@@ -0,0 +1,1329 @@
+#include "benchmark.h"
+
+#include "lib/roundedimage.h"
+#include "lib/smartlist.h"
+#include "lib/smartlistconsumer.h"
+#include "lib/structcolumnmodel.h"
+#include "lib/structmodel.h"
+#include "lib/structreplica.h"
+#include "lib/structtext.h"
+#include "lib/structtreemodel.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QQuickWindow>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+struct BenchRecord {
+    QString name;
+    int     value  = 0;
+    double  weight = 0;
+    bool    flag   = false;
+
+    SM_MAKE_META(SM_META(BenchRecord, name),
+                 SM_META(BenchRecord, value),
+                 SM_META(BenchRecord, weight),
+                 SM_META(BenchRecord, flag));
+};
+
+/// A record that counts its copies, to catch bulk paths that copy
+struct CountedRecord {
+    static inline qint64 copies = 0;
+
+    int    value  = 0;
+    double weight = 0;
+
+    CountedRecord() = default;
+    explicit CountedRecord(int v) : value(v), weight(v) { }
+
+    CountedRecord(CountedRecord const& o) : value(o.value), weight(o.weight) {
+        copies++;
+    }
+    CountedRecord(CountedRecord&&) = default;
+
+    CountedRecord& operator=(CountedRecord const& o) {
+        value  = o.value;
+        weight = o.weight;
+        copies++;
+        return *this;
+    }
+    CountedRecord& operator=(CountedRecord&&) = default;
+
+    SM_MAKE_META(SM_META(CountedRecord, value), SM_META(CountedRecord, weight));
+};
+
+QVector<BenchRecord> make_records(int count) {
+    QVector<BenchRecord> ret;
+    ret.reserve(count);
+    for (int i = 0; i < count; i++) {
+        ret << BenchRecord { QString::number(i), i, i * 0.5, i % 2 == 0 };
+    }
+    return ret;
+}
+
+using TableModel  = StructTableModel<BenchRecord>;
+using ColumnModel = StructColumnModel<BenchRecord>;
+
+template <class Model>
+std::unique_ptr<Model> make_model(int rows) {
+    auto ret = std::make_unique<Model>();
+    ret->append(make_records(rows));
+    bench::count_signals(ret.get());
+    return ret;
+}
+
+template <class Model>
+std::unique_ptr<Model> make_empty() {
+    auto ret = std::make_unique<Model>();
+    bench::count_signals(ret.get());
+    return ret;
+}
+
+/// A model plus records waiting to go into it
+template <class Model>
+struct Load {
+    std::unique_ptr<Model> model;
+    QVector<BenchRecord>   records;
+};
+
+template <class Model>
+std::unique_ptr<Load<Model>> make_load(int rows, int existing = 0) {
+    return std::make_unique<Load<Model>>(
+        Load<Model> { existing ? make_model<Model>(existing)
+                               : make_empty<Model>(),
+                      make_records(rows) });
+}
+
+/// Counts what it hears from a SmartList
+class CountingConsumer : public SmartListConsumerBase {
+protected:
+    void on_add(int begin, int end1) override {
+        bench::add_signals(1);
+        bench::keep(end1 - begin);
+    }
+
+public:
+    void set_source(SmartListBase* source) { set_base_source(source); }
+};
+
+struct FanOut {
+    SmartList<int>                                 list;
+    std::vector<std::unique_ptr<CountingConsumer>> consumers;
+};
+
+/// Column dispatch as StructTableModel did it before ColumnTable: a recursive
+/// search of the meta tuple on every access. Kept as the baseline that
+/// bench_dispatch measures the tables against.
+namespace legacy {
+
+template <class Tuple, int I, class Function>
+struct get_by_idx {
+    static_assert(I >= 1);
+    static void check(Tuple&& t, int i, Function&& f) {
+        if (I == i) { return f(std::get<I>(t)); }
+
+        get_by_idx<Tuple, I - 1, Function>::check(t, i, std::move(f));
+    }
+};
+
+template <class Tuple, class Function>
+struct get_by_idx<Tuple, 0, Function> {
+    static void check(Tuple&& t, int i, Function&& f) {
+        if (0 == i) { return f(std::get<0>(t)); }
+
+        throw std::runtime_error("Bad index");
+    }
+};
+
+template <class Tuple, class Function>
+void tuple_get(Tuple&& t, int index, Function&& f) {
+    using LT = std::remove_cvref_t<Tuple>;
+
+    constexpr static auto S = std::tuple_size_v<LT>;
+
+    get_by_idx<Tuple, S - 1, Function>::check(t, index, std::move(f));
+}
+
+template <class Record>
+QVariant record_get(Record const& r, int i) {
+    QVariant ret;
+    tuple_get(Record::meta, i, [&r, &ret](auto const& a) {
+        ret = QVariant::fromValue(a.get(r));
+    });
+    return ret;
+}
+
+template <class Record>
+bool record_set(Record& r, int i, QVariant const& v) {
+    bool ret = false;
+    tuple_get(Record::meta, i, [&v, &ret, &r](auto& a) {
+        if (!a.editable) return;
+        using LT = std::remove_cvref_t<decltype(a.get(r))>;
+        a.set(r, v.value<LT>());
+        ret = true;
+    });
+    return ret;
+}
+
+} // namespace legacy
+
+/// Per-member reads and writes, the core of data() and setData(), through the
+/// old tuple search and through ColumnTable
+void bench_dispatch(bench::Runner& runner, int rows) {
+    using Table = struct_model_detail::ColumnTable<BenchRecord>;
+
+    auto const records = make_records(rows);
+    qint64 const ops   = qint64(rows) * Table::count;
+
+    // one value of the right type for each column
+    BenchRecord const donor { "donor", 7, 1.5, true };
+    QVector<QVariant> values;
+    for (int c = 0; c < Table::count; c++) {
+        values << Table::getters[c](donor);
+    }
+
+    auto get_all = [&](auto&& get) {
+        return [&, get](QVector<BenchRecord> const& rs) {
+            for (auto const& r : rs) {
+                for (int c = 0; c < Table::count; c++) {
+                    bench::keep(get(r, c));
+                }
+            }
+        };
+    };
+
+    auto set_all = [&](auto&& set) {
+        return [&, set](QVector<BenchRecord>& rs) {
+            for (auto& r : rs) {
+                for (int c = 0; c < Table::count; c++) {
+                    bench::keep(set(r, c, values[c]));
+                }
+            }
+        };
+    };
+
+    auto shared = [&]() { return &records; };
+    auto copied = [&]() {
+        return std::make_unique<QVector<BenchRecord>>(records);
+    };
+
+    runner.run("dispatch/get/tuple_search",
+               ops,
+               shared,
+               get_all([](BenchRecord const& r, int c) {
+                   return legacy::record_get(r, c);
+               }));
+
+    runner.run("dispatch/get/column_table",
+               ops,
+               shared,
+               get_all([](BenchRecord const& r, int c) {
+                   return Table::getters[c](r);
+               }));
+
+    runner.run("dispatch/set/tuple_search",
+               ops,
+               copied,
+               set_all([](BenchRecord& r, int c, QVariant const& v) {
+                   return legacy::record_set(r, c, v);
+               }));
+
+    runner.run("dispatch/set/column_table",
+               ops,
+               copied,
+               set_all([](BenchRecord& r, int c, QVariant const& v) {
+                   return Table::setters[c](r, v);
+               }));
+}
+
+void bench_data(bench::Runner& runner, int rows) {
+    auto const model = make_model<TableModel>(rows);
+    auto const roles = model->roleNames();
+    int const  cols  = model->columnCount();
+
+    auto by_role = [&](QString const& name, int role, int column) {
+        runner.run(
+            "table/data/" + name,
+            rows,
+            [&]() { return model.get(); },
+            [&](TableModel& m) {
+                for (int r = 0; r < rows; r++) {
+                    bench::keep(m.data(m.index(r, column), role));
+                }
+            });
+    };
+
+    by_role("display", Qt::DisplayRole, 0);
+    by_role("edit", Qt::EditRole, 0);
+
+    for (int c = 0; c < cols; c++) {
+        int const role = Qt::UserRole + c;
+        by_role(QString::fromUtf8(roles.value(role)), role, 0);
+    }
+}
+
+void bench_set_data(bench::Runner& runner, int rows) {
+    QVector<QVariant> names, values;
+    names.reserve(rows);
+    values.reserve(rows);
+    for (int r = 0; r < rows; r++) {
+        names << QVariant(QString("renamed %1").arg(r));
+        values << QVariant(r + 1);
+    }
+
+    auto set_all = [&](TableModel& m, int column, QVector<QVariant> const& v) {
+        for (int r = 0; r < rows; r++) {
+            m.setData(m.index(r, column), v[r]);
+        }
+    };
+
+    runner.run(
+        "table/set_data/name",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) { set_all(m, 0, names); });
+
+    runner.run(
+        "table/set_data/value",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) { set_all(m, 1, values); });
+
+    runner.run(
+        "table/set_data/value_batched",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) {
+            auto batch = m.batch();
+            set_all(m, 1, values);
+        });
+}
+
+void bench_structure(bench::Runner& runner, int rows) {
+    int const edits = std::min(rows, 1000);
+
+    runner.run(
+        "table/append/one_by_one",
+        rows,
+        [&]() { return make_load<TableModel>(rows); },
+        [&](auto& f) {
+            for (auto& r : f.records) {
+                f.model->append(std::move(r));
+            }
+        });
+
+    runner.run(
+        "table/append/bulk",
+        rows,
+        [&]() { return make_load<TableModel>(rows); },
+        [&](auto& f) { f.model->append(std::move(f.records)); });
+
+    runner.run(
+        "table/insert_at/middle",
+        edits,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) {
+            BenchRecord r { "inserted", -1, 0, false };
+            for (int i = 0; i < edits; i++) {
+                m.insert_at(m.rowCount() / 2, std::span(&r, 1));
+            }
+        });
+
+    runner.run(
+        "table/remove_at/front",
+        edits,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) {
+            for (int i = 0; i < edits; i++) {
+                m.remove_at(0);
+            }
+        });
+
+    runner.run(
+        "table/remove_by_predicate/every_other",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) {
+            m.remove_by_predicate([](BenchRecord const& r) { return r.flag; });
+        });
+
+    runner.run(
+        "table/replace",
+        rows,
+        [&]() { return make_load<TableModel>(rows, rows); },
+        [&](auto& f) { f.model->replace(std::move(f.records)); });
+}
+
+void bench_sort(bench::Runner& runner, int rows) {
+    // names sort as text, so their order is shuffled against the row order
+    runner.run(
+        "table/sort/string",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) { m.sort(0); });
+
+    runner.run(
+        "table/sort/double_descending",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) { m.sort(2, Qt::DescendingOrder); });
+
+    runner.run(
+        "table/sort/two_keys",
+        rows,
+        [&]() { return make_model<TableModel>(rows); },
+        [&](TableModel& m) {
+            m.sort({ { 3, Qt::AscendingOrder }, { 1, Qt::DescendingOrder } });
+        });
+}
+
+void bench_fan_out(bench::Runner& runner, int rows) {
+    int const items = std::min(rows, 10000);
+
+    for (int consumers : { 1, 8, 64 }) {
+        runner.run(
+            QString("list/fan_out/%1").arg(consumers),
+            items,
+            [&]() {
+                auto f = std::make_unique<FanOut>();
+                for (int i = 0; i < consumers; i++) {
+                    auto c = std::make_unique<CountingConsumer>();
+                    c->set_source(&f->list);
+                    f->consumers.push_back(std::move(c));
+                }
+                return f;
+            },
+            [&](FanOut& f) {
+                for (int i = 0; i < items; i++) {
+                    f.list.append(i);
+                }
+            });
+
+        runner.run(
+            QString("list/fan_out_batch/%1").arg(consumers),
+            items,
+            [&]() {
+                auto f = std::make_unique<FanOut>();
+                for (int i = 0; i < consumers; i++) {
+                    auto c = std::make_unique<CountingConsumer>();
+                    c->set_source(&f->list);
+                    f->consumers.push_back(std::move(c));
+                }
+                return f;
+            },
+            [&](FanOut& f) {
+                auto batch = f.list.batch();
+                for (int i = 0; i < items; i++) {
+                    f.list.append(i);
+                }
+            });
+    }
+}
+
+/// Middle edits and lookups on flat and chunked list storage
+template <class List>
+void bench_list_storage(bench::Runner&  runner,
+                        QString const& kind,
+                        int             rows) {
+    int const edits = std::min(rows, 10000);
+
+    auto make = [rows]() {
+        auto l = std::make_unique<List>();
+        l->reserve(rows);
+        for (int i = 0; i < rows; i++) {
+            l->append(i);
+        }
+        return l;
+    };
+
+    runner.run(
+        QString("list/insert_middle/%1").arg(kind), edits, make, [&](List& l) {
+            for (int i = 0; i < edits; i++) {
+                l.insert(l.size() / 2, i);
+            }
+        });
+
+    runner.run(
+        QString("list/remove_middle/%1").arg(kind), edits, make, [&](List& l) {
+            for (int i = 0; i < edits; i++) {
+                l.remove(l.size() / 2);
+            }
+        });
+
+    runner.run(
+        QString("list/find_remove_one/%1").arg(kind),
+        edits,
+        [&]() {
+            auto l = make();
+            if constexpr (requires { l->enable_index(); }) l->enable_index();
+            return l;
+        },
+        [&](List& l) {
+            for (int i = 0; i < edits; i++) {
+                l.find_remove_one(rows - 1 - i * 7 % rows);
+            }
+        });
+}
+
+void bench_role_for_member(bench::Runner& runner) {
+    constexpr int calls = 1000000;
+
+    int dummy = 0;
+
+    runner.run(
+        "meta/role_for_member",
+        calls * 2,
+        [&]() { return &dummy; },
+        [&](int&) {
+            using struct_model_detail::role_for_member;
+            for (int i = 0; i < calls; i++) {
+                bench::keep(role_for_member(&BenchRecord::value));
+                bench::keep(role_for_member(&BenchRecord::flag));
+            }
+        });
+}
+
+/// Puts rows children under the first top level record, and a few under each
+/// of the others
+class BenchTreeSource : public StructTreeSource<BenchRecord> {
+    int m_rows;
+
+public:
+    explicit BenchTreeSource(int rows) : m_rows(rows) { }
+
+    QVector<BenchRecord> children(BenchRecord const* parent) const override {
+        if (!parent) return make_records(64);
+        return make_records(parent->value == 0 ? m_rows : 16);
+    }
+};
+
+void bench_tree(bench::Runner& runner, int rows) {
+    using TreeModel = StructTreeModel<BenchRecord>;
+
+    // siblings are already expanded, so their blocks exist beside the new one
+    runner.run(
+        "tree/expand_large",
+        rows,
+        [&]() {
+            auto ret = std::make_unique<TreeModel>();
+            ret->set_source(std::make_shared<BenchTreeSource>(rows));
+            ret->fetchMore({});
+            for (int i = 1; i < ret->rowCount(); i++) {
+                ret->fetchMore(ret->index(i, 0));
+            }
+            bench::count_signals(ret.get());
+            return ret;
+        },
+        [&](TreeModel& m) { m.fetchMore(m.index(0, 0)); });
+}
+
+/// A window of rounded avatars
+struct Avatars {
+    QQuickWindow window;
+};
+
+void bench_rounded_image(bench::Runner& runner, int rows) {
+    int const items   = std::min(rows, 2000);
+    int const columns = 40;
+    int const side    = 48;
+
+    QTemporaryDir dir;
+    QString const path = dir.filePath("avatar.png");
+
+    QImage photo(640, 480, QImage::Format_RGB32);
+    photo.fill(Qt::darkCyan);
+    photo.save(path);
+
+    auto make = [&]() {
+        auto ret = std::make_unique<Avatars>();
+        ret->window.resize(columns * side,
+                           (items + columns - 1) / columns * side);
+
+        for (int i = 0; i < items; i++) {
+            auto* item = new RoundedImage(ret->window.contentItem());
+            item->setPosition(QPointF(i % columns * side, i / columns * side));
+            item->setSize(QSizeF(side, side));
+            item->set_radius(side / 2.0);
+            item->set_fill_mode(RoundedImage::PreserveAspectCrop);
+            item->set_source(QUrl::fromLocalFile(path));
+        }
+        return ret;
+    };
+
+    auto make_shown = [&]() {
+        auto ret = make();
+        ret->window.grabWindow();
+        return ret;
+    };
+
+    // every item lays out and masks its image
+    runner.run("quick/rounded_image/first_frame", items, make, [](Avatars& a) {
+        bench::keep(a.window.grabWindow());
+    });
+
+    runner.run("quick/rounded_image/next_frame",
+               items,
+               make_shown,
+               [](Avatars& a) { bench::keep(a.window.grabWindow()); });
+
+    runner.run("quick/rounded_image/resize",
+               items,
+               make_shown,
+               [&](Avatars& a) {
+                   for (auto* item : a.window.contentItem()->childItems()) {
+                       item->setSize(QSizeF(side - 8, side - 8));
+                   }
+                   bench::keep(a.window.grabWindow());
+               });
+}
+
+/// The same workloads on row storage and on column storage
+template <class Model>
+void bench_layout(bench::Runner& runner, QString const& kind, int rows) {
+    runner.run(
+        "layout/" + kind + "/append_bulk",
+        rows,
+        [&]() { return make_load<Model>(rows); },
+        [&](auto& f) { f.model->append(std::move(f.records)); });
+
+    runner.run(
+        "layout/" + kind + "/data",
+        rows,
+        [&]() { return make_model<Model>(rows); },
+        [&](Model& m) {
+            int const role = Qt::UserRole + 1;
+            for (int r = 0; r < rows; r++) {
+                bench::keep(m.data(m.index(r, 0), role));
+            }
+        });
+
+    runner.run(
+        "layout/" + kind + "/scan",
+        rows,
+        [&]() { return make_model<Model>(rows); },
+        [&](Model& m) {
+            qint64 sum = 0;
+            if constexpr (std::is_same_v<Model, ColumnModel>) {
+                for (int v : m.column(&BenchRecord::value)) {
+                    sum += v;
+                }
+            } else {
+                for (auto const& r : m) {
+                    sum += r.value;
+                }
+            }
+            bench::keep(sum);
+        });
+}
+
+/// Bulk loads should cost the same few allocations however many rows there
+/// are, and never copy a record
+void check_bulk_load(bench::Runner& runner) {
+    struct Load {
+        qint64 allocations;
+        qint64 copies;
+    };
+
+    auto measure = [](int count, auto&& load) {
+        StructTableModel<CountedRecord> model;
+
+        CountedRecord::copies = 0;
+        auto const before     = bench::allocations();
+
+        QVector<CountedRecord> records;
+        records.reserve(count);
+        for (int i = 0; i < count; i++) {
+            records.emplaceBack(i);
+        }
+        load(model, std::move(records));
+
+        return Load { bench::allocations().count - before.count,
+                      CountedRecord::copies };
+    };
+
+    auto compare = [&](QString const& name, auto&& load) {
+        measure(16, load); // warm up anything Qt sets up on first use
+
+        auto small = measure(1000, load);
+        auto large = measure(100000, load);
+
+        bool const passed =
+            small.copies == 0 and large.copies == 0 and
+            (!bench::counts_allocations() or
+             small.allocations == large.allocations);
+
+        runner.check(name,
+                     passed,
+                     { { "allocations_1k", small.allocations },
+                       { "allocations_100k", large.allocations },
+                       { "copies_1k", small.copies },
+                       { "copies_100k", large.copies } });
+    };
+
+    using Model = StructTableModel<CountedRecord>;
+
+    compare("bulk_load/append", [](Model& m, QVector<CountedRecord>&& r) {
+        m.append(std::move(r));
+    });
+
+    compare("bulk_load/reset", [](Model& m, QVector<CountedRecord>&& r) {
+        m.reset(std::move(r));
+    });
+
+    compare("bulk_load/replace", [](Model& m, QVector<CountedRecord>&& r) {
+        m.replace(std::move(r));
+    });
+
+    compare("bulk_load/smart_list", [](Model&, QVector<CountedRecord>&& r) {
+        SmartList<CountedRecord> list;
+        list.append(std::move(r));
+    });
+}
+
+QVector<BenchRecord> records_of(TableModel const& model) {
+    QVector<BenchRecord> ret;
+    ret.reserve(model.rowCount());
+    for (int i = 0; i < model.rowCount(); i++) {
+        ret << *model.get_at(i);
+    }
+    return ret;
+}
+
+bool same_records(QVector<BenchRecord> const& a,
+                  QVector<BenchRecord> const& b) {
+    auto same = [](BenchRecord const& x, BenchRecord const& y) {
+        return x.name == y.name and x.value == y.value and
+               x.weight == y.weight and x.flag == y.flag;
+    };
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), same);
+}
+
+/// Undoing each kind of change should give back the records from before it,
+/// and redoing should give back those from after it. A batch should also send
+/// the same notifications with the journal on as without.
+void check_journal(bench::Runner& runner) {
+    auto model    = make_model<TableModel>(1000);
+    auto* journal = model->enable_journal();
+
+    // the records after each step, starting with the initial ones
+    QVector<QVector<BenchRecord>> states { records_of(*model) };
+
+    auto step = [&](auto&& change) {
+        change(*model);
+        states << records_of(*model);
+    };
+
+    auto batch = [](TableModel& m) {
+        TableModel::Batch b(&m);
+        m.insert_at(10, make_records(5));
+        m.remove_at(12, 3);
+        m.remove_at(500, 40);
+        m.append(make_records(3));
+    };
+
+    step(batch);
+    step([](TableModel& m) { m.setData(m.index(7, 1), 12345); });
+    step([](TableModel& m) {
+        m.modify(20, [](BenchRecord& r) {
+            r.name  = "modified";
+            r.value = -1;
+        });
+    });
+    step([](TableModel& m) { m.sort(1, Qt::DescendingOrder); });
+    step([](TableModel& m) { m.reset(make_records(10)); });
+
+    int const steps = states.size() - 1;
+
+    bool undone = journal->undo_count() == steps;
+    for (int i = steps - 1; i >= 0; i--) {
+        journal->undo();
+        undone = undone and same_records(records_of(*model), states[i]);
+    }
+
+    runner.check("journal/undo",
+                 undone and !journal->can_undo(),
+                 { { "steps", steps },
+                   { "redo_count", journal->redo_count() } });
+
+    bool redone = journal->redo_count() == steps;
+    for (int i = 1; i <= steps; i++) {
+        journal->redo();
+        redone = redone and same_records(records_of(*model), states[i]);
+    }
+
+    runner.check("journal/redo",
+                 redone and !journal->can_redo(),
+                 { { "steps", steps },
+                   { "undo_count", journal->undo_count() } });
+
+    auto count_batch = [&](bool journaled) {
+        auto m = make_model<TableModel>(1000);
+        if (journaled) m->enable_journal();
+
+        bench::reset_signals();
+        batch(*m);
+        return bench::signal_count();
+    };
+
+    auto const plain     = count_batch(false);
+    auto const journaled = count_batch(true);
+
+    runner.check("journal/batch_signals",
+                 plain == journaled,
+                 { { "plain", plain }, { "journaled", journaled } });
+}
+
+/// Running totals should match a fresh scan of the column after each kind of
+/// change, including removing the current min and max
+void check_aggregates(bench::Runner& runner) {
+    auto model = make_model<TableModel>(1000);
+
+    auto* value  = model->add_aggregate(&BenchRecord::value);
+    auto* weight = model->add_aggregate(&BenchRecord::weight);
+
+    auto matches = [&](StructAggregate const* a, auto member) {
+        int    count = 0;
+        double sum   = 0;
+        double min   = std::numeric_limits<double>::quiet_NaN();
+        double max   = min;
+
+        for (int i = 0; i < model->rowCount(); i++) {
+            double const v = model->get_at(i)->*member;
+
+            min = count ? std::min(min, v) : v;
+            max = count ? std::max(max, v) : v;
+            sum += v;
+            count++;
+        }
+
+        auto near = [](double x, double y) {
+            if (std::isnan(x) or std::isnan(y)) {
+                return std::isnan(x) and std::isnan(y);
+            }
+            return std::abs(x - y) <= 1e-9 * std::max(1.0, std::abs(y));
+        };
+
+        return a->count() == count and near(a->sum(), sum) and
+               near(a->min(), min) and near(a->max(), max);
+    };
+
+    auto compare = [&](QString const& name, auto&& change) {
+        change(*model);
+
+        runner.check(name,
+                     matches(value, &BenchRecord::value) and
+                         matches(weight, &BenchRecord::weight),
+                     { { "rows", model->rowCount() },
+                       { "sum", value->sum() },
+                       { "min", value->min() },
+                       { "max", value->max() } });
+    };
+
+    compare("aggregate/remove", [](TableModel& m) {
+        m.remove_at(0);
+        m.remove_at(m.rowCount() - 1);
+        m.remove_at(100, 50);
+    });
+
+    compare("aggregate/update", [](TableModel& m) {
+        m.update(5, BenchRecord { "big", 1000000, 1e6, true });
+        m.modify(5, [](BenchRecord& r) { r.value = -7; });
+        m.setData(m.index(10, 2), -0.25);
+    });
+
+    compare("aggregate/insert", [](TableModel& m) {
+        m.insert_at(3, make_records(20));
+        m.append(BenchRecord { "low", -1000, -500.5, false });
+    });
+
+    compare("aggregate/batch", [](TableModel& m) {
+        TableModel::Batch b(&m);
+        m.remove_at(0, 10);
+        m.insert_at(0, make_records(4));
+        m.remove_at(m.rowCount() - 1);
+    });
+
+    compare("aggregate/reset", [](TableModel& m) {
+        m.reset(make_records(10));
+    });
+
+    compare("aggregate/empty",
+            [](TableModel& m) { m.remove_at(0, m.rowCount()); });
+}
+
+/// Reading back an export, from memory or through a file, should give the
+/// same records, including text that needs quoting and awkward numbers
+void check_text_round_trip(bench::Runner& runner) {
+    auto model = make_model<TableModel>(1000);
+
+    model->append(QVector<BenchRecord> {
+        { "comma, separated", 1, 0.1, true },
+        { "\"quoted\" \"\"twice\"\"", -1, 1.0 / 3, false },
+        { "line\nbreak\r\nand\ttab", 2, -0.0, true },
+        { QString::fromUtf8("café 日本 \U0001F600"), 3, 1e300, false },
+        { "back\\slash /", 4, 5e-324, true },
+        { "", std::numeric_limits<int>::min(), -1e-300, false },
+        { "  padded  ", std::numeric_limits<int>::max(), 123456.789, true },
+    });
+
+    auto const expected = records_of(*model);
+
+    using Read = std::optional<QVector<BenchRecord>>;
+
+    auto compare = [&](QString const& name, Read const& read) {
+        runner.check(name,
+                     read and same_records(*read, expected),
+                     { { "rows", read ? read->size() : -1 } });
+    };
+
+    QBuffer csv;
+    csv.open(QIODevice::WriteOnly);
+    export_csv(*model, csv);
+    compare("text/csv", read_csv<BenchRecord>(QByteArrayView(csv.data())));
+
+    QBuffer json;
+    json.open(QIODevice::WriteOnly);
+    export_json(*model, json);
+    compare("text/json", read_json<BenchRecord>(QByteArrayView(json.data())));
+
+    QTemporaryDir dir;
+
+    auto through_file = [&](QString const& file,
+                            auto&&         save,
+                            auto&&         load) -> Read {
+        QString const path = dir.filePath(file);
+
+        TableModel copy;
+        if (!save(*model, path) or !load(copy, path)) return std::nullopt;
+
+        return records_of(copy);
+    };
+
+    compare("text/csv_file",
+            through_file(
+                "records.csv",
+                [](TableModel const& m, QString const& p) {
+                    return export_csv(m, p);
+                },
+                [](TableModel& m, QString const& p) {
+                    return import_csv(m, p);
+                }));
+
+    compare("text/json_file",
+            through_file(
+                "records.json",
+                [](TableModel const& m, QString const& p) {
+                    return export_json(m, p);
+                },
+                [](TableModel& m, QString const& p) {
+                    return import_json(m, p);
+                }));
+}
+
+/// Order-sensitive hash of a model's records, to compare copies held by
+/// different processes
+size_t model_digest(TableModel const& model) {
+    size_t ret = qHash(model.rowCount());
+    for (int i = 0; i < model.rowCount(); i++) {
+        auto const& r = *model.get_at(i);
+        ret = qHashMulti(ret, r.name, r.value, r.weight, r.flag);
+    }
+    return ret;
+}
+
+/// The replica side of check_replication, run in a second process. Follows
+/// the server and answers commands from stdin, one per line:
+///
+///   stall <ms>    reply "stalled", then block the event loop so the server
+///                 gets ahead
+///   digest <seq>  once synced up to seq, reply
+///                 "digest <seq> <resyncs> <rows> <hash>"
+///   quit
+int run_replica(QString const& name) {
+    StructReplica<BenchRecord> replica;
+
+    int resyncs = 0;
+    QObject::connect(
+        &replica, &StructReplicaBase::resynced, [&resyncs]() { resyncs++; });
+
+    QTextStream out(stdout);
+    auto reply = [&out](QString const& line) { out << line << Qt::endl; };
+
+    QObject::connect(&replica, &StructReplicaBase::disconnected, [&reply]() {
+        reply("disconnected");
+    });
+
+    std::optional<quint64> wanted;
+
+    auto answer = [&]() {
+        if (!wanted or !replica.synced() or replica.sequence() < *wanted) {
+            return;
+        }
+
+        reply(QString("digest %1 %2 %3 %4")
+                  .arg(*wanted)
+                  .arg(resyncs)
+                  .arg(replica.model()->rowCount())
+                  .arg(model_digest(*replica.model())));
+        wanted.reset();
+    };
+
+    QTimer poll;
+    poll.callOnTimeout(answer);
+    poll.start(1);
+
+    auto handle = [&](QString const& command) {
+        auto const parts = command.split(' ');
+
+        if (parts[0] == "stall") {
+            reply("stalled");
+            QThread::msleep(parts.value(1).toULong());
+        } else if (parts[0] == "digest") {
+            wanted = parts.value(1).toULongLong();
+            answer();
+        } else if (parts[0] == "quit") {
+            QCoreApplication::quit();
+        }
+    };
+
+    // stdin is read on its own thread so the event loop keeps serving the
+    // socket; the thread ends on quit or when the parent goes away
+    std::thread input([&handle]() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            auto command = QString::fromStdString(line);
+            bool const last = command == "quit";
+
+            QMetaObject::invokeMethod(
+                qApp,
+                [&handle, command]() { handle(command); },
+                Qt::QueuedConnection);
+
+            if (last) return;
+        }
+
+        QMetaObject::invokeMethod(
+            qApp, []() { QCoreApplication::quit(); }, Qt::QueuedConnection);
+    });
+
+    replica.connect_to(name);
+
+    int const ret = QCoreApplication::exec();
+    input.join();
+    return ret;
+}
+
+/// Drives a replica process started by check_replication
+class ReplicaProcess {
+    QProcess m_process;
+
+    /// Wait for a line from the replica, serving the socket meanwhile
+    std::optional<QString> read_line(int timeout_ms) {
+        QDeadlineTimer deadline(timeout_ms);
+
+        while (!m_process.canReadLine()) {
+            if (deadline.hasExpired()) return std::nullopt;
+            if (m_process.state() != QProcess::Running) return std::nullopt;
+
+            QCoreApplication::processEvents();
+            m_process.waitForReadyRead(5);
+        }
+
+        return QString::fromUtf8(m_process.readLine()).trimmed();
+    }
+
+public:
+    struct Digest {
+        int    resyncs = -1;
+        int    rows    = -1;
+        size_t hash    = 0;
+    };
+
+    explicit ReplicaProcess(QString const& name) {
+        m_process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        m_process.start(QCoreApplication::applicationFilePath(),
+                        { "--replica", name });
+    }
+
+    ~ReplicaProcess() {
+        if (m_process.state() == QProcess::NotRunning) return;
+        m_process.kill();
+        m_process.waitForFinished();
+    }
+
+    bool started() { return m_process.waitForStarted(); }
+
+    void send(QString const& command) {
+        m_process.write(command.toUtf8() + '\n');
+    }
+
+    /// Block the replica's event loop for ms, once it says it has stopped
+    bool stall(int ms) {
+        send(QString("stall %1").arg(ms));
+
+        auto const line = read_line(10000);
+        return line and *line == "stalled";
+    }
+
+    /// What the replica holds once it has seen change sequence
+    std::optional<Digest> digest(quint64 sequence) {
+        send(QString("digest %1").arg(sequence));
+
+        auto const line = read_line(60000);
+        if (!line) return std::nullopt;
+
+        auto const parts = line->split(' ');
+        if (parts.size() != 5 or parts[0] != "digest") return std::nullopt;
+
+        return Digest { parts[2].toInt(),
+                        parts[3].toInt(),
+                        size_t(parts[4].toULongLong()) };
+    }
+
+    /// \returns The exit code, or -1 if the replica did not quit cleanly
+    int quit() {
+        send("quit");
+        m_process.closeWriteChannel();
+
+        if (!m_process.waitForFinished(10000)) return -1;
+        if (m_process.exitStatus() != QProcess::NormalExit) return -1;
+        return m_process.exitCode();
+    }
+};
+
+/// Replication across two processes. This process serves a model, and a copy
+/// of the executable started with --replica follows it. After each step the
+/// replica's model is compared with the served one, and its resync count
+/// tells how it caught up.
+void check_replication(bench::Runner& runner, int rows) {
+    QStringList const names { "replica/edits",
+                              "replica/reset",
+                              "replica/sort",
+                              "replica/tail_resync",
+                              "replica/snapshot_resync",
+                              "replica/quit" };
+
+    if (std::none_of(names.begin(), names.end(), [&](QString const& n) {
+            return runner.selected(n);
+        })) {
+        return;
+    }
+
+    int const count = std::min(rows, 10000);
+
+    TableModel model;
+    model.append(make_records(count));
+
+    StructReplicaServer<BenchRecord> server(&model);
+
+    QString const socket_name =
+        QString("QtToolsBench-%1").arg(QCoreApplication::applicationPid());
+
+    if (!server.listen(socket_name)) {
+        runner.check("replica/edits", false, { { "error", "listen failed" } });
+        return;
+    }
+
+    ReplicaProcess replica(socket_name);
+    if (!replica.started()) {
+        runner.check("replica/edits", false, { { "error", "no replica" } });
+        return;
+    }
+
+    int resyncs = 0;
+
+    // times each step, up to the replica having caught up
+    QElapsedTimer timer;
+
+    // compare the replica with the model; it should have resynced the given
+    // number of times since the last step
+    auto compare = [&](QString const& name, int resynced) {
+        auto const got = replica.digest(server.sequence());
+        auto const ms  = timer.elapsed();
+
+        bool const passed = got and got->rows == model.rowCount() and
+                            got->hash == model_digest(model) and
+                            got->resyncs == resyncs + resynced;
+
+        runner.check(name,
+                     passed,
+                     { { "rows", model.rowCount() },
+                       { "replica_rows", got ? got->rows : -1 },
+                       { "resyncs", got ? got->resyncs - resyncs : -1 },
+                       { "sequence", qint64(server.sequence()) },
+                       { "ms", ms } });
+
+        if (got) resyncs = got->resyncs;
+    };
+
+    // the first digest waits for the replica's snapshot
+    if (auto const first = replica.digest(server.sequence())) {
+        resyncs = first->resyncs;
+    }
+
+    // single and batched row changes, each sent as it is made
+    timer.start();
+    {
+        model.insert_at(count / 2, make_records(100));
+        model.remove_at(10, 50);
+
+        for (int i = 0; i < model.rowCount(); i += 7) {
+            model.modify(i, [](BenchRecord& r) {
+                r.value += 1;
+                r.flag = !r.flag;
+            });
+        }
+
+        model.setData(model.index(3, 0), QString("renamed"));
+
+        model.begin_batch();
+        model.append(make_records(20));
+        model.remove_at(0, 5);
+        model.modify(1, [](BenchRecord& r) { r.weight = -1; });
+        model.end_batch();
+    }
+    compare("replica/edits", 0);
+
+    // resets and layout changes go out as snapshots; each is compared on its
+    // own, as snapshots read together count as one resync
+    timer.start();
+    model.reset(make_records(count / 2));
+    compare("replica/reset", 1);
+
+    timer.start();
+    model.sort(1, Qt::DescendingOrder);
+    compare("replica/sort", 1);
+
+    // a replica that stops reading falls behind; with a tail long enough to
+    // cover what it missed, it catches up without a snapshot
+    auto fall_behind = [&]() {
+        replica.stall(300);
+
+        for (int i = 0; i < model.rowCount(); i++) {
+            model.modify(i, [](BenchRecord& r) { r.value++; });
+        }
+    };
+
+    server.set_backlog_limit(16 * 1024);
+
+    timer.start();
+    server.set_tail_limit(64 * 1024 * 1024);
+    fall_behind();
+    compare("replica/tail_resync", 0);
+
+    // with no tail, the gap can only be covered by a snapshot
+    timer.start();
+    server.set_tail_limit(0);
+    fall_behind();
+    compare("replica/snapshot_resync", 1);
+
+    int const code = replica.quit();
+    runner.check("replica/quit", code == 0, { { "exit_code", code } });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // run headless unless told otherwise
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    // the software backend renders without a GPU, so frames can be grabbed
+    // headless
+    QQuickWindow::setGraphicsApi(QSGRendererInterface::Software);
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("QtTools container benchmarks");
+    parser.addHelpOption();
+
+    QCommandLineOption rows_opt(
+        "rows", "Rows per model (default 100000).", "count", "100000");
+    QCommandLineOption repeat_opt(
+        "repeats", "Runs per case (default 5).", "count", "5");
+    QCommandLineOption filter_opt(
+        "filter", "Only run cases whose name contains this.", "text");
+    QCommandLineOption output_opt(
+        "output", "Write the JSON report here instead of stdout.", "file");
+
+    // used by check_replication to start this executable as the replica
+    QCommandLineOption replica_opt(
+        "replica", "Follow the replication server of this name.", "name");
+    replica_opt.setFlags(QCommandLineOption::HiddenFromHelp);
+
+    parser.addOptions(
+        { rows_opt, repeat_opt, filter_opt, output_opt, replica_opt });
+    parser.process(app);
+
+    if (parser.isSet(replica_opt)) {
+        return run_replica(parser.value(replica_opt));
+    }
+
+    int const rows = std::max(parser.value(rows_opt).toInt(), 1);
+
+    bench::Runner runner(parser.value(filter_opt),
+                         parser.value(repeat_opt).toInt());
+
+    bench_dispatch(runner, rows);
+    bench_data(runner, rows);
+    bench_set_data(runner, rows);
+    bench_structure(runner, rows);
+    bench_sort(runner, rows);
+    bench_fan_out(runner, rows);
+    bench_list_storage<SmartList<int>>(runner, "flat", rows);
+    bench_list_storage<ChunkedSmartList<int>>(runner, "chunked", rows);
+    bench_role_for_member(runner);
+    bench_tree(runner, rows);
+    bench_rounded_image(runner, rows);
+    bench_layout<TableModel>(runner, "row", rows);
+    bench_layout<ColumnModel>(runner, "column", rows);
+    check_bulk_load(runner);
+    check_journal(runner);
+    check_aggregates(runner);
+    check_text_round_trip(runner);
+    check_replication(runner, rows);
+
+    QJsonObject meta;
+    meta["qt_version"] = QString::fromUtf8(qVersion());
+    meta["platform"]   = QGuiApplication::platformName();
+    meta["rows"]       = rows;
+    meta["timestamp"]  = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+
+    auto const json = QJsonDocument(runner.report(meta)).toJson();
+
+    if (parser.isSet(output_opt)) {
+        QFile file(parser.value(output_opt));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Unable to write" << file.fileName();
+            return 2;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return runner.failed() ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+///
+/// \brief The MPSCQueue class is an unbounded, lock-free queue that any number
+/// of threads can push into, and a single thread pops from.
+///
+/// This is the intrusive node queue described by Dmitry Vyukov. A push is one
+/// atomic exchange. A pop can briefly report empty while a push is half done;
+/// the item shows up on a later pop.
+///
+template <class T>
+class MPSCQueue {
+    struct NodeBase {
+        std::atomic<NodeBase*> next { nullptr };
+    };
+
+    struct Node : NodeBase {
+        T value;
+
+        explicit Node(T&& v) : value(std::move(v)) { }
+    };
+
+    std::atomic<NodeBase*> m_head; // producers push here
+    NodeBase*              m_tail; // consumer pops here
+    NodeBase               m_stub;
+
+    void push_node(NodeBase* n) {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        NodeBase* prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    T take(NodeBase* n) {
+        auto* node = static_cast<Node*>(n);
+        T     ret  = std::move(node->value);
+        delete node;
+        return ret;
+    }
+
+public:
+    MPSCQueue() : m_head(&m_stub), m_tail(&m_stub) { }
+
+    ~MPSCQueue() {
+        while (pop()) { }
+    }
+
+    MPSCQueue(MPSCQueue const&)            = delete;
+    MPSCQueue& operator=(MPSCQueue const&) = delete;
+
+    /// Add an item. Safe to call from any thread.
+    void push(T value) { push_node(new Node(std::move(value))); }
+
+    /// Take the oldest item. Only one thread may pop.
+    std::optional<T> pop() {
+        NodeBase* tail = m_tail;
+        NodeBase* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (!next) return {};
+            m_tail = next;
+            tail   = next;
+            next   = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            return take(tail);
+        }
+
+        // a producer is between the exchange and linking; try again later
+        if (tail != m_head.load(std::memory_order_acquire)) return {};
+
+        push_node(&m_stub);
+
+        next = tail->next.load(std::memory_order_acquire);
+
+        if (next) {
+            m_tail = next;
+            return take(tail);
+        }
+
+        return {};
+    }
+};
@@ -0,0 +1,561 @@
+#include "roundedimage.h"
+
+#include <QBuffer>
+#include <QCache>
+#include <QDebug>
+#include <QFile>
+#include <QFuture>
+#include <QImageReader>
+#include <QMutex>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPainter>
+#include <QPromise>
+#include <QQmlContext>
+#include <QQmlEngine>
+#include <QQmlFile>
+#include <QQuickImageProvider>
+#include <QQuickWindow>
+#include <QSGImageNode>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <memory>
+
+namespace rounded_image_detail {
+
+namespace {
+
+struct MaskKey {
+    QSize size;
+    // in quarter pixels, so nearly equal radii share a mask
+    int radius;
+
+    bool operator==(MaskKey const&) const = default;
+};
+
+size_t qHash(MaskKey const& key, size_t seed = 0) {
+    return qHashMulti(seed, key.size.width(), key.size.height(), key.radius);
+}
+
+struct MaskCache {
+    QMutex                  lock;
+    QCache<MaskKey, QImage> masks { 16 * 1024 * 1024 };
+};
+
+// render threads of several windows may ask at once
+MaskCache& mask_cache() {
+    static MaskCache ret;
+    return ret;
+}
+
+QImage scaled(QImage const& image, QSize size, Qt::TransformationMode mode) {
+    if (size.isEmpty()) return {};
+    if (image.size() == size) return image;
+    return image.scaled(size, Qt::IgnoreAspectRatio, mode);
+}
+
+/// Fill the canvas with copies of tile, centered as an Image aligns them
+void paint_tiles(QPainter& painter, QSize canvas, QImage const& tile) {
+    if (tile.isNull()) return;
+
+    painter.setBrushOrigin(QPointF((canvas.width() - tile.width()) / 2.0,
+                                   (canvas.height() - tile.height()) / 2.0));
+    painter.fillRect(QRect(QPoint(), canvas), QBrush(tile));
+}
+
+} // namespace
+
+QImage rounded_mask(QSize size, qreal radius) {
+    radius = std::min({ radius, size.width() / 2.0, size.height() / 2.0 });
+
+    MaskKey const key { size, qRound(radius * 4) };
+
+    auto& cache = mask_cache();
+
+    {
+        QMutexLocker locker(&cache.lock);
+        if (auto* hit = cache.masks.object(key)) return *hit;
+    }
+
+    QImage mask(size, QImage::Format_ARGB32_Premultiplied);
+    mask.fill(Qt::transparent);
+
+    {
+        QPainter painter(&mask);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(Qt::white);
+
+        qreal const r = key.radius / 4.0;
+        painter.drawRoundedRect(QRectF(QPointF(), size), r, r);
+    }
+
+    QMutexLocker locker(&cache.lock);
+    cache.masks.insert(key, new QImage(mask), mask.sizeInBytes());
+
+    return mask;
+}
+
+QImage compose(QImage const& image,
+               QSize        size,
+               qreal        radius,
+               int          fill_mode,
+               qreal        dpr,
+               bool         smooth) {
+    auto const mode = smooth ? Qt::SmoothTransformation
+                             : Qt::FastTransformation;
+
+    QImage canvas(size, QImage::Format_ARGB32_Premultiplied);
+    canvas.fill(Qt::transparent);
+
+    QPainter painter(&canvas);
+
+    // the image as it would be drawn unscaled, in device pixels
+    QSize const natural = (image.deviceIndependentSize() * dpr).toSize();
+
+    auto centered = [&](QImage const& part) {
+        painter.drawImage(QPointF((size.width() - part.width()) / 2.0,
+                                  (size.height() - part.height()) / 2.0),
+                          part);
+    };
+
+    switch (fill_mode) {
+    case RoundedImage::Stretch:
+        painter.drawImage(0, 0, scaled(image, size, mode));
+        break;
+
+    case RoundedImage::PreserveAspectFit:
+        centered(scaled(
+            image, image.size().scaled(size, Qt::KeepAspectRatio), mode));
+        break;
+
+    case RoundedImage::PreserveAspectCrop: {
+        // scale only the part that shows, not the whole image
+        qreal const scale =
+            std::max(qreal(size.width()) / image.width(),
+                     qreal(size.height()) / image.height());
+
+        QSizeF const shown(size.width() / scale, size.height() / scale);
+
+        QRectF part(QPointF(), shown);
+        part.moveCenter(QRectF(image.rect()).center());
+
+        painter.drawImage(
+            0, 0, scaled(image.copy(part.toAlignedRect()), size, mode));
+        break;
+    }
+
+    case RoundedImage::Tile:
+        paint_tiles(painter, size, scaled(image, natural, mode));
+        break;
+
+    case RoundedImage::TileVertically:
+        paint_tiles(painter,
+                    size,
+                    scaled(image, { size.width(), natural.height() }, mode));
+        break;
+
+    case RoundedImage::TileHorizontally:
+        paint_tiles(painter,
+                    size,
+                    scaled(image, { natural.width(), size.height() }, mode));
+        break;
+
+    case RoundedImage::Pad:
+        centered(scaled(image, natural, mode));
+        break;
+    }
+
+    if (radius > 0) {
+        painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+        painter.drawImage(0, 0, rounded_mask(size, radius));
+    }
+
+    painter.end();
+
+    return canvas;
+}
+
+} // namespace rounded_image_detail
+
+using namespace rounded_image_detail;
+
+namespace {
+
+// decoded sources, shared by every item; only touched on the GUI thread
+QCache<QString, QImage>& image_cache() {
+    static QCache<QString, QImage> ret { 64 * 1024 * 1024 };
+    return ret;
+}
+
+QString cache_key(QUrl const& url, bool auto_transform) {
+    return (auto_transform ? QStringLiteral("t:") : QStringLiteral("n:")) +
+           url.toString();
+}
+
+QImage read_image(QIODevice& device, bool auto_transform) {
+    QImageReader reader(&device);
+    reader.setAutoTransform(auto_transform);
+
+    QImage ret;
+
+    if (!reader.read(&ret)) {
+        qWarning() << "Unable to read image:" << reader.errorString();
+    }
+
+    return ret;
+}
+
+} // namespace
+
+RoundedImage::RoundedImage(QQuickItem* parent) : QQuickItem(parent) {
+    setFlag(ItemHasContents);
+
+    connect(this, &QQuickItem::smoothChanged, this, &RoundedImage::invalidate);
+}
+
+RoundedImage::~RoundedImage() {
+    cancel();
+}
+
+void RoundedImage::set_source(QUrl const& source) {
+    if (m_source == source) return;
+    m_source = source;
+    emit source_changed();
+
+    if (isComponentComplete()) load();
+}
+
+void RoundedImage::set_radius(qreal radius) {
+    if (m_radius == radius) return;
+    m_radius = radius;
+    emit radius_changed();
+
+    invalidate();
+}
+
+void RoundedImage::set_fill_mode(FillMode mode) {
+    if (m_fill_mode == mode) return;
+    m_fill_mode = mode;
+    emit fill_mode_changed();
+
+    invalidate();
+}
+
+void RoundedImage::set_asynchronous(bool on) {
+    if (m_asynchronous == on) return;
+    m_asynchronous = on;
+    emit asynchronous_changed();
+}
+
+void RoundedImage::set_cache(bool on) {
+    if (m_cache == on) return;
+    m_cache = on;
+    emit cache_changed();
+}
+
+void RoundedImage::set_auto_transform(bool on) {
+    if (m_auto_transform == on) return;
+    m_auto_transform = on;
+    emit auto_transform_changed();
+
+    if (isComponentComplete()) load();
+}
+
+void RoundedImage::set_mipmap(bool on) {
+    if (m_mipmap == on) return;
+    m_mipmap = on;
+    emit mipmap_changed();
+
+    invalidate();
+}
+
+void RoundedImage::set_cache_limit(qsizetype bytes) {
+    image_cache().setMaxCost(std::max<qsizetype>(bytes, 0));
+}
+
+qsizetype RoundedImage::cache_limit() {
+    return image_cache().maxCost();
+}
+
+void RoundedImage::set_status(Status status) {
+    if (m_status == status) return;
+    m_status = status;
+    emit status_changed();
+}
+
+void RoundedImage::set_progress(qreal progress) {
+    if (m_progress == progress) return;
+    m_progress = progress;
+    emit progress_changed();
+}
+
+void RoundedImage::invalidate() {
+    m_dirty = true;
+    update();
+}
+
+void RoundedImage::cancel() {
+    m_generation++;
+
+    // aborting finishes the reply at once; the bumped generation drops it
+    if (m_reply) {
+        m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+    }
+}
+
+void RoundedImage::load() {
+    cancel();
+
+    if (m_source.isEmpty()) {
+        m_image = {};
+        set_progress(0);
+        set_status(Null);
+        invalidate();
+        return;
+    }
+
+    auto*      context = qmlContext(this);
+    QUrl const url = context ? context->resolvedUrl(m_source) : m_source;
+
+    bool const auto_transform = m_auto_transform;
+
+    m_cache_key = cache_key(url, auto_transform);
+
+    if (m_cache) {
+        if (auto* hit = image_cache().object(m_cache_key)) {
+            finish(m_generation, *hit);
+            return;
+        }
+    }
+
+    set_progress(0);
+    set_status(Loading);
+
+    if (QQmlFile::isLocalFile(url)) {
+        QString const path = QQmlFile::urlToLocalFileOrQrc(url);
+
+        start([path, auto_transform]() {
+            QFile file(path);
+            if (!file.open(QIODevice::ReadOnly)) {
+                qWarning() << "Unable to open image" << path;
+                return QImage();
+            }
+            return read_image(file, auto_transform);
+        });
+        return;
+    }
+
+    auto* engine = qmlEngine(this);
+
+    if (!engine) {
+        qWarning() << "RoundedImage needs a QML engine to load" << url;
+        finish(m_generation, {});
+        return;
+    }
+
+    quint64 const generation = m_generation;
+
+    if (url.scheme() == QLatin1String("image")) {
+        auto* provider = qobject_cast<QQuickImageProvider*>(
+            engine->imageProvider(url.host()));
+
+        if (!provider) {
+            qWarning() << "No image provider for" << url;
+            finish(generation, {});
+            return;
+        }
+
+        QString const id =
+            url.toString(QUrl::RemoveScheme | QUrl::RemoveAuthority).mid(1);
+
+        switch (provider->imageType()) {
+        case QQmlImageProviderBase::Image:
+            start([provider, id]() {
+                QSize size;
+                return provider->requestImage(id, &size, {});
+            });
+            break;
+
+        case QQmlImageProviderBase::Pixmap: {
+            QSize size;
+            finish(generation,
+                   provider->requestPixmap(id, &size, {}).toImage());
+            break;
+        }
+
+        case QQmlImageProviderBase::Texture: {
+            QSize size;
+            std::unique_ptr<QQuickTextureFactory> factory(
+                provider->requestTexture(id, &size, {}));
+            finish(generation, factory ? factory->image() : QImage());
+            break;
+        }
+
+        case QQmlImageProviderBase::ImageResponse: {
+            auto* response = static_cast<QQuickAsyncImageProvider*>(provider)
+                                 ->requestImageResponse(id, {});
+
+            connect(response,
+                    &QQuickImageResponse::finished,
+                    this,
+                    [this, response, generation]() {
+                        response->deleteLater();
+
+                        std::unique_ptr<QQuickTextureFactory> factory(
+                            response->textureFactory());
+
+                        bool const ok = factory and
+                                        response->errorString().isEmpty();
+
+                        finish(generation, ok ? factory->image() : QImage());
+                    });
+            break;
+        }
+
+        default:
+            finish(generation, {});
+            break;
+        }
+        return;
+    }
+
+    auto* reply = engine->networkAccessManager()->get(QNetworkRequest(url));
+    m_reply     = reply;
+
+    connect(reply,
+            &QNetworkReply::downloadProgress,
+            this,
+            [this, generation](qint64 received, qint64 total) {
+                if (generation != m_generation or total <= 0) return;
+                set_progress(qreal(received) / total);
+            });
+
+    connect(reply,
+            &QNetworkReply::finished,
+            this,
+            [this, reply, generation, auto_transform]() {
+                reply->deleteLater();
+
+                if (generation != m_generation) return;
+                m_reply = nullptr;
+
+                if (reply->error() != QNetworkReply::NoError) {
+                    qWarning() << "Unable to fetch image" << reply->url()
+                               << reply->errorString();
+                    finish(generation, {});
+                    return;
+                }
+
+                start([data = reply->readAll(), auto_transform]() {
+                    QBuffer buffer;
+                    buffer.setData(data);
+                    buffer.open(QIODevice::ReadOnly);
+                    return read_image(buffer, auto_transform);
+                });
+            });
+}
+
+void RoundedImage::start(std::function<QImage()> job) {
+    quint64 const generation = m_generation;
+
+    if (!m_asynchronous) {
+        finish(generation, job());
+        return;
+    }
+
+    // the continuation is skipped if this item is gone by then
+    auto promise = std::make_shared<QPromise<QImage>>();
+
+    promise->future().then(this, [this, generation](QImage image) {
+        finish(generation, std::move(image));
+    });
+
+    QThreadPool::globalInstance()->start([promise, job = std::move(job)]() {
+        promise->start();
+        promise->addResult(job());
+        promise->finish();
+    });
+}
+
+void RoundedImage::finish(quint64 generation, QImage image) {
+    if (generation != m_generation) return;
+
+    if (image.isNull()) {
+        m_image = {};
+        set_status(Error);
+        invalidate();
+        return;
+    }
+
+    if (m_cache and !image_cache().contains(m_cache_key)) {
+        image_cache().insert(
+            m_cache_key, new QImage(image), image.sizeInBytes());
+    }
+
+    m_image = std::move(image);
+
+    set_progress(1);
+    set_status(Ready);
+    invalidate();
+}
+
+void RoundedImage::componentComplete() {
+    QQuickItem::componentComplete();
+    load();
+}
+
+void RoundedImage::itemChange(ItemChange change, ItemChangeData const& value) {
+    // the texture is made in device pixels
+    if (change == ItemDevicePixelRatioHasChanged) update();
+
+    QQuickItem::itemChange(change, value);
+}
+
+void RoundedImage::geometryChange(QRectF const& new_geometry,
+                                  QRectF const& old_geometry) {
+    QQuickItem::geometryChange(new_geometry, old_geometry);
+
+    if (new_geometry.size() != old_geometry.size()) update();
+}
+
+QSGNode* RoundedImage::updatePaintNode(QSGNode* old, UpdatePaintNodeData*) {
+    auto* node = static_cast<QSGImageNode*>(old);
+
+    qreal const dpr    = window()->effectiveDevicePixelRatio();
+    QSize const pixels = (size() * dpr).toSize();
+
+    if (m_image.isNull() or pixels.isEmpty()) {
+        delete node;
+        return nullptr;
+    }
+
+    if (!node) {
+        node = window()->createImageNode();
+        node->setOwnsTexture(true);
+        m_dirty = true;
+    }
+
+    if (m_dirty or node->texture()->textureSize() != pixels) {
+        QQuickWindow::CreateTextureOptions options;
+        if (m_mipmap) options |= QQuickWindow::TextureHasMipmaps;
+
+        // the node deletes the texture it replaces
+        node->setTexture(window()->createTextureFromImage(
+            compose(
+                m_image, pixels, m_radius * dpr, m_fill_mode, dpr, smooth()),
+            options));
+        m_dirty = false;
+    }
+
+    auto const filtering = smooth() ? QSGTexture::Linear : QSGTexture::Nearest;
+
+    node->setRect(boundingRect());
+    node->setFiltering(filtering);
+    node->setMipmapFiltering(m_mipmap ? filtering : QSGTexture::None);
+
+    return node;
+}
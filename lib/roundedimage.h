@@ -0,0 +1,174 @@
+#pragma once
+
+#include <QImage>
+#include <QPointer>
+#include <QQuickItem>
+#include <QUrl>
+#include <QtQml/qqmlregistration.h>
+
+#include <functional>
+
+class QNetworkReply;
+
+namespace rounded_image_detail {
+
+/// Draw image into a canvas of size device pixels, laid out as an Image with
+/// the given fill mode would, and cut the corners to radius device pixels.
+QImage compose(QImage const& image,
+               QSize        size,
+               qreal        radius,
+               int          fill_mode,
+               qreal        dpr,
+               bool         smooth);
+
+/// An antialiased rounded rectangle in the alpha channel. Masks are cached
+/// and shared between all callers asking for the same size and radius.
+QImage rounded_mask(QSize size, qreal radius);
+
+} // namespace rounded_image_detail
+
+///
+/// \brief The RoundedImage class draws an image with rounded corners.
+///
+/// The image is laid out into a texture the size of the item and cut to shape
+/// with an antialiased alpha mask, so each item is a single scene graph node
+/// and needs no offscreen layers. This works the same on every backend,
+/// including the software one. The texture is redone only when the image,
+/// size, radius or fill mode change.
+///
+/// Sources are loaded from files, resources, the network and image providers.
+/// With cache set, decoded images are shared between items with the same
+/// source.
+///
+class RoundedImage : public QQuickItem {
+    Q_OBJECT
+    QML_ELEMENT
+
+    Q_PROPERTY(QUrl source READ source WRITE set_source NOTIFY source_changed)
+    Q_PROPERTY(qreal radius READ radius WRITE set_radius NOTIFY radius_changed)
+    Q_PROPERTY(FillMode fillMode READ fill_mode WRITE set_fill_mode NOTIFY
+                   fill_mode_changed)
+    Q_PROPERTY(bool asynchronous READ asynchronous WRITE set_asynchronous
+                   NOTIFY asynchronous_changed)
+    Q_PROPERTY(bool cache READ cache WRITE set_cache NOTIFY cache_changed)
+    Q_PROPERTY(bool autoTransform READ auto_transform WRITE set_auto_transform
+                   NOTIFY auto_transform_changed)
+    Q_PROPERTY(bool mipmap READ mipmap WRITE set_mipmap NOTIFY mipmap_changed)
+    Q_PROPERTY(Status status READ status NOTIFY status_changed)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progress_changed)
+
+public:
+    /// Same values as Image.FillMode, so either can be assigned
+    enum FillMode {
+        Stretch,
+        PreserveAspectFit,
+        PreserveAspectCrop,
+        Tile,
+        TileVertically,
+        TileHorizontally,
+        Pad,
+    };
+    Q_ENUM(FillMode)
+
+    /// Same values as Image.Status
+    enum Status {
+        Null,
+        Ready,
+        Loading,
+        Error,
+    };
+    Q_ENUM(Status)
+
+private:
+    QUrl     m_source;
+    qreal    m_radius         = 0;
+    FillMode m_fill_mode      = Stretch;
+    bool     m_asynchronous   = false;
+    bool     m_cache          = true;
+    bool     m_auto_transform = false;
+    bool     m_mipmap         = false;
+    Status   m_status         = Null;
+    qreal    m_progress       = 0;
+
+    QImage  m_image;
+    QString m_cache_key;
+
+    // bumped on every load, so late results from an older source are dropped
+    quint64 m_generation = 0;
+
+    QPointer<QNetworkReply> m_reply;
+
+    // the texture needs redoing at the next sync
+    bool m_dirty = true;
+
+    void load();
+    void cancel();
+
+    /// Run job, on the thread pool if asynchronous, and take its image
+    void start(std::function<QImage()> job);
+
+    void finish(quint64 generation, QImage image);
+
+    void set_status(Status status);
+    void set_progress(qreal progress);
+
+    void invalidate();
+
+protected:
+    void componentComplete() override;
+
+    void itemChange(ItemChange change, ItemChangeData const& value) override;
+
+    void geometryChange(QRectF const& new_geometry,
+                        QRectF const& old_geometry) override;
+
+    QSGNode* updatePaintNode(QSGNode* old, UpdatePaintNodeData*) override;
+
+public:
+    explicit RoundedImage(QQuickItem* parent = nullptr);
+    ~RoundedImage() override;
+
+    QUrl source() const { return m_source; }
+    void set_source(QUrl const& source);
+
+    qreal radius() const { return m_radius; }
+    void  set_radius(qreal radius);
+
+    FillMode fill_mode() const { return m_fill_mode; }
+    void     set_fill_mode(FillMode mode);
+
+    /// Decode off the GUI thread. Network sources are always fetched in the
+    /// background.
+    bool asynchronous() const { return m_asynchronous; }
+    void set_asynchronous(bool on);
+
+    /// Share decoded images with other items using the same source
+    bool cache() const { return m_cache; }
+    void set_cache(bool on);
+
+    /// Apply the orientation stored in the image, such as EXIF rotation
+    bool auto_transform() const { return m_auto_transform; }
+    void set_auto_transform(bool on);
+
+    /// Filter through mipmaps, for items drawn scaled down, as Image.mipmap
+    bool mipmap() const { return m_mipmap; }
+    void set_mipmap(bool on);
+
+    Status status() const { return m_status; }
+    qreal  progress() const { return m_progress; }
+
+    /// Images held in the shared cache, across all items
+    static void      set_cache_limit(qsizetype bytes);
+    static qsizetype cache_limit();
+
+signals:
+    void source_changed();
+    void radius_changed();
+    void fill_mode_changed();
+    void asynchronous_changed();
+    void cache_changed();
+    void auto_transform_changed();
+    void mipmap_changed();
+    void status_changed();
+    void progress_changed();
+};
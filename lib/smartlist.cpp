@@ -1,7 +1,238 @@
 #include "smartlist.h"
 
+#include <algorithm>
+#include <vector>
+
 /// To reduce linker pain, we anchor virtual here.
 
 SmartListBase::SmartListBase(QObject* parent) : QObject(parent) { }
 
 SmartListBase::~SmartListBase() = default;
+
+void SmartListBase::schedule_publish() {
+    if (m_publish_scheduled) return;
+    m_publish_scheduled = true;
+
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            m_publish_scheduled = false;
+            publish_snapshot();
+        },
+        Qt::QueuedConnection);
+}
+
+namespace smart_list_detail {
+
+bool ChangeTracker::can_merge(Run const& a, Run const& b) {
+    if (a.added() or b.added()) return a.added() and b.added();
+    return a.updated == b.updated and a.origin + a.count == b.origin;
+}
+
+// Make a run start at pos, returning the index of that run
+size_t ChangeTracker::split_at(qsizetype pos) {
+    if (pos < m_cursor_start or m_cursor > m_runs.size()) {
+        m_cursor       = 0;
+        m_cursor_start = 0;
+    }
+
+    size_t    i     = m_cursor;
+    qsizetype start = m_cursor_start;
+
+    while (i < m_runs.size() and start + m_runs[i].count <= pos) {
+        start += m_runs[i].count;
+        i++;
+    }
+
+    if (i < m_runs.size() and pos > start) {
+        auto&     run  = m_runs[i];
+        qsizetype head = pos - start;
+
+        Run tail { run.added() ? -1 : run.origin + head,
+                   run.count - head,
+                   run.updated };
+
+        run.count = head;
+        m_runs.insert(m_runs.begin() + i + 1, tail);
+        i++;
+    }
+
+    m_cursor       = i;
+    m_cursor_start = pos;
+    return i;
+}
+
+// Merge neighbouring runs in [first, last], leaving the cursor at first.
+// start is where run first begins.
+void ChangeTracker::settle(size_t first, size_t last, qsizetype start) {
+    last = std::min(last, m_runs.size() - 1);
+
+    for (size_t k = last; k > first and k < m_runs.size(); k--) {
+        if (can_merge(m_runs[k - 1], m_runs[k])) {
+            m_runs[k - 1].count += m_runs[k].count;
+            m_runs.erase(m_runs.begin() + k);
+        }
+    }
+
+    m_cursor       = first;
+    m_cursor_start = start;
+}
+
+// Index of the run before i, and where it starts. i starts at pos.
+std::pair<size_t, qsizetype> ChangeTracker::before(size_t    i,
+                                                   qsizetype pos) const {
+    if (i == 0) return { 0, 0 };
+    return { i - 1, pos - m_runs[i - 1].count };
+}
+
+ChangeTracker::ChangeTracker(qsizetype size) {
+    if (size > 0) m_runs.push_back({ 0, size, false });
+}
+
+void ChangeTracker::insert(qsizetype pos, qsizetype count) {
+    if (count <= 0) return;
+
+    size_t i = split_at(pos);
+    m_runs.insert(m_runs.begin() + i, Run { -1, count, false });
+
+    auto [first, start] = before(i, pos);
+    settle(first, i + 1, start);
+}
+
+void ChangeTracker::remove(qsizetype pos, qsizetype count) {
+    if (count <= 0) return;
+
+    size_t i = split_at(pos);
+    size_t j = split_at(pos + count);
+
+    for (size_t k = i; k < j; k++) {
+        auto const& run = m_runs[k];
+        if (!run.added()) {
+            m_deleted.emplace_back(run.origin, run.origin + run.count);
+        }
+    }
+
+    m_runs.erase(m_runs.begin() + i, m_runs.begin() + j);
+
+    if (m_runs.empty()) {
+        m_cursor       = 0;
+        m_cursor_start = 0;
+        return;
+    }
+
+    auto [first, start] = before(i, pos);
+    settle(first, i, start);
+}
+
+void ChangeTracker::update(qsizetype pos, qsizetype count) {
+    if (count <= 0) return;
+
+    size_t i = split_at(pos);
+    size_t j = split_at(pos + count);
+
+    // added items will be reported whole, with their latest values
+    for (size_t k = i; k < j; k++) {
+        m_runs[k].updated = true;
+    }
+
+    auto [first, start] = before(i, pos);
+    settle(first, j, start);
+}
+
+std::vector<Change> ChangeTracker::changes() const {
+    std::vector<Change> ret;
+
+    // removals first, from the back, so each range is still valid when it is
+    // applied
+    auto deleted = m_deleted;
+    std::sort(deleted.begin(), deleted.end());
+
+    std::vector<std::pair<qsizetype, qsizetype>> merged;
+    for (auto const& range : deleted) {
+        if (!merged.empty() and merged.back().second == range.first) {
+            merged.back().second = range.second;
+        } else {
+            merged.push_back(range);
+        }
+    }
+
+    for (auto it = merged.rbegin(); it != merged.rend(); ++it) {
+        ret.push_back({ Change::Deleted, it->first, it->second });
+    }
+
+    // then additions, from the front, so each lands between items that are
+    // already where they will end up
+    qsizetype pos = 0;
+    for (auto const& run : m_runs) {
+        if (run.added()) {
+            ret.push_back({ Change::Added, pos, pos + run.count });
+        }
+        pos += run.count;
+    }
+
+    // and finally changes to the items that stayed
+    pos = 0;
+    for (auto const& run : m_runs) {
+        if (!run.added() and run.updated) {
+            if (!ret.empty() and ret.back().kind == Change::Updated and
+                ret.back().end_1 == pos) {
+                ret.back().end_1 = pos + run.count;
+            } else {
+                ret.push_back({ Change::Updated, pos, pos + run.count });
+            }
+        }
+        pos += run.count;
+    }
+
+    return ret;
+}
+
+} // namespace smart_list_detail
+
+void SmartListBase::report_added(qsizetype begin, qsizetype end_1) {
+    if (m_tracker) return m_tracker->insert(begin, end_1 - begin);
+    emit index_added(begin, end_1);
+}
+
+void SmartListBase::report_updated(qsizetype begin, qsizetype end_1) {
+    if (m_tracker) return m_tracker->update(begin, end_1 - begin);
+    emit index_updated(begin, end_1);
+}
+
+void SmartListBase::report_deleted(qsizetype begin, qsizetype end_1) {
+    if (m_tracker) return m_tracker->remove(begin, end_1 - begin);
+    emit index_deleted(begin, end_1);
+}
+
+void SmartListBase::begin_batch() {
+    if (m_batch_depth++ == 0) {
+        using smart_list_detail::ChangeTracker;
+        m_tracker = std::make_unique<ChangeTracker>(item_count());
+    }
+}
+
+void SmartListBase::end_batch() {
+    Q_ASSERT(m_batch_depth > 0);
+
+    if (m_batch_depth <= 0) return;
+
+    if (--m_batch_depth > 0) return;
+
+    auto tracker = std::move(m_tracker);
+
+    using smart_list_detail::Change;
+
+    for (auto const& change : tracker->changes()) {
+        switch (change.kind) {
+        case Change::Added:
+            emit index_added(change.begin, change.end_1);
+            break;
+        case Change::Updated:
+            emit index_updated(change.begin, change.end_1);
+            break;
+        case Change::Deleted:
+            emit index_deleted(change.begin, change.end_1);
+            break;
+        }
+    }
+}
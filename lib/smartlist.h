@@ -1,15 +1,137 @@
 #pragma once
 
+#include "smartlistsnapshot.h"
+#include "smartliststorage.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include <span>
+#include <vector>
 
 #include <QDebug>
 #include <QObject>
 
+namespace smart_list_detail {
+
+/// A range of items that was added, updated or removed
+struct Change {
+    enum Kind { Added, Updated, Deleted };
+
+    Kind      kind;
+    qsizetype begin;
+    qsizetype end_1;
+};
+
+///
+/// \brief The ChangeTracker class merges a run of list changes into as few
+/// ranges as possible.
+///
+/// The list is followed as runs of items. Each run is either items that were
+/// in the list when tracking began, in their original order, or items added
+/// since. Original items that were removed are noted as they go.
+///
+class ChangeTracker {
+    struct Run {
+        qsizetype origin; // first original index, or -1 for added items
+        qsizetype count;
+        bool      updated;
+
+        bool added() const { return origin < 0; }
+    };
+
+    std::vector<Run> m_runs;
+
+    // original index ranges that were removed
+    std::vector<std::pair<qsizetype, qsizetype>> m_deleted;
+
+    // last run looked at, and where it starts. Most changes touch the list in
+    // order, so lookups start from here.
+    size_t    m_cursor       = 0;
+    qsizetype m_cursor_start = 0;
+
+    static bool can_merge(Run const& a, Run const& b);
+
+    size_t split_at(qsizetype pos);
+    void   settle(size_t first, size_t last, qsizetype start);
+
+    std::pair<size_t, qsizetype> before(size_t i, qsizetype pos) const;
+
+public:
+    /// Start tracking a list of the given size
+    explicit ChangeTracker(qsizetype size);
+
+    /// Note changes, with indices as the list signals carry them
+    void insert(qsizetype pos, qsizetype count);
+    void remove(qsizetype pos, qsizetype count);
+    void update(qsizetype pos, qsizetype count);
+
+    /// The merged changes. Removals come first, highest first and in terms of
+    /// the list before tracking began; then additions, lowest first and in
+    /// terms of the list now; then updates, also in terms of the list now.
+    /// Applied in this order they turn the old list into the new one. Items
+    /// both added and removed do not appear at all.
+    std::vector<Change> changes() const;
+};
+
+} // namespace smart_list_detail
+
 class SmartListBase : public QObject {
     Q_OBJECT
+
+    bool m_publish_scheduled = false;
+
+    // Follows changes made during a batch, so they can be reported merged
+    int                                              m_batch_depth = 0;
+    std::unique_ptr<smart_list_detail::ChangeTracker> m_tracker;
+
+protected:
+    /// Arrange for publish_snapshot() to run once control returns to the event
+    /// loop. Calls made before then are folded into one.
+    void schedule_publish();
+
+    virtual void publish_snapshot() { }
+
+    /// Number of items, used to start following a batch
+    virtual qsizetype item_count() const = 0;
+
+    /// Report a change, with the same ranges as the matching signal. Outside
+    /// of a batch, the signal is emitted right away.
+    void report_added(qsizetype begin, qsizetype end_1);
+    void report_updated(qsizetype begin, qsizetype end_1);
+    void report_deleted(qsizetype begin, qsizetype end_1);
+
 public:
     explicit SmartListBase(QObject* parent = nullptr);
     virtual ~SmartListBase();
+
+    ///
+    /// \brief The Batch class holds a batch open for its lifetime
+    ///
+    class [[nodiscard]] Batch {
+        SmartListBase* m_list;
+
+    public:
+        explicit Batch(SmartListBase* l) : m_list(l) { m_list->begin_batch(); }
+        ~Batch() { m_list->end_batch(); }
+
+        Batch(Batch const&)            = delete;
+        Batch& operator=(Batch const&) = delete;
+    };
+
+    /// Hold back change signals until the batch ends. Batches can nest; the
+    /// signals go out when the outermost one ends.
+    ///
+    /// Changes are then reported merged, as ChangeTracker::changes() gives
+    /// them: removed ranges first, then added, then updated.
+    void begin_batch();
+
+    /// Finish a batch, emitting the merged signals
+    void end_batch();
+
+    /// Open a batch for the lifetime of the returned object
+    Batch batch() { return Batch(this); }
+
 signals:
     /// Report when items were added. Indicies are provided from beginning to
     /// end, exclusive
@@ -26,17 +148,64 @@ signals:
 /// \brief The SmartList class is a stripped down model class, which can notify
 /// listeners on changes and updates
 ///
-template <class T>
+/// Items live in a FlatStorage by default. For long lists that are edited in
+/// the middle, use ChunkedSmartList instead.
+///
+template <class T, class Storage = smart_list_detail::FlatStorage<T>>
 class SmartList : public SmartListBase {
-    QList<T> m_storage;
+    Storage m_storage;
+
+    quint64 m_version = 0;
+
+    // Snapshot publishing, only set up once someone asks for snapshots
+    struct Snapshots {
+        std::shared_ptr<SmartListSnapshotSource<T>> source;
+        std::vector<smart_list_detail::ChunkPtr<T>> chunks;
+
+        // items from here on moved or changed since the last publish
+        qsizetype dirty_from = 0;
+        // chunks with items changed in place
+        std::vector<qsizetype> dirty_chunks;
+
+        quint64 published = 0;
+    };
+
+    std::unique_ptr<Snapshots> m_snapshots;
+
+    static constexpr qsizetype no_dirt = std::numeric_limits<qsizetype>::max();
+
+    /// Note that items from an index on were inserted, removed or shifted
+    void note_structure(qsizetype from) {
+        m_version++;
+        if (!m_snapshots) return;
+        m_snapshots->dirty_from = std::min(m_snapshots->dirty_from, from);
+        schedule_publish();
+    }
+
+    /// Note that an item was changed in place
+    void note_item(qsizetype idx) {
+        m_version++;
+        if (!m_snapshots) return;
+        m_snapshots->dirty_chunks.push_back(
+            idx / smart_list_detail::chunk_size<T>);
+        schedule_publish();
+    }
+
+protected:
+    void publish_snapshot() override { publish(); }
+
+    qsizetype item_count() const override { return m_storage.size(); }
 
 public:
     explicit SmartList(QObject* parent = nullptr) : SmartListBase(parent) { }
 
     template <class Iterator>
     SmartList(Iterator begin, Iterator end, QObject* parent = nullptr)
-        : SmartListBase(parent), m_storage(begin, end) {
-        emit index_added(0, m_storage.size());
+        : SmartListBase(parent) {
+        for (; begin != end; ++begin) {
+            m_storage.emplace(m_storage.size(), *begin);
+        }
+        report_added(0, m_storage.size());
     }
 
     ~SmartList() { clear(); }
@@ -44,64 +213,137 @@ public:
     ///
     /// Obtain the value at the list index
     ///
-    T value(int idx) const { return m_storage.value(idx); }
+    T value(int idx) const {
+        if (idx < 0 or idx >= m_storage.size()) return T();
+        return m_storage.at(idx);
+    }
+
+    /// The value at a valid list index, without copying
+    T const& at(int idx) const { return m_storage.at(idx); }
 
     /// Set a value at the list index
     void set(int idx, T value) {
-        m_storage[idx] = value;
-        emit index_updated(idx, idx + 1);
+        m_storage.assign(idx, std::move(value));
+        note_item(idx);
+        report_updated(idx, idx + 1);
     }
 
     /// Append to the list
     void append(T const& new_value) {
-        qDebug() << Q_FUNC_INFO << m_storage.size();
         int starting_index = m_storage.size();
         int count          = 1;
-        m_storage << new_value;
-        emit index_added(starting_index, starting_index + count);
+        m_storage.emplace(starting_index, new_value);
+        note_structure(starting_index);
+        report_added(starting_index, starting_index + count);
     }
 
-    /// Append a list to this list
+    /// Append to the list, moving the value in
+    void append(T&& new_value) {
+        int starting_index = m_storage.size();
+        m_storage.emplace(starting_index, std::move(new_value));
+        note_structure(starting_index);
+        report_added(starting_index, starting_index + 1);
+    }
+
+    /// Construct a value in place at the end of the list
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        int starting_index = m_storage.size();
+        m_storage.emplace(starting_index, std::forward<Args>(args)...);
+        note_structure(starting_index);
+        report_added(starting_index, starting_index + 1);
+    }
+
+    /// Insert a value before the given index
+    void insert(int idx, T value) {
+        m_storage.emplace(idx, std::move(value));
+        note_structure(idx);
+        report_added(idx, idx + 1);
+    }
+
+    /// Append a list to this list. Pass an rvalue to move the values in; with
+    /// flat storage, an empty list takes over the storage outright.
     void append(QList<T> new_values) {
         int starting_index = m_storage.size();
         int count          = new_values.size();
-        m_storage << new_values;
-        emit index_added(starting_index, starting_index + count);
+
+        m_storage.append(std::move(new_values));
+
+        note_structure(starting_index);
+        report_added(starting_index, starting_index + count);
+    }
+
+    /// Move the values out of a span onto the end of this list. The span is
+    /// left with moved-from values.
+    void append_moved(std::span<T> new_values) {
+        int starting_index = m_storage.size();
+        int count          = new_values.size();
+        if (count == 0) return;
+
+        m_storage.append_moved(new_values);
+
+        note_structure(starting_index);
+        report_added(starting_index, starting_index + count);
     }
 
+    /// Make room for at least count values
+    void reserve(qsizetype count) { m_storage.reserve(count); }
+
     /// Replace the contents of this list with a different list
     void replace(QList<T> new_values) {
         clear();
-        append(new_values);
+        append(std::move(new_values));
     }
 
-    /// Remove at an index. Performance negative
+    /// Remove at an index. With flat storage, this shifts everything after.
     void remove(int idx, int count = 1) {
-        m_storage.remove(idx, count);
-        emit index_deleted(idx, idx + count);
+        m_storage.erase(idx, count);
+        note_structure(idx);
+        report_deleted(idx, idx + count);
     }
 
     /// Clear all values in this list
     void clear() {
         int count = m_storage.size();
         m_storage.clear();
-        emit index_deleted(0, count);
+        note_structure(0);
+        report_deleted(0, count);
     }
 
-    /// Find and remove a single value that matches the given.
+    /// Find and remove a single value that matches the given. This is a
+    /// linear search, unless the storage keeps a value index.
     ///
     /// \returns True if a value was removed. False otherwise
     bool find_remove_one(T const& item) {
-        auto iter = std::find(m_storage.begin(), m_storage.end(), item);
-        if (iter == m_storage.end()) return false;
-        auto offset = std::distance(m_storage.begin(), iter);
+        auto offset = m_storage.find(item);
+        if (offset < 0) return false;
         remove(offset);
         return true;
     }
 
+    /// Keep a value index, so find_remove_one does not search. Only for
+    /// chunked storage; T needs a qHash overload.
+    void enable_index()
+        requires requires(Storage& s) { s.enable_index(); }
+    {
+        m_storage.enable_index();
+    }
+
+    /// The items in [begin, end1), without copying. Only valid until the
+    /// list is next changed.
+    ///
+    /// With chunked storage the span stops at the end of the block holding
+    /// begin, so it may be shorter; use for_each_span to read the whole range.
     std::span<T const> range(int begin, int end1) const {
         if (end1 <= begin) return {};
-        return { m_storage.data(), end1 - begin };
+        return m_storage.span_from(begin, end1);
+    }
+
+    /// Call f(first, items) over the items in [begin, end1), a contiguous
+    /// span at a time. first is the index of the first item in the span.
+    template <class Function>
+    void for_each_span(int begin, int end1, Function&& f) const {
+        m_storage.for_each_span(begin, end1, std::forward<Function>(f));
     }
 
     /// Append to this list
@@ -110,13 +352,96 @@ public:
         return *this;
     }
 
+    SmartList& operator<<(T&& rhs) {
+        append(std::move(rhs));
+        return *this;
+    }
+
     auto begin() const { return m_storage.begin(); }
     auto end() const { return m_storage.end(); }
 
     /// Obtain the size of this list
     auto size() const { return m_storage.size(); }
+
+    /// A counter bumped by every change to the list
+    quint64 version() const { return m_version; }
+
+    /// Start publishing snapshots, and obtain the source that readers on other
+    /// threads should hold. Call this on the list's thread.
+    ///
+    /// Until this is first called, the list keeps no snapshot state. After
+    /// that it keeps a chunked copy of its items, and publishes a new snapshot
+    /// once per event loop pass in which it changed.
+    std::shared_ptr<SmartListSnapshotSource<T> const> snapshot_source() {
+        if (!m_snapshots) {
+            using Source = SmartListSnapshotSource<T>;
+
+            m_snapshots            = std::make_unique<Snapshots>();
+            m_snapshots->source    = std::make_shared<Source>();
+            m_snapshots->published = m_version - 1;
+            publish();
+        }
+        return m_snapshots->source;
+    }
+
+    /// Publish a snapshot of the current contents now, instead of waiting for
+    /// the event loop. Only chunks that changed are copied.
+    void publish() {
+        if (!m_snapshots) return;
+
+        auto& s = *m_snapshots;
+
+        if (s.published == m_version) return;
+
+        constexpr auto C = smart_list_detail::chunk_size<T>;
+
+        auto const size      = m_storage.size();
+        auto const count     = (size + C - 1) / C;
+        auto const old_count = qsizetype(s.chunks.size());
+
+        std::sort(s.dirty_chunks.begin(), s.dirty_chunks.end());
+
+        s.chunks.resize(count);
+
+        auto dirty = s.dirty_chunks.cbegin();
+
+        for (qsizetype k = 0; k < count; k++) {
+            auto const first = k * C;
+            auto const last  = std::min(size, first + C);
+
+            while (dirty != s.dirty_chunks.cend() and *dirty < k) {
+                ++dirty;
+            }
+
+            bool const stale = k >= old_count or last > s.dirty_from or
+                               (dirty != s.dirty_chunks.cend() and *dirty == k);
+
+            if (!stale) continue;
+
+            smart_list_detail::Chunk<T> chunk;
+            chunk.reserve(last - first);
+            m_storage.for_each_span(
+                first, last, [&chunk](qsizetype, std::span<T const> items) {
+                    chunk.insert(chunk.end(), items.begin(), items.end());
+                });
+
+            s.chunks[k] = std::make_shared<smart_list_detail::Chunk<T> const>(
+                std::move(chunk));
+        }
+
+        s.dirty_from = no_dirt;
+        s.dirty_chunks.clear();
+        s.published = m_version;
+
+        s.source->publish(std::make_shared<SmartListSnapshot<T> const>(
+            s.chunks, size, m_version));
+    }
 };
 
+/// A SmartList for long lists edited anywhere, not just at the end
+template <class T>
+using ChunkedSmartList = SmartList<T, smart_list_detail::ChunkedStorage<T>>;
+
 /// As smart lists are QObjects, it can be helpful to have a pointer typedef
 template <class T>
 using SmartListPtr = std::unique_ptr<SmartList<T>>;
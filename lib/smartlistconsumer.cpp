@@ -1,9 +1,39 @@
 #include "smartlistconsumer.h"
 
 SmartListConsumerBase::SmartListConsumerBase(QObject* parent)
-    : QObject(parent) { }
+    : QObject(parent), m_mailbox(std::make_shared<Mailbox>()) {
+    m_mailbox->consumer = this;
+}
+
+SmartListConsumerBase::~SmartListConsumerBase() {
+    {
+        std::scoped_lock lock(m_mailbox->mutex);
+        m_mailbox->consumer = nullptr;
+    }
+    drop_relay();
+}
+
+void SmartListConsumerBase::deliver(
+    std::shared_ptr<Mailbox> const&              box,
+    std::function<void(SmartListConsumerBase*)> f) {
+    std::scoped_lock lock(box->mutex);
 
-SmartListConsumerBase::~SmartListConsumerBase() = default;
+    auto* consumer = box->consumer;
+
+    if (!consumer) return;
+
+    QMetaObject::invokeMethod(
+        consumer,
+        [consumer, f = std::move(f)]() { f(consumer); },
+        Qt::QueuedConnection);
+}
+
+void SmartListConsumerBase::drop_relay() {
+    if (!m_relay) return;
+    // on the source's thread, so it goes once that thread is done with it
+    m_relay->deleteLater();
+    m_relay = nullptr;
+}
 
 void SmartListConsumerBase::on_add(int /*begin*/, int /*end1*/) { }
 void SmartListConsumerBase::on_update(int /*begin*/, int /*end1*/) { }
@@ -5,12 +5,44 @@
 #include <QObject>
 #include <QPointer>
 
+#include <functional>
+#include <mutex>
+#include <optional>
+
 class SmartListConsumerBase : public QObject {
+public:
+    /// How changes reach a consumer
+    enum class Delivery {
+        /// As the list emits them, on the list's thread
+        Direct,
+        /// Merged, on the consumer's own thread. While the consumer is busy,
+        /// further changes are folded into a single pending set.
+        Queued,
+    };
+
 protected:
     QPointer<SmartListBase> m_source;
 
     void set_base_source(SmartListBase*);
 
+    struct Mailbox {
+        std::mutex             mutex;
+        SmartListConsumerBase* consumer = nullptr;
+    };
+
+    std::shared_ptr<Mailbox> m_mailbox;
+
+    // For queued delivery; lives on the source's thread
+    QObject* m_relay = nullptr;
+
+    /// Run f on the consumer's thread, if the consumer still exists by then.
+    /// Safe to call from any thread.
+    static void deliver(std::shared_ptr<Mailbox> const&              box,
+                        std::function<void(SmartListConsumerBase*)> f);
+
+    /// Stop queued delivery, if any
+    void drop_relay();
+
 protected slots:
     virtual void on_add(int begin, int end1);
     virtual void on_update(int begin, int end1);
@@ -25,14 +57,248 @@ private slots:
     void source_destroyed(QObject*);
 };
 
-
-template <class T>
+///
+/// \brief The SmartListConsumer class receives the changes to a SmartList as
+/// spans of the items involved.
+///
+/// Override items_added, items_updated and items_deleted. With direct
+/// delivery, spans point into the list itself. With queued delivery, they
+/// point into a snapshot of the list, so the consumer can run on another
+/// thread and take its time. Either way a range may come as several spans, one
+/// per contiguous piece.
+///
+template <class T, class Storage = smart_list_detail::FlatStorage<T>>
 class SmartListConsumer : public SmartListConsumerBase {
+    using List     = SmartList<T, Storage>;
+    using Change   = smart_list_detail::Change;
+    using Snapshot = SmartListSnapshot<T>;
+
+    // Queued delivery state. Only touched on the source's thread.
+    struct Queue {
+        List*                                             list = nullptr;
+        std::shared_ptr<SmartListSnapshotSource<T> const> snapshots;
+        std::optional<smart_list_detail::ChangeTracker>   pending;
+
+        bool in_flight       = false;
+        bool flush_scheduled = false;
+    };
+
+    std::shared_ptr<Queue>          m_queue;
+    std::shared_ptr<Snapshot const> m_snapshot;
+
+    static void note(std::shared_ptr<Queue> const&   q,
+                     QObject*                        relay,
+                     std::shared_ptr<Mailbox> const& box,
+                     Change::Kind                    kind,
+                     int                             begin,
+                     int                             end1) {
+        if (!q->list) return;
+
+        qsizetype const count = end1 - begin;
+
+        if (!q->pending) {
+            // the list has already changed; track from before that
+            qsizetype size = q->list->size();
+            if (kind == Change::Added) size -= count;
+            if (kind == Change::Deleted) size += count;
+            q->pending.emplace(size);
+        }
+
+        switch (kind) {
+        case Change::Added: q->pending->insert(begin, count); break;
+        case Change::Updated: q->pending->update(begin, count); break;
+        case Change::Deleted: q->pending->remove(begin, count); break;
+        }
+
+        schedule(q, relay, box);
+    }
+
+    static void schedule(std::shared_ptr<Queue> const&   q,
+                         QObject*                        relay,
+                         std::shared_ptr<Mailbox> const& box) {
+        if (q->flush_scheduled or q->in_flight) return;
+        q->flush_scheduled = true;
+
+        QMetaObject::invokeMethod(
+            relay,
+            [q, relay, box]() {
+                q->flush_scheduled = false;
+                flush(q, relay, box);
+            },
+            Qt::QueuedConnection);
+    }
+
+    // Hand the pending changes over, with a snapshot that matches them
+    static void flush(std::shared_ptr<Queue> const&   q,
+                      QObject*                        relay,
+                      std::shared_ptr<Mailbox> const& box) {
+        if (q->in_flight or !q->pending or !q->list) return;
+
+        auto changes = q->pending->changes();
+        q->pending.reset();
+
+        if (changes.empty()) return;
+
+        q->list->publish();
+
+        q->in_flight = true;
+
+        deliver(box,
+                [q, relay, changes = std::move(changes),
+                 snapshot = q->snapshots->latest()](SmartListConsumerBase* c) {
+                    static_cast<SmartListConsumer*>(c)->apply(
+                        q, relay, changes, snapshot);
+                });
+    }
+
+    void apply(std::shared_ptr<Queue> const&   q,
+               QObject*                        relay,
+               std::vector<Change> const&      changes,
+               std::shared_ptr<Snapshot const> snapshot) {
+        // left over from an earlier source
+        if (q != m_queue) return;
+
+        m_snapshot = std::move(snapshot);
+
+        for (auto const& change : changes) {
+            switch (change.kind) {
+            case Change::Added:
+                m_snapshot->for_each_span(
+                    change.begin,
+                    change.end_1,
+                    [this](qsizetype first, std::span<T const> items) {
+                        items_added(first, items);
+                    });
+                break;
+            case Change::Updated:
+                m_snapshot->for_each_span(
+                    change.begin,
+                    change.end_1,
+                    [this](qsizetype first, std::span<T const> items) {
+                        items_updated(first, items);
+                    });
+                break;
+            case Change::Deleted:
+                items_deleted(change.begin, change.end_1);
+                break;
+            }
+        }
+
+        // ready for whatever piled up meanwhile
+        QMetaObject::invokeMethod(
+            relay,
+            [q, relay, box = m_mailbox]() {
+                q->in_flight = false;
+                flush(q, relay, box);
+            },
+            Qt::QueuedConnection);
+    }
+
+    void start_queue(List* source) {
+        auto q   = std::make_shared<Queue>();
+        auto box = m_mailbox;
+
+        m_queue = q;
+        m_relay = new QObject;
+
+        auto* relay = m_relay;
+
+        q->list      = source;
+        q->snapshots = source->snapshot_source();
+
+        // the consumer starts out seeing everything already there
+        q->pending.emplace(0);
+        q->pending->insert(0, source->size());
+
+        connect(source,
+                &SmartListBase::index_added,
+                relay,
+                [q, relay, box](int begin, int end1) {
+                    note(q, relay, box, Change::Added, begin, end1);
+                });
+        connect(source,
+                &SmartListBase::index_updated,
+                relay,
+                [q, relay, box](int begin, int end1) {
+                    note(q, relay, box, Change::Updated, begin, end1);
+                });
+        connect(source,
+                &SmartListBase::index_deleted,
+                relay,
+                [q, relay, box](int begin, int end1) {
+                    note(q, relay, box, Change::Deleted, begin, end1);
+                });
+        connect(source, &QObject::destroyed, relay, [q]() {
+            q->list = nullptr;
+        });
+
+        schedule(q, relay, box);
+    }
+
+protected:
+    /// Items were added, starting at index first
+    virtual void items_added(int /*first*/, std::span<T const> /*items*/) { }
+
+    /// Items were changed in place, starting at index first
+    virtual void items_updated(int /*first*/, std::span<T const> /*items*/) {
+    }
+
+    /// Items in [begin, end1) were removed
+    virtual void items_deleted(int /*begin*/, int /*end1*/) { }
+
+    void on_add(int begin, int end1) override {
+        if (auto* s = source()) {
+            s->for_each_span(
+                begin, end1, [this](int first, std::span<T const> items) {
+                    items_added(first, items);
+                });
+        }
+    }
+
+    void on_update(int begin, int end1) override {
+        if (auto* s = source()) {
+            s->for_each_span(
+                begin, end1, [this](int first, std::span<T const> items) {
+                    items_updated(first, items);
+                });
+        }
+    }
+
+    void on_delete(int begin, int end1) override {
+        items_deleted(begin, end1);
+    }
+
 public:
-    SmartListConsumer();
+    explicit SmartListConsumer(QObject* parent = nullptr)
+        : SmartListConsumerBase(parent) { }
     ~SmartListConsumer() = default;
 
-    void set_source(SmartList<T>* source) { set_base_source(source); }
+    /// Follow a list. Call this on the list's thread.
+    ///
+    /// For queued delivery, the consumer may then be moved to another thread.
+    /// It is first told of the items already in the list, and from then on
+    /// receives changes with spans read from list snapshots. Changing the
+    /// source again should be done while the consumer is not receiving.
+    void set_source(List* source, Delivery delivery = Delivery::Direct) {
+        drop_relay();
+        m_queue.reset();
+        m_snapshot.reset();
 
-protected slots:
+        if (delivery == Delivery::Direct or !source) {
+            set_base_source(source);
+            return;
+        }
+
+        set_base_source(nullptr);
+        start_queue(source);
+    }
+
+    /// The list being followed with direct delivery
+    List* source() const { return static_cast<List*>(m_source.data()); }
+
+    /// With queued delivery, the list as of the changes last delivered. Only
+    /// use this on the consumer's thread.
+    std::shared_ptr<Snapshot const> const& snapshot() const {
+        return m_snapshot;
+    }
 };
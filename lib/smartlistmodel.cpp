@@ -0,0 +1,45 @@
+#include "smartlistmodel.h"
+
+SmartListModelBase::~SmartListModelBase() = default;
+
+// The list has already changed by the time these are called. Views only read
+// rows after each end call, by which point the count matches again.
+
+void SmartListModelBase::apply_added(int begin, int end1) {
+    if (end1 <= begin) return;
+
+    beginInsertRows({}, begin, end1 - 1);
+    m_count += end1 - begin;
+    endInsertRows();
+
+    emit count_changed();
+}
+
+void SmartListModelBase::apply_updated(int begin, int end1) {
+    if (end1 <= begin) return;
+
+    emit dataChanged(index(begin), index(end1 - 1));
+}
+
+void SmartListModelBase::apply_deleted(int begin, int end1) {
+    if (end1 <= begin) return;
+
+    beginRemoveRows({}, begin, end1 - 1);
+    m_count -= end1 - begin;
+    endRemoveRows();
+
+    emit count_changed();
+}
+
+void SmartListModelBase::apply_reset(int count) {
+    beginResetModel();
+    m_count = count;
+    endResetModel();
+
+    emit count_changed();
+}
+
+int SmartListModelBase::rowCount(QModelIndex const& parent) const {
+    if (parent.isValid()) return 0;
+    return m_count;
+}
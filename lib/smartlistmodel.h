@@ -0,0 +1,187 @@
+#pragma once
+
+#include "smartlistconsumer.h"
+#include "structmodel.h"
+
+#include <QAbstractListModel>
+
+namespace struct_model_detail {
+
+/// Types that describe their members with SM_MAKE_META
+template <class T>
+concept has_meta = requires {
+    std::tuple_size<std::remove_cvref_t<decltype(T::meta)>>::value;
+};
+
+} // namespace struct_model_detail
+
+class SmartListModelBase : public QAbstractListModel {
+    Q_OBJECT
+
+    Q_PROPERTY(int count READ count NOTIFY count_changed)
+
+protected:
+    // rows the views have been told about
+    int m_count = 0;
+
+    void apply_added(int begin, int end1);
+    void apply_updated(int begin, int end1);
+    void apply_deleted(int begin, int end1);
+
+    /// Start over with a number of rows
+    void apply_reset(int count);
+
+public:
+    using QAbstractListModel::QAbstractListModel;
+    virtual ~SmartListModelBase();
+
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override;
+
+    int count() const { return m_count; }
+
+signals:
+    void count_changed();
+};
+
+///
+/// \brief The SmartListModel class exposes a SmartList to views, such as a QML
+/// ListView.
+///
+/// List changes turn straight into row insertions, removals and dataChanged.
+/// If T has meta, each member is a role, named as in the meta, starting at
+/// Qt::UserRole. Otherwise the item itself is the display role. Items are read
+/// in place, from the list or, with queued delivery, from the snapshot the
+/// model was last brought up to.
+///
+template <class T, class Storage = smart_list_detail::FlatStorage<T>>
+class SmartListModel : public SmartListModelBase {
+    using List = SmartList<T, Storage>;
+
+    class Feed : public SmartListConsumer<T, Storage> {
+        SmartListModel* m_model;
+
+    protected:
+        void items_added(int first, std::span<T const> items) override {
+            m_model->apply_added(first, first + items.size());
+        }
+        void items_updated(int first, std::span<T const> items) override {
+            m_model->apply_updated(first, first + items.size());
+        }
+        void items_deleted(int begin, int end1) override {
+            m_model->apply_deleted(begin, end1);
+        }
+
+    public:
+        explicit Feed(SmartListModel* model) : m_model(model) { }
+    };
+
+    using Delivery = SmartListConsumerBase::Delivery;
+
+    static constexpr bool has_meta = struct_model_detail::has_meta<T>;
+
+    Feed     m_feed;
+    Delivery m_delivery = Delivery::Direct;
+
+    T const* item(int row) const {
+        if (row < 0 or row >= m_count) return nullptr;
+
+        if (m_delivery == Delivery::Direct) {
+            auto* list = m_feed.source();
+            if (!list or row >= list->size()) return nullptr;
+            return &list->at(row);
+        }
+
+        auto const& snapshot = m_feed.snapshot();
+        if (!snapshot or row >= snapshot->size()) return nullptr;
+        return &snapshot->at(row);
+    }
+
+public:
+    explicit SmartListModel(QObject* parent = nullptr)
+        : SmartListModelBase(parent), m_feed(this) { }
+
+    /// Follow a list. With queued delivery the list may be changed on another
+    /// thread; rows then follow as the model's thread catches up. Call this on
+    /// the list's thread.
+    void set_source(List* source, Delivery delivery = Delivery::Direct) {
+        m_delivery = delivery;
+        m_feed.set_source(source, delivery);
+
+        // queued delivery starts with everything already in the list
+        bool const direct = source and delivery == Delivery::Direct;
+        apply_reset(direct ? source->size() : 0);
+    }
+
+    QVariant data(QModelIndex const& index,
+                  int                role = Qt::DisplayRole) const override {
+        if (!index.isValid()) return {};
+
+        auto const* p = item(index.row());
+        if (!p) return {};
+
+        if constexpr (has_meta) {
+            using Table = struct_model_detail::ColumnTable<T>;
+
+            auto local_role = role - Qt::UserRole;
+
+            if (!Table::in_range(local_role)) return {};
+
+            return Table::getters[local_role](*p);
+        } else {
+            if (role != Qt::DisplayRole) return {};
+            return struct_model_detail::to_variant(*p);
+        }
+    }
+
+    /// Editable members can be set through their role. Only with direct
+    /// delivery, as the list is written in turn.
+    bool setData(QModelIndex const& index,
+                 QVariant const&    value,
+                 int                role = Qt::EditRole) override {
+        if constexpr (has_meta) {
+            using Table = struct_model_detail::ColumnTable<T>;
+
+            if (m_delivery != Delivery::Direct) return false;
+
+            auto const* p = item(index.row());
+            if (!p) return false;
+
+            auto local_role = role - Qt::UserRole;
+
+            if (!Table::in_range(local_role)) return false;
+            if (!Table::editable[local_role]) return false;
+            if (Table::equals[local_role](*p, value)) return false;
+
+            T updated = *p;
+            if (!Table::setters[local_role](updated, value)) return false;
+
+            // the list reports the change back to us
+            m_feed.source()->set(index.row(), std::move(updated));
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    Qt::ItemFlags flags(QModelIndex const& index) const override {
+        if (!index.isValid()) return Qt::NoItemFlags;
+
+        Qt::ItemFlags ret = Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+
+        if constexpr (has_meta) {
+            if (m_delivery == Delivery::Direct) ret |= Qt::ItemIsEditable;
+        }
+
+        return ret;
+    }
+
+    QHash<int, QByteArray> roleNames() const override {
+        if constexpr (has_meta) {
+            return struct_model_detail::get_name_map<T>();
+        } else {
+            return { { Qt::DisplayRole, "display" } };
+        }
+    }
+
+    List* source() const { return m_feed.source(); }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <QList>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace smart_list_detail {
+
+/// Items per snapshot chunk; about 4KiB worth, but never tiny
+template <class T>
+constexpr qsizetype chunk_size = std::max<qsizetype>(16, 4096 / sizeof(T));
+
+template <class T>
+using Chunk = std::vector<T>;
+
+template <class T>
+using ChunkPtr = std::shared_ptr<Chunk<T> const>;
+
+// libstdc++ before 13 releases its internal lock too weakly in load()
+#if defined(__cpp_lib_atomic_shared_ptr) and                                  \
+    !(defined(_GLIBCXX_RELEASE) and _GLIBCXX_RELEASE < 13)
+#    define SMART_LIST_ATOMIC_SHARED_PTR 1
+#endif
+
+/// A shared pointer that can be swapped by one thread while others read it
+template <class P>
+class AtomicSharedPtr {
+#if defined(SMART_LIST_ATOMIC_SHARED_PTR)
+    std::atomic<std::shared_ptr<P>> m_ptr;
+
+public:
+    std::shared_ptr<P> load() const {
+        return m_ptr.load(std::memory_order_acquire);
+    }
+    void store(std::shared_ptr<P> p) {
+        m_ptr.store(std::move(p), std::memory_order_release);
+    }
+#else
+    // only held for the length of a pointer copy
+    mutable std::mutex m_mutex;
+    std::shared_ptr<P> m_ptr;
+
+public:
+    std::shared_ptr<P> load() const {
+        std::scoped_lock lock(m_mutex);
+        return m_ptr;
+    }
+    void store(std::shared_ptr<P> p) {
+        std::scoped_lock lock(m_mutex);
+        m_ptr.swap(p);
+    }
+#endif
+};
+
+} // namespace smart_list_detail
+
+///
+/// \brief The SmartListSnapshot class is an immutable copy of a SmartList at a
+/// given version.
+///
+/// Items are held in fixed size chunks. Chunks that did not change between two
+/// versions are shared, so a new snapshot only costs the chunks that were
+/// touched. Snapshots can be read from any thread.
+///
+template <class T>
+class SmartListSnapshot {
+    using ChunkPtr = smart_list_detail::ChunkPtr<T>;
+
+    static constexpr qsizetype C = smart_list_detail::chunk_size<T>;
+
+    std::vector<ChunkPtr> m_chunks;
+    qsizetype             m_size    = 0;
+    quint64               m_version = 0;
+
+public:
+    SmartListSnapshot() = default;
+    SmartListSnapshot(std::vector<ChunkPtr> chunks,
+                      qsizetype             size,
+                      quint64               version)
+        : m_chunks(std::move(chunks)), m_size(size), m_version(version) { }
+
+    /// The list version this was taken at. Versions only go up.
+    quint64 version() const { return m_version; }
+
+    qsizetype size() const { return m_size; }
+    bool      empty() const { return m_size == 0; }
+
+    T const& at(qsizetype i) const {
+        Q_ASSERT(i >= 0 and i < m_size);
+        return (*m_chunks[i / C])[i % C];
+    }
+
+    T const& operator[](qsizetype i) const { return at(i); }
+
+    /// Number of chunks. Items are read fastest a chunk at a time.
+    qsizetype chunk_count() const { return m_chunks.size(); }
+
+    /// The items in a chunk, in order
+    std::span<T const> chunk(qsizetype k) const {
+        auto const& c = *m_chunks[k];
+        return { c.data(), c.size() };
+    }
+
+    /// Call f on every item, in order
+    template <class Function>
+    void for_each(Function&& f) const {
+        for (auto const& c : m_chunks) {
+            for (auto const& item : *c) {
+                f(item);
+            }
+        }
+    }
+
+    /// Call f(first, items) over the items in [begin, end_1), a chunk at a
+    /// time. first is the index of the first item in the span.
+    template <class Function>
+    void for_each_span(qsizetype begin, qsizetype end_1, Function&& f) const {
+        Q_ASSERT(begin >= 0 and end_1 <= m_size);
+        while (begin < end_1) {
+            auto const offset = begin % C;
+            auto const count  = std::min(end_1 - begin, C - offset);
+            auto const& c     = *m_chunks[begin / C];
+
+            f(begin, std::span<T const>(c.data() + offset, count));
+            begin += count;
+        }
+    }
+
+    /// Copy the items out into a list
+    QList<T> to_list() const {
+        QList<T> ret;
+        ret.reserve(m_size);
+        for_each([&ret](T const& item) { ret << item; });
+        return ret;
+    }
+};
+
+///
+/// \brief The SmartListSnapshotSource class hands out the latest snapshot of a
+/// SmartList.
+///
+/// Readers on other threads hold on to this rather than to the list. It stays
+/// valid after the list is gone, keeping the last snapshot published.
+///
+template <class T>
+class SmartListSnapshotSource {
+    using Ptr = std::shared_ptr<SmartListSnapshot<T> const>;
+
+    smart_list_detail::AtomicSharedPtr<SmartListSnapshot<T> const> m_latest;
+
+public:
+    /// The most recently published snapshot. Never null once the source has
+    /// been handed out. Safe to call from any thread.
+    Ptr latest() const { return m_latest.load(); }
+
+    /// Used by the owning list
+    void publish(Ptr snapshot) { m_latest.store(std::move(snapshot)); }
+};
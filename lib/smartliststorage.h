@@ -0,0 +1,539 @@
+#pragma once
+
+#include "smartlistsnapshot.h"
+
+#include <QHash>
+#include <QList>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace smart_list_detail {
+
+///
+/// \brief The FlatStorage class keeps SmartList items in a single QList.
+///
+/// Indexing is direct and appends are cheap, but inserting or removing in the
+/// middle shifts everything after.
+///
+template <class T>
+class FlatStorage {
+    QList<T> m_items;
+
+public:
+    using const_iterator = typename QList<T>::const_iterator;
+
+    qsizetype size() const { return m_items.size(); }
+
+    T const& at(qsizetype i) const { return m_items[i]; }
+
+    void assign(qsizetype i, T&& value) { m_items[i] = std::move(value); }
+
+    template <class... Args>
+    void emplace(qsizetype i, Args&&... args) {
+        m_items.emplace(i, std::forward<Args>(args)...);
+    }
+
+    /// An empty list takes over the storage outright
+    void append(QList<T>&& values) {
+        if (m_items.isEmpty() and m_items.capacity() < values.size()) {
+            m_items = std::move(values);
+        } else {
+            m_items.append(std::move(values));
+        }
+    }
+
+    void append_moved(std::span<T> values) {
+        qsizetype needed = m_items.size() + values.size();
+        if (m_items.capacity() < needed) {
+            m_items.reserve(std::max(needed, m_items.capacity() * 2));
+        }
+
+        for (auto& v : values) {
+            m_items.append(std::move(v));
+        }
+    }
+
+    void erase(qsizetype i, qsizetype count) { m_items.remove(i, count); }
+    void clear() { m_items.clear(); }
+    void reserve(qsizetype count) { m_items.reserve(count); }
+
+    /// The items from begin to end_1, all in one piece
+    std::span<T const> span_from(qsizetype begin, qsizetype end_1) const {
+        return { m_items.data() + begin, size_t(end_1 - begin) };
+    }
+
+    template <class Function>
+    void for_each_span(qsizetype begin, qsizetype end_1, Function&& f) const {
+        if (end_1 > begin) f(begin, span_from(begin, end_1));
+    }
+
+    qsizetype find(T const& value) const {
+        auto iter = std::find(m_items.begin(), m_items.end(), value);
+        if (iter == m_items.end()) return -1;
+        return std::distance(m_items.begin(), iter);
+    }
+
+    const_iterator begin() const { return m_items.begin(); }
+    const_iterator end() const { return m_items.end(); }
+};
+
+///
+/// \brief The ChunkedStorage class keeps SmartList items in fixed size blocks
+/// held by a counted B+ tree.
+///
+/// Indexed access, insertion and removal anywhere are O(log n), moving at most
+/// a block's worth of items. Blocks are contiguous, so items can still be read
+/// a span at a time.
+///
+/// An optional value index maps items to the block that holds them, making
+/// find() independent of the list size. It needs qHash(T) and keeps a copy of
+/// every item.
+///
+template <class T>
+class ChunkedStorage {
+    static constexpr qsizetype leaf_size = chunk_size<T>;
+    static constexpr qsizetype fanout    = 32;
+
+    struct Node {
+        Node*     parent = nullptr;
+        qsizetype count  = 0; // items in this subtree
+        bool      leaf   = true;
+
+        // leaves only, linked in order
+        std::vector<T> items;
+        Node*          prev = nullptr;
+        Node*          next = nullptr;
+
+        // branches only
+        std::vector<std::unique_ptr<Node>> children;
+
+        qsizetype width() const {
+            return leaf ? qsizetype(items.size()) : qsizetype(children.size());
+        }
+    };
+
+    struct Hash {
+        size_t operator()(T const& v) const { return qHash(v); }
+    };
+
+    using Index = std::unordered_multimap<T, Node*, Hash>;
+
+    std::unique_ptr<Node> m_root;
+    Node*                 m_first = nullptr;
+    Node*                 m_last  = nullptr;
+
+    std::optional<Index> m_index;
+
+    static std::unique_ptr<Node> make_leaf() {
+        auto ret = std::make_unique<Node>();
+        ret->items.reserve(leaf_size);
+        return ret;
+    }
+
+    void reset_root() {
+        m_root  = make_leaf();
+        m_first = m_root.get();
+        m_last  = m_root.get();
+    }
+
+    static qsizetype child_index(Node const* parent, Node const* child) {
+        auto const& c = parent->children;
+        for (qsizetype k = 0; k < qsizetype(c.size()); k++) {
+            if (c[k].get() == child) return k;
+        }
+        Q_UNREACHABLE();
+        return -1;
+    }
+
+    static void add_count(Node* n, qsizetype delta) {
+        for (; n; n = n->parent) {
+            n->count += delta;
+        }
+    }
+
+    // The leaf holding item i, and the offset in it. i may be the size, for
+    // the end of the last leaf.
+    std::pair<Node*, qsizetype> locate(qsizetype i) const {
+        Node* n = m_root.get();
+        while (!n->leaf) {
+            auto const& c = n->children;
+            size_t      k = 0;
+            while (k + 1 < c.size() and i >= c[k]->count) {
+                i -= c[k]->count;
+                k++;
+            }
+            n = c[k].get();
+        }
+        return { n, i };
+    }
+
+    qsizetype index_of(Node const* leaf, qsizetype offset) const {
+        qsizetype ret = offset;
+        for (Node const* n = leaf; n->parent; n = n->parent) {
+            for (auto const& c : n->parent->children) {
+                if (c.get() == n) break;
+                ret += c->count;
+            }
+        }
+        return ret;
+    }
+
+    void index_add(T const& v, Node* leaf) {
+        if (m_index) m_index->emplace(v, leaf);
+    }
+
+    void index_remove(T const& v, Node* leaf) {
+        if (!m_index) return;
+        auto [a, b] = m_index->equal_range(v);
+        for (; a != b; ++a) {
+            if (a->second == leaf) {
+                m_index->erase(a);
+                return;
+            }
+        }
+    }
+
+    void index_move(T const& v, Node* from, Node* to) {
+        if (!m_index) return;
+        auto [a, b] = m_index->equal_range(v);
+        for (; a != b; ++a) {
+            if (a->second == from) {
+                a->second = to;
+                return;
+            }
+        }
+    }
+
+    // Place a new node just after an existing one, growing the tree upwards
+    // as branches fill
+    void insert_after(Node* existing, std::unique_ptr<Node> node) {
+        Node* parent = existing->parent;
+
+        if (!parent) {
+            auto root   = std::make_unique<Node>();
+            root->leaf  = false;
+            root->count = existing->count + node->count;
+
+            existing->parent = root.get();
+            node->parent     = root.get();
+
+            root->children.push_back(std::move(m_root));
+            root->children.push_back(std::move(node));
+            m_root = std::move(root);
+            return;
+        }
+
+        auto at      = child_index(parent, existing) + 1;
+        node->parent = parent;
+        parent->children.insert(parent->children.begin() + at,
+                                std::move(node));
+
+        if (qsizetype(parent->children.size()) > fanout) split_branch(parent);
+    }
+
+    void split_branch(Node* branch) {
+        auto right  = std::make_unique<Node>();
+        right->leaf = false;
+
+        auto&      c    = branch->children;
+        auto const half = c.size() / 2;
+
+        for (auto k = half; k < c.size(); k++) {
+            c[k]->parent = right.get();
+            right->count += c[k]->count;
+            right->children.push_back(std::move(c[k]));
+        }
+        c.resize(half);
+        branch->count -= right->count;
+
+        insert_after(branch, std::move(right));
+    }
+
+    // Move the items from at on into a new leaf after this one
+    Node* split_leaf(Node* leaf, qsizetype at) {
+        auto right = make_leaf();
+
+        auto& items = leaf->items;
+        for (auto k = at; k < qsizetype(items.size()); k++) {
+            index_move(items[k], leaf, right.get());
+            right->items.push_back(std::move(items[k]));
+        }
+        items.erase(items.begin() + at, items.end());
+
+        right->count = right->items.size();
+        leaf->count  = items.size();
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) leaf->next->prev = right.get();
+        leaf->next = right.get();
+        if (m_last == leaf) m_last = right.get();
+
+        Node* ret = right.get();
+        insert_after(leaf, std::move(right));
+        return ret;
+    }
+
+    void unlink_leaf(Node* leaf) {
+        if (leaf->prev) leaf->prev->next = leaf->next;
+        if (leaf->next) leaf->next->prev = leaf->prev;
+        if (m_first == leaf) m_first = leaf->next;
+        if (m_last == leaf) m_last = leaf->prev;
+    }
+
+    // Fold b, the next sibling of a, into a
+    void merge(Node* a, Node* b) {
+        if (a->leaf) {
+            for (auto& v : b->items) {
+                index_move(v, b, a);
+                a->items.push_back(std::move(v));
+            }
+            unlink_leaf(b);
+        } else {
+            for (auto& c : b->children) {
+                c->parent = a;
+                a->children.push_back(std::move(c));
+            }
+        }
+        a->count += b->count;
+
+        auto* parent = a->parent;
+        parent->children.erase(parent->children.begin() +
+                               child_index(parent, b));
+    }
+
+    // After a removal, drop empty nodes and fold small ones into a neighbour
+    void rebalance(Node* node) {
+        while (node->parent) {
+            Node* parent = node->parent;
+            auto  k      = child_index(parent, node);
+            auto& c      = parent->children;
+
+            qsizetype const cap = node->leaf ? leaf_size : fanout;
+
+            if (node->width() == 0) {
+                if (node->leaf) unlink_leaf(node);
+                c.erase(c.begin() + k);
+            } else if (node->width() < cap / 4) {
+                if (k + 1 < qsizetype(c.size()) and
+                    node->width() + c[k + 1]->width() <= cap) {
+                    merge(node, c[k + 1].get());
+                } else if (k > 0 and node->width() + c[k - 1]->width() <= cap) {
+                    merge(c[k - 1].get(), node);
+                } else {
+                    break;
+                }
+            } else {
+                break;
+            }
+
+            node = parent;
+        }
+
+        while (!m_root->leaf and m_root->children.size() == 1) {
+            auto child    = std::move(m_root->children.front());
+            child->parent = nullptr;
+            m_root        = std::move(child);
+        }
+
+        if (!m_root->leaf and m_root->children.empty()) reset_root();
+    }
+
+public:
+    ChunkedStorage() { reset_root(); }
+
+    ChunkedStorage(ChunkedStorage const&)            = delete;
+    ChunkedStorage& operator=(ChunkedStorage const&) = delete;
+
+    qsizetype size() const { return m_root->count; }
+
+    T const& at(qsizetype i) const {
+        auto [leaf, offset] = locate(i);
+        return leaf->items[offset];
+    }
+
+    void assign(qsizetype i, T&& value) {
+        auto [leaf, offset] = locate(i);
+        auto& slot          = leaf->items[offset];
+        index_remove(slot, leaf);
+        slot = std::move(value);
+        index_add(slot, leaf);
+    }
+
+    template <class... Args>
+    void emplace(qsizetype i, Args&&... args) {
+        auto [leaf, offset] = locate(i);
+
+        if (qsizetype(leaf->items.size()) == leaf_size) {
+            // appending to a full leaf starts a new one, rather than leaving
+            // two half full
+            auto  at    = offset == leaf_size ? leaf_size : leaf_size / 2;
+            Node* right = split_leaf(leaf, at);
+            if (offset >= at) {
+                leaf = right;
+                offset -= at;
+            }
+        }
+
+        auto iter = leaf->items.emplace(leaf->items.begin() + offset,
+                                        std::forward<Args>(args)...);
+        add_count(leaf, 1);
+        index_add(*iter, leaf);
+    }
+
+    void append(QList<T>&& values) {
+        append_moved(std::span<T>(values.data(), values.size()));
+    }
+
+    void append_moved(std::span<T> values) {
+        for (auto& v : values) {
+            emplace(size(), std::move(v));
+        }
+    }
+
+    void erase(qsizetype i, qsizetype count) {
+        while (count > 0) {
+            auto [leaf, offset] = locate(i);
+
+            auto& items = leaf->items;
+            auto  take  = std::min(count, qsizetype(items.size()) - offset);
+
+            for (auto k = offset; k < offset + take; k++) {
+                index_remove(items[k], leaf);
+            }
+            items.erase(items.begin() + offset, items.begin() + offset + take);
+
+            add_count(leaf, -take);
+            count -= take;
+
+            rebalance(leaf);
+        }
+    }
+
+    void clear() {
+        reset_root();
+        if (m_index) m_index->clear();
+    }
+
+    void reserve(qsizetype) { }
+
+    /// The items from begin, up to end_1 or the end of the block holding
+    /// begin, whichever comes first
+    std::span<T const> span_from(qsizetype begin, qsizetype end_1) const {
+        auto [leaf, offset] = locate(begin);
+        auto count =
+            std::min(end_1 - begin, qsizetype(leaf->items.size()) - offset);
+        return { leaf->items.data() + offset, size_t(count) };
+    }
+
+    template <class Function>
+    void for_each_span(qsizetype begin, qsizetype end_1, Function&& f) const {
+        if (end_1 <= begin) return;
+
+        auto [leaf, offset] = locate(begin);
+
+        while (begin < end_1) {
+            auto count = std::min(end_1 - begin,
+                                  qsizetype(leaf->items.size()) - offset);
+
+            f(begin, std::span<T const>(leaf->items.data() + offset, count));
+
+            begin += count;
+            leaf   = leaf->next;
+            offset = 0;
+        }
+    }
+
+    /// Start keeping the value index
+    void enable_index() {
+        if (m_index) return;
+        m_index.emplace();
+        m_index->reserve(size());
+        for (Node* leaf = m_first; leaf; leaf = leaf->next) {
+            for (auto const& v : leaf->items) {
+                m_index->emplace(v, leaf);
+            }
+        }
+    }
+
+    bool has_index() const { return m_index.has_value(); }
+
+    /// Index of the first item equal to value, or -1
+    qsizetype find(T const& value) const {
+        if (m_index) {
+            qsizetype ret = -1;
+
+            auto [a, b] = m_index->equal_range(value);
+            for (; a != b; ++a) {
+                auto const& items = a->second->items;
+                auto offset = std::find(items.begin(), items.end(), value) -
+                              items.begin();
+                auto at = index_of(a->second, offset);
+                if (ret < 0 or at < ret) ret = at;
+            }
+            return ret;
+        }
+
+        qsizetype base = 0;
+        for (Node* leaf = m_first; leaf; leaf = leaf->next) {
+            auto const& items = leaf->items;
+            auto        iter  = std::find(items.begin(), items.end(), value);
+            if (iter != items.end()) return base + (iter - items.begin());
+            base += items.size();
+        }
+        return -1;
+    }
+
+    class const_iterator {
+        Node const* m_leaf   = nullptr;
+        qsizetype   m_offset = 0;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = T const*;
+        using reference         = T const&;
+
+        const_iterator() = default;
+        const_iterator(Node const* leaf, qsizetype offset)
+            : m_leaf(leaf), m_offset(offset) {
+            skip_empty();
+        }
+
+        void skip_empty() {
+            while (m_leaf and m_offset >= qsizetype(m_leaf->items.size())) {
+                m_leaf   = m_leaf->next;
+                m_offset = 0;
+            }
+        }
+
+        T const& operator*() const { return m_leaf->items[m_offset]; }
+        T const* operator->() const { return &m_leaf->items[m_offset]; }
+
+        const_iterator& operator++() {
+            m_offset++;
+            skip_empty();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        bool operator==(const_iterator const&) const = default;
+    };
+
+    const_iterator begin() const { return { m_first, 0 }; }
+    const_iterator end() const { return {}; }
+};
+
+} // namespace smart_list_detail
@@ -0,0 +1,74 @@
+#include "structaggregate.h"
+
+#include <cmath>
+
+StructAggregate::StructAggregate(QString name, int column, QObject* parent)
+    : QObject(parent), m_name(std::move(name)), m_column(column) { }
+
+StructAggregate::~StructAggregate() = default;
+
+void StructAggregate::ensure_extremes() const {
+    if (!m_extremes_stale) return;
+
+    auto fresh = scan();
+    m_totals.min = fresh.min;
+    m_totals.max = fresh.max;
+
+    m_extremes_stale = false;
+}
+
+void StructAggregate::add_value(double v) {
+    m_totals.count++;
+    m_totals.sum += v;
+
+    if (!m_extremes_stale) {
+        m_totals.min = std::min(m_totals.min, v);
+        m_totals.max = std::max(m_totals.max, v);
+    }
+
+    m_dirty = true;
+}
+
+void StructAggregate::take_value(double v) {
+    m_totals.count--;
+    m_totals.sum -= v;
+
+    if (m_totals.count == 0) {
+        // start clean, rather than carry rounding forward
+        m_totals         = {};
+        m_extremes_stale = false;
+    } else if (v <= m_totals.min or v >= m_totals.max) {
+        m_extremes_stale = true;
+    }
+
+    m_dirty = true;
+}
+
+double StructAggregate::min() const {
+    if (m_totals.count == 0) return std::nan("");
+    ensure_extremes();
+    return m_totals.min;
+}
+
+double StructAggregate::max() const {
+    if (m_totals.count == 0) return std::nan("");
+    ensure_extremes();
+    return m_totals.max;
+}
+
+double StructAggregate::mean() const {
+    if (m_totals.count == 0) return std::nan("");
+    return m_totals.sum / m_totals.count;
+}
+
+void StructAggregate::rebuild() {
+    m_totals         = scan();
+    m_extremes_stale = false;
+    m_dirty          = true;
+}
+
+void StructAggregate::notify() {
+    if (!m_dirty) return;
+    m_dirty = false;
+    emit changed();
+}
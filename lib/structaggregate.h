@@ -0,0 +1,197 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+
+namespace struct_model_detail {
+
+/// Totals over a set of values
+struct Reduction {
+    qsizetype count = 0;
+    double    sum   = 0;
+    double    min   = std::numeric_limits<double>::infinity();
+    double    max   = -std::numeric_limits<double>::infinity();
+
+    void merge(Reduction const& o) {
+        count += o.count;
+        sum += o.sum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+};
+
+/// Reduce a contiguous run of values. Each lane keeps its own totals, so the
+/// loop has no carried dependency and the compiler turns it into SIMD.
+template <class T>
+Reduction reduce_values(T const* values, qsizetype count) {
+    constexpr int lanes = 8;
+
+    std::array<double, lanes> sum {};
+    std::array<double, lanes> lo;
+    std::array<double, lanes> hi;
+    lo.fill(std::numeric_limits<double>::infinity());
+    hi.fill(-std::numeric_limits<double>::infinity());
+
+    qsizetype i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        for (int l = 0; l < lanes; l++) {
+            double v = double(values[i + l]);
+            sum[l] += v;
+            lo[l] = v < lo[l] ? v : lo[l];
+            hi[l] = v > hi[l] ? v : hi[l];
+        }
+    }
+
+    for (int l = 0; i < count; i++, l++) {
+        double v = double(values[i]);
+        sum[l] += v;
+        lo[l] = v < lo[l] ? v : lo[l];
+        hi[l] = v > hi[l] ? v : hi[l];
+    }
+
+    Reduction ret;
+    ret.count = count;
+    for (int l = 0; l < lanes; l++) {
+        ret.sum += sum[l];
+        ret.min = std::min(ret.min, lo[l]);
+        ret.max = std::max(ret.max, hi[l]);
+    }
+    return ret;
+}
+
+} // namespace struct_model_detail
+
+///
+/// \brief The StructAggregate class holds running totals for one numeric
+/// column of a model: count, sum, min, max and mean.
+///
+/// Totals follow the model's changes as they happen, so reading them is cheap.
+/// Removing the current min or max means rescanning the column, which is put
+/// off until the value is next read. min, max and mean are NaN while the
+/// column is empty.
+///
+class StructAggregate : public QObject {
+    Q_OBJECT
+
+    Q_PROPERTY(QString column READ column CONSTANT)
+    Q_PROPERTY(int count READ count NOTIFY changed)
+    Q_PROPERTY(double sum READ sum NOTIFY changed)
+    Q_PROPERTY(double min READ min NOTIFY changed)
+    Q_PROPERTY(double max READ max NOTIFY changed)
+    Q_PROPERTY(double mean READ mean NOTIFY changed)
+
+    QString m_name;
+    int     m_column;
+
+    mutable struct_model_detail::Reduction m_totals;
+
+    // min and max need a rescan
+    mutable bool m_extremes_stale = false;
+
+    // changed since the last notify
+    bool m_dirty = false;
+
+    void ensure_extremes() const;
+
+protected:
+    /// Totals over the whole column, computed from scratch
+    virtual struct_model_detail::Reduction scan() const = 0;
+
+    void add_value(double v);
+    void take_value(double v);
+
+public:
+    StructAggregate(QString name, int column, QObject* parent = nullptr);
+    virtual ~StructAggregate();
+
+    QString const& column() const { return m_name; }
+
+    /// Check if edits to the given column affect this aggregate
+    bool covers(int column) const { return column == m_column; }
+
+    int    count() const { return m_totals.count; }
+    double sum() const { return m_totals.sum; }
+    double min() const;
+    double max() const;
+    double mean() const;
+
+    /// Recompute everything from the column
+    void rebuild();
+
+    /// Emit changed, if anything changed since the last call
+    void notify();
+
+signals:
+    void changed();
+};
+
+namespace struct_model_detail {
+
+///
+/// \brief The RecordAggregate class is the interface the model uses to keep an
+/// aggregate current.
+///
+template <class Record>
+class RecordAggregate : public StructAggregate {
+public:
+    using StructAggregate::StructAggregate;
+
+    /// A record joined the model, or was changed in place
+    virtual void add(Record const& r) = 0;
+
+    /// A record is leaving the model, or about to be changed in place
+    virtual void take(Record const& r) = 0;
+};
+
+template <class Record, class Value>
+class MemberAggregate : public RecordAggregate<Record> {
+    static_assert(std::is_arithmetic_v<Value>,
+                  "Aggregates need a numeric member");
+
+    QVector<Record> const* m_records;
+    Value Record::*m_member;
+
+protected:
+    Reduction scan() const override {
+        // gather a block at a time, so the reduction runs over packed values
+        constexpr qsizetype block = 512;
+
+        std::array<Value, block> values;
+        Reduction                ret;
+
+        auto const& records = *m_records;
+
+        for (qsizetype first = 0; first < records.size(); first += block) {
+            auto const count = std::min(block, records.size() - first);
+            for (qsizetype i = 0; i < count; i++) {
+                values[i] = records[first + i].*m_member;
+            }
+            ret.merge(reduce_values(values.data(), count));
+        }
+
+        return ret;
+    }
+
+public:
+    MemberAggregate(QVector<Record> const* records,
+                    int                    column,
+                    QString                name,
+                    Value Record::*member,
+                    QObject*               parent)
+        : RecordAggregate<Record>(std::move(name), column, parent),
+          m_records(records),
+          m_member(member) { }
+
+    Value Record::*member() const { return m_member; }
+
+    void add(Record const& r) override { this->add_value(r.*m_member); }
+    void take(Record const& r) override { this->take_value(r.*m_member); }
+};
+
+} // namespace struct_model_detail
@@ -0,0 +1,523 @@
+#pragma once
+
+#include "structmodel.h"
+
+#include <optional>
+#include <variant>
+
+namespace struct_model_detail {
+
+template <class Meta>
+struct meta_traits;
+
+template <class H, class T>
+struct meta_traits<MetaMember<H, T>> {
+    using value_type             = T;
+    static constexpr bool stored = true;
+};
+
+template <class H, class T>
+struct meta_traits<MetaCustom<H, T>> {
+    using value_type             = T;
+    static constexpr bool stored = false;
+};
+
+template <class Record, std::size_t I>
+using meta_at = std::remove_cvref_t<decltype(std::get<I>(Record::meta))>;
+
+template <class Record, std::size_t I>
+using meta_value_t = typename meta_traits<meta_at<Record, I>>::value_type;
+
+/// Plain members get their own array; custom members are computed from the
+/// record, so they take no space.
+template <class Record, std::size_t I>
+using column_storage_t =
+    std::conditional_t<meta_traits<meta_at<Record, I>>::stored,
+                       QVector<meta_value_t<Record, I>>,
+                       std::monostate>;
+
+template <class Record, class Seq>
+struct ColumnStoreImpl;
+
+template <class Record, std::size_t... Is>
+struct ColumnStoreImpl<Record, std::index_sequence<Is...>> {
+    using type = std::tuple<column_storage_t<Record, Is>...>;
+};
+
+template <class Record>
+using ColumnStore = typename ColumnStoreImpl<
+    Record,
+    std::make_index_sequence<ColumnTable<Record>::count>>::type;
+
+template <class Record, std::size_t I>
+constexpr bool is_stored = meta_traits<meta_at<Record, I>>::stored;
+
+/// Call f with an index constant for each stored column
+template <class Record, class Function>
+void for_each_stored(Function&& f) {
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+        (..., [&] {
+            if constexpr (is_stored<Record, Is>) {
+                f(std::integral_constant<std::size_t, Is> {});
+            }
+        }());
+    }(std::make_index_sequence<ColumnTable<Record>::count> {});
+}
+
+/// Put a record back together from its columns
+template <class Record>
+Record store_record(ColumnStore<Record> const& store, int row) {
+    Record r;
+    for_each_stored<Record>([&](auto I) {
+        auto const& m = std::get<I>(Record::meta);
+        r.*m.access   = std::get<I>(store)[row];
+    });
+    return r;
+}
+
+template <class Record, std::size_t I>
+QVariant store_get(ColumnStore<Record> const& store, int row) {
+    auto const& m = std::get<I>(Record::meta);
+    if constexpr (is_stored<Record, I>) {
+        return to_variant(std::get<I>(store)[row]);
+    } else {
+        return to_variant(m.get(store_record<Record>(store, row)));
+    }
+}
+
+template <class Record, std::size_t I>
+bool store_equals(ColumnStore<Record> const& store,
+                  int                        row,
+                  QVariant const&            v) {
+    using LT = meta_value_t<Record, I>;
+
+    if constexpr (is_stored<Record, I> and !is_shared_qobject<LT>::value and
+                  std::equality_comparable<LT>) {
+        if (v.metaType() == QMetaType::fromType<LT>()) {
+            return std::get<I>(store)[row] ==
+                   *static_cast<LT const*>(v.constData());
+        }
+    }
+
+    return store_get<Record, I>(store, row) == v;
+}
+
+template <class Record, std::size_t I>
+bool store_set(ColumnStore<Record>& store, int row, QVariant const& v) {
+    auto const& m = std::get<I>(Record::meta);
+    using LT      = meta_value_t<Record, I>;
+
+    if constexpr (is_shared_qobject<LT>::value) {
+        qWarning() << "Attempting to write to a shared pointer qobject";
+        return false;
+    } else if constexpr (is_stored<Record, I>) {
+        if (!m.editable) return false;
+        std::get<I>(store)[row] = v.value<LT>();
+        return true;
+    } else {
+        // a custom setter may touch any member, so write the whole record back
+        if (!m.editable) return false;
+        Record r = store_record<Record>(store, row);
+        m.set(r, v.value<LT>());
+        for_each_stored<Record>([&](auto J) {
+            auto const& n           = std::get<J>(Record::meta);
+            std::get<J>(store)[row] = std::move(r.*n.access);
+        });
+        return true;
+    }
+}
+
+/// Per-record tables of column store accessors, indexed directly by column
+template <class Record>
+struct StoreTable {
+    using Store  = ColumnStore<Record>;
+    using Getter = QVariant (*)(Store const&, int);
+    using Setter = bool (*)(Store&, int, QVariant const&);
+    using Equals = bool (*)(Store const&, int, QVariant const&);
+
+    static constexpr int count = ColumnTable<Record>::count;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_getters(std::index_sequence<Is...>) {
+        return std::array<Getter, count> { &store_get<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_setters(std::index_sequence<Is...>) {
+        return std::array<Setter, count> { &store_set<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_equals(std::index_sequence<Is...>) {
+        return std::array<Equals, count> { &store_equals<Record, Is>... };
+    }
+
+    using Seq = std::make_index_sequence<count>;
+
+public:
+    static constexpr std::array<Getter, count> getters = make_getters(Seq {});
+    static constexpr std::array<Setter, count> setters = make_setters(Seq {});
+    static constexpr std::array<Equals, count> equals  = make_equals(Seq {});
+};
+
+} // namespace struct_model_detail
+
+///
+/// \brief The StructColumnModel class is a StructTableModel that stores each
+/// meta member in its own contiguous array, rather than storing records.
+///
+/// Scans over one member, for sorting, filtering or aggregation, only touch
+/// that member's array. Records are put back together on demand, so only
+/// members listed in the meta are kept. Custom meta entries are computed from
+/// the reassembled record.
+///
+template <class Record>
+class StructColumnModel : public StructTableModelBase {
+    using Table      = struct_model_detail::ColumnTable<Record>;
+    using StoreTable = struct_model_detail::StoreTable<Record>;
+    using Store      = struct_model_detail::ColumnStore<Record>;
+
+    Store m_columns;
+    int   m_size = 0;
+
+    // see StructTableModel; rows removed but not yet compacted away
+    struct Gap {
+        int start = 0;
+        int size  = 0;
+    };
+
+    Gap m_gap;
+
+    int physical_row(int row) const {
+        return row < m_gap.start ? row : row + m_gap.size;
+    }
+
+    template <class Function>
+    static void for_each_stored(Function&& f) {
+        struct_model_detail::for_each_stored<Record>(f);
+    }
+
+    template <class Range>
+    void write_rows(int row, Range&& records) {
+        for_each_stored([&](auto I) {
+            auto const& m = std::get<I>(Record::meta);
+            using LT      = struct_model_detail::meta_value_t<Record, I>;
+
+            QVector<LT> values;
+            values.reserve(std::size(records));
+            for (auto&& r : records) {
+                using RT = std::remove_reference_t<decltype(r)>;
+
+                // each member is taken once, so owned records can be moved
+                if constexpr (std::is_lvalue_reference_v<Range> or
+                              std::is_const_v<RT>) {
+                    values << r.*m.access;
+                } else {
+                    values << std::move(r.*m.access);
+                }
+            }
+
+            struct_model_detail::move_insert(
+                std::get<I>(m_columns), row, std::move(values));
+        });
+        m_size += std::size(records);
+    }
+
+    void write_record(int row, Record const& r) {
+        for_each_stored([&](auto I) {
+            auto const& m               = std::get<I>(Record::meta);
+            std::get<I>(m_columns)[row] = r.*m.access;
+        });
+    }
+
+    void erase_rows(int row, int count) {
+        for_each_stored(
+            [&](auto I) { std::get<I>(m_columns).remove(row, count); });
+        m_size -= count;
+    }
+
+    template <class T>
+    static constexpr bool matches(auto const& meta, T Record::*member) {
+        using M = std::remove_cvref_t<decltype(meta)>;
+        if constexpr (std::is_same_v<M, MetaMember<Record, T>>) {
+            return meta.access == member;
+        } else {
+            return false;
+        }
+    }
+
+public:
+    explicit StructColumnModel(QObject* parent = nullptr)
+        : StructTableModelBase(parent) { }
+
+    // Header:
+    QVariant headerData(int             section,
+                        Qt::Orientation orientation,
+                        int             role = Qt::DisplayRole) const override {
+        if (orientation != Qt::Orientation::Horizontal) return {};
+        if (role != Qt::DisplayRole) return {};
+
+        return struct_model_detail::get_header<Record>().value(section);
+    }
+
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override {
+        if (parent.isValid()) return 0;
+        return m_size - m_gap.size;
+    }
+
+    int columnCount(QModelIndex const& parent = QModelIndex()) const override {
+        if (parent.isValid()) return 0;
+        return Table::count;
+    }
+
+    QVariant data(QModelIndex const& index,
+                  int                role = Qt::DisplayRole) const override {
+        if (!index.isValid()) return {};
+        if (index.row() >= rowCount()) return {};
+
+        int location = -1;
+
+        if (role == Qt::DisplayRole or role == Qt::EditRole) {
+            location = index.column();
+        } else if (role >= Qt::UserRole) {
+            location = role - Qt::UserRole;
+        }
+
+        if (!Table::in_range(location)) return {};
+
+        return StoreTable::getters[location](m_columns,
+                                             physical_row(index.row()));
+    }
+
+    bool setData(QModelIndex const& index,
+                 QVariant const&    value,
+                 int                role = Qt::EditRole) override {
+        if (!index.isValid()) return false;
+        if (index.row() >= rowCount()) return false;
+
+        int location = -1;
+
+        if (role >= Qt::UserRole) {
+            location = role - Qt::UserRole;
+        } else {
+            location = index.column();
+        }
+
+        if (!Table::in_range(location)) return false;
+
+        int const row = physical_row(index.row());
+
+        if (StoreTable::equals[location](m_columns, row, value)) return false;
+
+        if (!StoreTable::setters[location](m_columns, row, value)) {
+            return false;
+        }
+
+        note_changed(index.row(), index.column(), role);
+        return true;
+    }
+
+    Qt::ItemFlags flags(QModelIndex const& index) const override {
+        if (!index.isValid()) return Qt::NoItemFlags;
+
+        if (!Table::in_range(index.column())) return Qt::NoItemFlags;
+
+        if (!Table::editable[index.column()]) return Qt::ItemIsEnabled;
+
+        return Qt::ItemIsEditable | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    }
+
+    QHash<int, QByteArray> roleNames() const override {
+        return struct_model_detail::get_name_map<Record>();
+    }
+
+    bool insertRows(int                row,
+                    int                count,
+                    QModelIndex const& p = QModelIndex()) override {
+        if (p.isValid()) return false;
+        if (row < 0 or row > rowCount() or count <= 0) return false;
+
+        insert_at(row, QVector<Record>(count));
+        return true;
+    }
+
+    bool removeRows(int                row,
+                    int                count,
+                    QModelIndex const& p = QModelIndex()) override {
+        if (p.isValid()) return false;
+        if (row < 0 or count <= 0) return false;
+        if (row + count > rowCount()) return false;
+
+        remove_at(row, count);
+        return true;
+    }
+
+    void reset(QList<Record> new_records = {}) {
+        clear_pending();
+
+        beginResetModel();
+        for_each_stored([&](auto I) { std::get<I>(m_columns).clear(); });
+        m_size = 0;
+        write_rows(0, std::move(new_records));
+        endResetModel();
+    }
+
+    // this emits a remove signal, instead of a reset
+    void remove_all() {
+        if (m_size == 0) return;
+        remove_at(0, m_size);
+    }
+
+    /// Obtain a copy of the record at a row, put together from the columns
+    std::optional<Record> get_at(int i) const {
+        if (i < 0) return {};
+        if (i >= rowCount()) return {};
+        return struct_model_detail::store_record<Record>(m_columns,
+                                                         physical_row(i));
+    }
+
+    void append(Record const& r) { insert_at(m_size, std::span(&r, 1)); }
+
+    void append(QVector<Record> r) { insert_at(m_size, std::move(r)); }
+
+    void insert_at(int index, std::span<Record const> records) {
+        if (records.empty()) return;
+        beginInsertRows({}, index, index + records.size() - 1);
+        write_rows(index, records);
+        endInsertRows();
+
+        shift_pending(index, records.size());
+    }
+
+    void insert_at(int index, QVector<Record>&& records) {
+        if (records.isEmpty()) return;
+
+        int const count = records.size();
+
+        beginInsertRows({}, index, index + count - 1);
+        write_rows(index, std::move(records));
+        endInsertRows();
+
+        shift_pending(index, count);
+    }
+
+    void update(int i, Record const& r) {
+        if (i < 0) return;
+        if (i >= m_size) return;
+
+        write_record(i, r);
+
+        note_changed(i, -1, -1);
+    }
+
+    void remove_at(int index, int count = 1) {
+        if (index < 0) return;
+        if (index >= m_size) return;
+
+        count = std::min(count, m_size - index);
+        if (count <= 0) return;
+
+        beginRemoveRows({}, index, index + count - 1);
+        erase_rows(index, count);
+        endRemoveRows();
+
+        drop_pending(index, count);
+    }
+
+    /// Delete records matching a predicate. The predicate is given a
+    /// reassembled record; prefer remove_by_column() when testing one member.
+    template <class Function>
+    void remove_by_predicate(Function&& f) {
+        QVector<int> rows;
+        for (int i = 0; i < m_size; i++) {
+            if (f(struct_model_detail::store_record<Record>(m_columns, i))) {
+                rows << i;
+            }
+        }
+        remove_rows(rows);
+    }
+
+    /// Delete records where a single member matches a predicate. Only that
+    /// member's array is scanned.
+    template <class T, class Function>
+    void remove_by_column(T Record::*member, Function&& f) {
+        auto values = column(member);
+
+        QVector<int> rows;
+        for (int i = 0; i < int(values.size()); i++) {
+            if (f(values[i])) rows << i;
+        }
+        remove_rows(rows);
+    }
+
+    /// Remove sorted rows, one notification per contiguous run. Every kept
+    /// value is moved at most once.
+    void remove_rows(QVector<int> const& sorted_rows) {
+        auto runs = struct_model_detail::rows_to_runs(sorted_rows);
+
+        if (runs.isEmpty()) return;
+
+        int const total = m_size;
+
+        int write = 0;
+        int read  = 0;
+
+        auto slide = [this](int from, int to, int dest) {
+            for_each_stored([&](auto I) {
+                auto& c = std::get<I>(m_columns);
+                std::move(c.begin() + from, c.begin() + to, c.begin() + dest);
+            });
+        };
+
+        for (auto const& run : runs) {
+            // nothing has been removed before the first run, and moving a
+            // value onto itself may empty it
+            if (write != read) slide(read, run.start, write);
+            write += run.start - read;
+            read = run.start;
+
+            m_gap = { write, read - write };
+
+            beginRemoveRows({}, write, write + run.count - 1);
+            read += run.count;
+            m_gap = { write, read - write };
+            endRemoveRows();
+
+            drop_pending(write, run.count);
+        }
+
+        slide(read, total, write);
+        write += total - read;
+
+        m_gap = {};
+        for_each_stored([&](auto I) {
+            auto& c = std::get<I>(m_columns);
+            c.erase(c.begin() + write, c.end());
+        });
+        m_size = write;
+    }
+
+    /// Obtain the contiguous array holding a member
+    template <class T>
+    std::span<T const> column(T Record::*member) const {
+        std::span<T const> ret;
+
+        for_each_stored([&](auto I) {
+            using LT = struct_model_detail::meta_value_t<Record, I>;
+
+            if constexpr (std::is_same_v<LT, T>) {
+                if (matches(std::get<I>(Record::meta), member)) {
+                    auto const& c = std::get<I>(m_columns);
+                    ret = std::span<T const>(c.constData(), m_size);
+                }
+            }
+        });
+
+        Q_ASSERT(ret.data() or m_size == 0);
+
+        return ret;
+    }
+
+    int size() const { return m_size; }
+};
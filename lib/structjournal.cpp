@@ -0,0 +1,31 @@
+#include "structjournal.h"
+
+#include <algorithm>
+
+StructJournal::StructJournal(QObject* parent) : QObject(parent) { }
+
+StructJournal::~StructJournal() = default;
+
+void StructJournal::set_limit(qsizetype bytes) {
+    m_limit = std::max<qsizetype>(bytes, 0);
+    trim();
+    emit changed();
+}
+
+void StructJournal::set_max_steps(int count) {
+    m_max_steps = std::max(count, 1);
+    trim();
+    emit changed();
+}
+
+void StructJournal::undo() {
+    if (!can_undo()) return;
+    replay(true);
+    emit changed();
+}
+
+void StructJournal::redo() {
+    if (!can_redo()) return;
+    replay(false);
+    emit changed();
+}
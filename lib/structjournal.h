@@ -0,0 +1,463 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+///
+/// \brief The StructJournal class keeps the undo and redo history of a model.
+///
+/// Each change to the model is one step; changes made inside a batch become a
+/// single step. Undoing or redoing a step replays it as one batch, so views
+/// see a single coalesced set of notifications.
+///
+/// The history is bounded: once it grows past limit() bytes or max_steps()
+/// steps, the oldest steps are dropped. Byte counts cover the records and
+/// members held, but not memory those own in turn, such as string data.
+///
+class StructJournal : public QObject {
+    Q_OBJECT
+
+    Q_PROPERTY(bool can_undo READ can_undo NOTIFY changed)
+    Q_PROPERTY(bool can_redo READ can_redo NOTIFY changed)
+
+protected:
+    qsizetype m_limit     = 64 * 1024 * 1024;
+    int       m_max_steps = 1000;
+
+    /// Apply the newest undo step, or the newest redo step
+    virtual void replay(bool undo) = 0;
+
+    /// Drop old steps until the history fits the limits
+    virtual void trim() = 0;
+
+public:
+    explicit StructJournal(QObject* parent = nullptr);
+    virtual ~StructJournal();
+
+    virtual int undo_count() const = 0;
+    virtual int redo_count() const = 0;
+
+    bool can_undo() const { return undo_count() > 0; }
+    bool can_redo() const { return redo_count() > 0; }
+
+    /// Approximate memory held by the history
+    virtual qsizetype bytes() const = 0;
+
+    /// Set the most memory the history should hold, in bytes. The newest step
+    /// is kept even if it alone is larger.
+    void      set_limit(qsizetype bytes);
+    qsizetype limit() const { return m_limit; }
+
+    /// Set the most steps the history holds
+    void set_max_steps(int count);
+    int  max_steps() const { return m_max_steps; }
+
+    /// Forget the whole history
+    virtual void clear() = 0;
+
+    Q_INVOKABLE void undo();
+    Q_INVOKABLE void redo();
+
+signals:
+    void changed();
+};
+
+template <class Record>
+class StructTableModel;
+
+namespace struct_model_detail {
+
+/// A single member value, typed through the meta
+template <class Record>
+struct MemberValue {
+    virtual ~MemberValue() = default;
+
+    /// Write the value back into a record
+    virtual void apply(Record& r) const = 0;
+
+    virtual qsizetype bytes() const = 0;
+};
+
+template <class Record, std::size_t I>
+struct TypedMemberValue final : MemberValue<Record> {
+    using Type = std::remove_cvref_t<decltype(std::get<I>(Record::meta).get(
+        std::declval<Record const&>()))>;
+
+    Type value;
+
+    explicit TypedMemberValue(Record const& r)
+        : value(std::get<I>(Record::meta).get(r)) { }
+
+    void apply(Record& r) const override {
+        std::get<I>(Record::meta).set(r, Type(value));
+    }
+
+    qsizetype bytes() const override { return sizeof(*this); }
+};
+
+template <class Record>
+using ValuePtr = std::unique_ptr<MemberValue<Record>>;
+
+template <class Record, std::size_t I>
+ValuePtr<Record> capture_member(Record const& r) {
+    auto const& m = std::get<I>(Record::meta);
+
+    // custom entries without a setter are derived from other members, so
+    // there is nothing to restore
+    if constexpr (requires { m.setter; }) {
+        if (!m.setter) return nullptr;
+    }
+
+    return std::make_unique<TypedMemberValue<Record, I>>(r);
+}
+
+template <class Record>
+struct CaptureTable {
+    using Capture = ValuePtr<Record> (*)(Record const&);
+
+    static constexpr int count =
+        std::tuple_size_v<std::remove_cvref_t<decltype(Record::meta)>>;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_captures(std::index_sequence<Is...>) {
+        return std::array<Capture, count> { &capture_member<Record, Is>... };
+    }
+
+public:
+    static constexpr std::array<Capture, count> captures =
+        make_captures(std::make_index_sequence<count> {});
+};
+
+///
+/// \brief The RecordJournal class records the changes to a StructTableModel,
+/// and replays them backwards or forwards.
+///
+/// Inserted and removed rows keep their records in the journal only while
+/// they are out of the model, so a done insert costs almost nothing. Edits
+/// keep just the members that changed.
+///
+template <class Record>
+class RecordJournal : public StructJournal {
+    using Model = StructTableModel<Record>;
+
+    struct Op {
+        enum Kind { Edit, Insert, Remove, Reset, Permute };
+
+        Kind kind   = Edit;
+        int  row    = 0;
+        int  count  = 0;
+        int  column = -1;
+
+        // Edit: the member before and after
+        ValuePtr<Record> before;
+        ValuePtr<Record> after;
+
+        // Insert and Remove: the rows, while they are out of the model.
+        // Reset: the contents not currently in the model.
+        QVector<Record> records;
+
+        // Permute: the old row of each new row
+        QVector<int> order;
+
+        qsizetype bytes() const {
+            qsizetype ret = sizeof(Op) + records.size() * sizeof(Record) +
+                            order.size() * sizeof(int);
+            if (before) ret += before->bytes();
+            if (after) ret += after->bytes();
+            return ret;
+        }
+    };
+
+    using Step = std::vector<Op>;
+
+    Model* m_model;
+
+    std::deque<Step> m_undo;
+    std::deque<Step> m_redo; // newest at the back
+    Step             m_open;
+
+    qsizetype m_bytes = 0;
+
+    // set while replaying, or while the model makes changes that cannot be
+    // replayed, so those are not recorded
+    bool m_paused = false;
+
+    static qsizetype step_bytes(Step const& s) {
+        qsizetype ret = 0;
+        for (auto const& op : s) {
+            ret += op.bytes();
+        }
+        return ret;
+    }
+
+    Op& add(typename Op::Kind kind) {
+        if (!m_redo.empty()) {
+            for (auto const& s : m_redo) {
+                m_bytes -= step_bytes(s);
+            }
+            m_redo.clear();
+        }
+
+        auto& op = m_open.emplace_back();
+        op.kind  = kind;
+        return op;
+    }
+
+    /// Put the rows of an op back into the model
+    void put_back(Op& op) {
+        m_model->do_insert(op.row, std::exchange(op.records, {}));
+    }
+
+    /// Take the rows of an op out of the model
+    void take_out(Op& op) {
+        op.records = m_model->copy_rows(op.row, op.count);
+        m_model->do_remove(op.row, op.count);
+    }
+
+    void apply(Op& op, bool undo) {
+        switch (op.kind) {
+        case Op::Edit:
+            m_model->apply_member(
+                op.row, op.column, undo ? *op.before : *op.after);
+            break;
+        case Op::Insert: undo ? take_out(op) : put_back(op); break;
+        case Op::Remove: undo ? put_back(op) : take_out(op); break;
+        case Op::Reset:
+            op.records = m_model->swap_records(std::move(op.records));
+            break;
+        case Op::Permute:
+            m_model->layout_rows(undo ? inverse(op.order) : op.order);
+            break;
+        }
+    }
+
+    static QVector<int> inverse(QVector<int> const& order) {
+        QVector<int> ret(order.size());
+        for (int i = 0; i < order.size(); i++) {
+            ret[order[i]] = i;
+        }
+        return ret;
+    }
+
+    /// Check if an edit only continues the one before it, as with typing
+    static bool continues(Step const& prev, Step const& next) {
+        if (prev.size() != 1 or next.size() != 1) return false;
+
+        auto const& a = prev.front();
+        auto const& b = next.front();
+
+        return a.kind == Op::Edit and b.kind == Op::Edit and a.row == b.row and
+               a.column == b.column;
+    }
+
+protected:
+    void replay(bool undo) override {
+        auto& from = undo ? m_undo : m_redo;
+        auto& to   = undo ? m_redo : m_undo;
+
+        Step step = std::move(from.back());
+        from.pop_back();
+
+        m_bytes -= step_bytes(step);
+
+        m_paused = true;
+        m_model->begin_batch();
+
+        if (undo) {
+            for (auto i = step.rbegin(); i != step.rend(); ++i) {
+                apply(*i, true);
+            }
+        } else {
+            for (auto& op : step) {
+                apply(op, false);
+            }
+        }
+
+        m_model->end_batch();
+        m_paused = false;
+
+        m_bytes += step_bytes(step);
+        to.push_back(std::move(step));
+
+        trim();
+    }
+
+    void trim() override {
+        while (m_undo.size() + m_redo.size() > 1 and
+               (m_bytes > m_limit or
+                int(m_undo.size() + m_redo.size()) > m_max_steps)) {
+            // the oldest undo step goes first, then the furthest redo
+            auto& victims = m_undo.empty() ? m_redo : m_undo;
+            auto& victim  = m_undo.empty() ? m_redo.front() : m_undo.front();
+
+            m_bytes -= step_bytes(victim);
+            victims.pop_front();
+        }
+    }
+
+public:
+    RecordJournal(Model* model, QObject* parent)
+        : StructJournal(parent), m_model(model) { }
+
+    bool recording() const { return !m_paused; }
+
+    /// Stop recording for a while
+    void set_paused(bool paused) { m_paused = paused; }
+
+    int undo_count() const override { return m_undo.size(); }
+    int redo_count() const override { return m_redo.size(); }
+
+    qsizetype bytes() const override { return m_bytes + step_bytes(m_open); }
+
+    void clear() override {
+        m_undo.clear();
+        m_redo.clear();
+        m_open.clear();
+        m_bytes = 0;
+        emit changed();
+    }
+
+    /// Capture a member before an edit
+    ValuePtr<Record> capture(int column, Record const& r) const {
+        if (!recording()) return nullptr;
+        return CaptureTable<Record>::captures[column](r);
+    }
+
+    /// Record an edit to one member, given its value from capture()
+    void record_edit(int              row,
+                     int              column,
+                     ValuePtr<Record> before,
+                     Record const&    r) {
+        if (!recording() or !before) return;
+
+        auto after = CaptureTable<Record>::captures[column](r);
+
+        if (!m_open.empty()) {
+            auto& last = m_open.back();
+            if (last.kind == Op::Edit and last.row == row and
+                last.column == column) {
+                last.after = std::move(after);
+                return;
+            }
+        }
+
+        auto& op  = add(Op::Edit);
+        op.row    = row;
+        op.column = column;
+        op.before = std::move(before);
+        op.after  = std::move(after);
+    }
+
+    /// Record the members that differ between a record and its replacement
+    template <class Same>
+    void record_update(int           row,
+                       Record const& before,
+                       Record const& after,
+                       Same const&   same) {
+        if (!recording()) return;
+
+        for (int c = 0; c < CaptureTable<Record>::count; c++) {
+            if (same[c](before, after)) continue;
+            record_edit(row, c, capture(c, before), after);
+        }
+    }
+
+    /// Record rows inserted at a row, in the order the model sees them
+    void record_insert(int row, int count) {
+        if (!recording() or count <= 0) return;
+
+        if (!m_open.empty()) {
+            auto& last = m_open.back();
+
+            // rows landing inside or next to the last insert extend it
+            if (last.kind == Op::Insert and row >= last.row and
+                row <= last.row + last.count) {
+                last.count += count;
+                return;
+            }
+        }
+
+        auto& op = add(Op::Insert);
+        op.row   = row;
+        op.count = count;
+    }
+
+    /// Record rows about to be removed, given their records
+    void record_remove(int row, QVector<Record> records) {
+        if (!recording() or records.isEmpty()) return;
+
+        int const count = records.size();
+
+        if (!m_open.empty()) {
+            auto& last = m_open.back();
+
+            if (last.kind == Op::Remove and row == last.row) {
+                last.records.append(std::move(records));
+                last.count += count;
+                return;
+            }
+
+            if (last.kind == Op::Remove and row + count == last.row) {
+                records.append(std::move(last.records));
+                last.records = std::move(records);
+                last.row     = row;
+                last.count += count;
+                return;
+            }
+        }
+
+        auto& op   = add(Op::Remove);
+        op.row     = row;
+        op.count   = count;
+        op.records = std::move(records);
+    }
+
+    /// Record a reset, given the contents it replaces
+    void record_reset(QVector<Record> old_records) {
+        if (!recording()) return;
+
+        auto& op   = add(Op::Reset);
+        op.records = std::move(old_records);
+    }
+
+    /// Record a rearrangement of every row, as done by a sort
+    void record_permute(QVector<int> order) {
+        if (!recording()) return;
+
+        auto& op = add(Op::Permute);
+        op.order = std::move(order);
+    }
+
+    /// Close the open step, if there is one. Called when a change, or a
+    /// batch of changes, is finished.
+    void seal() {
+        if (m_open.empty()) return;
+
+        if (!m_undo.empty() and continues(m_undo.back(), m_open)) {
+            auto& last = m_undo.back().front();
+            m_bytes -= last.bytes();
+            last.after = std::move(m_open.front().after);
+            m_bytes += last.bytes();
+            m_open.clear();
+            return;
+        }
+
+        m_bytes += step_bytes(m_open);
+        m_undo.push_back(std::move(m_open));
+        m_open.clear();
+
+        trim();
+
+        emit changed();
+    }
+};
+
+} // namespace struct_model_detail
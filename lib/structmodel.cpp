@@ -1 +1,193 @@
 #include "structmodel.h"
+
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+
+namespace struct_model_detail {
+
+void parallel_for(int count, std::function<void(int)> const& f) {
+    if (count == 1) {
+        f(0);
+        return;
+    }
+
+    QThreadPool pool;
+
+    for (int i = 0; i < count; i++) {
+        pool.start([&f, i]() { f(i); });
+    }
+
+    pool.waitForDone();
+}
+
+int sort_parts(qsizetype count) {
+    // below this, threads cost more than they save
+    static constexpr qsizetype min_part = 1 << 14;
+
+    auto const threads = std::max(QThread::idealThreadCount(), 1);
+    auto const parts   = std::min<qsizetype>(threads, count / min_part);
+
+    if (parts <= 1) return 1;
+
+    return int(std::bit_floor(quint64(parts)));
+}
+
+} // namespace struct_model_detail
+
+StructTableModelBase::~StructTableModelBase() = default;
+
+void StructTableModelBase::begin_batch() {
+    m_batch_depth++;
+}
+
+void StructTableModelBase::end_batch() {
+    Q_ASSERT(m_batch_depth > 0);
+
+    if (m_batch_depth <= 0) return;
+
+    m_batch_depth--;
+
+    if (m_batch_depth > 0) return;
+
+    flush_structure();
+    flush_changes();
+    batch_finished();
+}
+
+StructAggregate* StructTableModelBase::aggregate(QString const& column) const {
+    for (auto* a : m_named_aggregates) {
+        if (a->column() == column) return a;
+    }
+    return nullptr;
+}
+
+void StructTableModelBase::note_changed(int row, int column, int role) {
+    if (!in_batch()) {
+        int first = column < 0 ? 0 : column;
+        int last  = column < 0 ? columnCount() - 1 : column;
+
+        QList<int> roles;
+        if (role >= 0) roles << role;
+
+        emit dataChanged(index(row, first), index(row, last), roles);
+        return;
+    }
+
+    m_pending_changes.push_back({ row, column, role });
+}
+
+void StructTableModelBase::shift_pending(int row, int count) {
+    for (auto& c : m_pending_changes) {
+        if (c.row >= row) c.row += count;
+    }
+}
+
+void StructTableModelBase::drop_pending(int row, int count) {
+    std::erase_if(m_pending_changes, [row, count](PendingChange const& c) {
+        return c.row >= row and c.row < row + count;
+    });
+
+    for (auto& c : m_pending_changes) {
+        if (c.row >= row + count) c.row -= count;
+    }
+}
+
+void StructTableModelBase::move_pending(int from, int to) {
+    for (auto& c : m_pending_changes) {
+        if (c.row == from) {
+            c.row = to;
+        } else if (from < to and c.row > from and c.row <= to) {
+            c.row--;
+        } else if (to < from and c.row >= to and c.row < from) {
+            c.row++;
+        }
+    }
+}
+
+void StructTableModelBase::permute_pending(QVector<int> const& new_row) {
+    for (auto& c : m_pending_changes) {
+        c.row = new_row.value(c.row, c.row);
+    }
+}
+
+void StructTableModelBase::clear_pending() {
+    m_pending_changes.clear();
+}
+
+void StructTableModelBase::flush_changes() {
+    if (m_pending_changes.empty()) return;
+
+    auto changes = std::move(m_pending_changes);
+    m_pending_changes.clear();
+
+    std::sort(changes.begin(), changes.end(), [](auto const& a, auto const& b) {
+        return std::tie(a.row, a.column, a.role) <
+               std::tie(b.row, b.column, b.role);
+    });
+
+    int const last_column = columnCount() - 1;
+
+    // a contiguous block of rows that share a column span and role list
+    struct Range {
+        int        first_row, last_row;
+        int        first_column, last_column;
+        QList<int> roles;
+    };
+
+    auto emit_range = [this](Range const& r) {
+        emit dataChanged(index(r.first_row, r.first_column),
+                         index(r.last_row, r.last_column),
+                         r.roles);
+    };
+
+    std::optional<Range> current;
+
+    auto iter = changes.begin();
+
+    while (iter != changes.end()) {
+        int const row = iter->row;
+
+        Range next { row, row, last_column, 0, {} };
+
+        bool all_roles = false;
+
+        for (; iter != changes.end() and iter->row == row; ++iter) {
+            if (iter->column < 0) {
+                next.first_column = 0;
+                next.last_column  = last_column;
+            } else {
+                next.first_column = std::min(next.first_column, iter->column);
+                next.last_column  = std::max(next.last_column, iter->column);
+            }
+
+            if (iter->role < 0) {
+                all_roles = true;
+            } else if (!next.roles.contains(iter->role)) {
+                next.roles << iter->role;
+            }
+        }
+
+        if (all_roles) {
+            next.roles.clear();
+        } else {
+            std::sort(next.roles.begin(), next.roles.end());
+        }
+
+        if (current and current->last_row + 1 == row and
+            current->first_column == next.first_column and
+            current->last_column == next.last_column and
+            current->roles == next.roles) {
+            current->last_row = row;
+            continue;
+        }
+
+        if (current) emit_range(*current);
+        current = std::move(next);
+    }
+
+    if (current) emit_range(*current);
+}
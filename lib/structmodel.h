@@ -1,201 +1,1272 @@
 #pragma once
 
+#include "structaggregate.h"
+#include "structjournal.h"
+#include "structmodelindex.h"
+
 #include <QAbstractTableModel>
 #include <QDebug>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <concepts>
+#include <functional>
+#include <memory>
 #include <span>
+#include <utility>
+#include <vector>
 
 namespace struct_model_detail {
 
 template <class Tuple, class Function>
-auto tuple_for_each(Tuple&& t, Function&& f) {
+constexpr auto tuple_for_each(Tuple&& t, Function&& f) {
     std::apply([&](auto&... x) { (..., f(x)); }, t);
 }
 
-template <class Tuple, int I, class Function>
-struct _get_by_idx {
-    static_assert(I >= 1);
-    static void check(Tuple&& t, int i, Function&& f) {
-        if (I == i) { return f(std::get<I>(t)); }
+template <class T>
+constexpr bool is_qobject = std::is_base_of_v<QObject, std::remove_cvref_t<T>>;
+
+template <class T>
+struct is_shared_qobject {
+    static constexpr bool value = false;
+};
+
+template <class T>
+struct is_shared_qobject<std::shared_ptr<T>> {
+    static constexpr bool value = is_qobject<T>;
+};
 
-        _get_by_idx<Tuple, I - 1, Function>::check(t, i, std::move(f));
+// Converting a member value to a variant. Shared QObjects are exposed as the
+// raw pointer, so QML can get at them.
+template <class T>
+QVariant to_variant(T const& value) {
+    if constexpr (is_shared_qobject<std::remove_cvref_t<T>>::value) {
+        return QVariant::fromValue(value.get());
+    } else {
+        return QVariant::fromValue(value);
     }
+}
+
+template <class Record, std::size_t I>
+QVariant column_get(Record const& r) {
+    auto const& m = std::get<I>(Record::meta);
+    return to_variant(m.get(r));
+}
+
+template <class Record, std::size_t I>
+bool column_set(Record& r, QVariant const& v) {
+    auto const& m = std::get<I>(Record::meta);
+    using LT      = std::remove_cvref_t<decltype(m.get(r))>;
+
+    if constexpr (is_shared_qobject<LT>::value) {
+        // editing a shared ptr is not supported at this time
+        qWarning() << "Attempting to write to a shared pointer qobject";
+        return false;
+    } else {
+        if (!m.editable) return false;
+        m.set(r, v.value<LT>());
+        return true;
+    }
+}
+
+/// Check if the member at I is equal to the given variant, without boxing the
+/// member. Falls back to a variant comparison if the types do not line up.
+template <class Record, std::size_t I>
+bool column_equals(Record const& r, QVariant const& v) {
+    auto const& m = std::get<I>(Record::meta);
+    using LT      = std::remove_cvref_t<decltype(m.get(r))>;
+
+    if constexpr (!is_shared_qobject<LT>::value &&
+                  std::equality_comparable<LT>) {
+        if (v.metaType() == QMetaType::fromType<LT>()) {
+            return m.get(r) == *static_cast<LT const*>(v.constData());
+        }
+    }
+
+    return to_variant(m.get(r)) == v;
+}
+
+/// Check if the member at I is the same in both records. Members that cannot
+/// be compared are always reported as different.
+template <class Record, std::size_t I>
+bool column_same(Record const& a, Record const& b) {
+    auto const& m = std::get<I>(Record::meta);
+    using LT      = std::remove_cvref_t<decltype(m.get(a))>;
+
+    if constexpr (std::equality_comparable<LT>) {
+        return m.get(a) == m.get(b);
+    } else {
+        return false;
+    }
+}
+
+/// Ordering of natively ordered values. NaN orders after every number, so
+/// floating point columns still sort consistently.
+template <class T>
+bool value_less(T const& a, T const& b) {
+    if constexpr (std::is_floating_point_v<T>) {
+        if (std::isnan(b)) return !std::isnan(a);
+        if (std::isnan(a)) return false;
+    }
+    return a < b;
+}
+
+/// Check if the member at I in a orders before the one in b. Members without
+/// a native ordering are compared as variants.
+template <class Record, std::size_t I>
+bool column_less(Record const& a, Record const& b) {
+    auto const& m = std::get<I>(Record::meta);
+    using LT      = std::remove_cvref_t<decltype(m.get(a))>;
+
+    if constexpr (std::totally_ordered<LT>) {
+        return value_less(m.get(a), m.get(b));
+    } else {
+        return QVariant::compare(to_variant(m.get(a)), to_variant(m.get(b))) ==
+               QPartialOrdering::Less;
+    }
+}
+
+/// Per-record tables of accessors, indexed directly by column
+template <class Record>
+struct ColumnTable {
+    using Getter = QVariant (*)(Record const&);
+    using Setter = bool (*)(Record&, QVariant const&);
+    using Equals = bool (*)(Record const&, QVariant const&);
+    using Same   = bool (*)(Record const&, Record const&);
+    using Less   = bool (*)(Record const&, Record const&);
+
+    static constexpr int count =
+        std::tuple_size_v<std::remove_cvref_t<decltype(Record::meta)>>;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_getters(std::index_sequence<Is...>) {
+        return std::array<Getter, count> { &column_get<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_setters(std::index_sequence<Is...>) {
+        return std::array<Setter, count> { &column_set<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_equals(std::index_sequence<Is...>) {
+        return std::array<Equals, count> { &column_equals<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_same(std::index_sequence<Is...>) {
+        return std::array<Same, count> { &column_same<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_less(std::index_sequence<Is...>) {
+        return std::array<Less, count> { &column_less<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_editable(std::index_sequence<Is...>) {
+        return std::array<bool, count> {
+            static_cast<bool>(std::get<Is>(Record::meta).editable)...
+        };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_names(std::index_sequence<Is...>) {
+        return std::array<char const*, count> {
+            std::get<Is>(Record::meta).name...
+        };
+    }
+
+    using Seq = std::make_index_sequence<count>;
+
+public:
+    static constexpr std::array<Getter, count> getters  = make_getters(Seq {});
+    static constexpr std::array<Setter, count> setters  = make_setters(Seq {});
+    static constexpr std::array<Equals, count> equals   = make_equals(Seq {});
+    static constexpr std::array<Same, count>   same     = make_same(Seq {});
+    static constexpr std::array<Less, count>   less     = make_less(Seq {});
+    static constexpr std::array<bool, count>   editable = make_editable(Seq {});
+
+    static constexpr std::array<char const*, count> names = make_names(Seq {});
+
+    static constexpr bool in_range(int i) { return i >= 0 and i < count; }
 };
 
-template <class Tuple, class Function>
-struct _get_by_idx<Tuple, 0, Function> {
-    static void check(Tuple&& t, int i, Function&& f) {
-        if (0 == i) { return f(std::get<0>(t)); }
+/// A contiguous run of rows
+struct RowRun {
+    int start;
+    int count;
+};
+
+/// Collapse a sorted list of rows into contiguous runs
+template <class Range>
+QVector<RowRun> rows_to_runs(Range const& sorted_rows) {
+    QVector<RowRun> ret;
+
+    for (int row : sorted_rows) {
+        if (!ret.isEmpty() and ret.last().start + ret.last().count == row) {
+            ret.last().count++;
+        } else {
+            ret << RowRun { row, 1 };
+        }
+    }
+
+    return ret;
+}
+
+/// Find a longest strictly increasing subsequence of values, returning a flag
+/// per entry marking membership
+inline QVector<bool> longest_increasing(QVector<int> const& values) {
+    QVector<int> tails;       // index of the smallest tail for each length
+    QVector<int> prev(values.size(), -1);
+
+    for (int i = 0; i < values.size(); i++) {
+        auto pos = std::lower_bound(
+            tails.begin(), tails.end(), values[i], [&values](int t, int v) {
+                return values[t] < v;
+            });
+
+        if (pos != tails.begin()) prev[i] = *(pos - 1);
+
+        if (pos == tails.end()) {
+            tails << i;
+        } else {
+            *pos = i;
+        }
+    }
+
+    QVector<bool> ret(values.size(), false);
+
+    for (int i = tails.isEmpty() ? -1 : tails.last(); i >= 0; i = prev[i]) {
+        ret[i] = true;
+    }
+
+    return ret;
+}
+
+/// Run a function for each index on a thread pool, and wait for all of them
+void parallel_for(int count, std::function<void(int)> const& f);
+
+/// Number of parts to sort count items in, one per thread for large counts
+int sort_parts(qsizetype count);
+
+/// Sort a range, sorting parts in parallel and then merging them. The order
+/// of equal items is not kept, so ties should be broken by the comparison.
+template <class Iter, class Compare>
+void parallel_sort(Iter first, Iter last, Compare comp) {
+    int const parts = sort_parts(last - first);
+
+    if (parts == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<qsizetype> bounds(parts + 1);
+    for (int i = 0; i <= parts; i++) {
+        bounds[i] = (last - first) * i / parts;
+    }
+
+    parallel_for(parts, [&](int i) {
+        std::sort(first + bounds[i], first + bounds[i + 1], comp);
+    });
+
+    // parts is a power of two, so the merges pair up evenly
+    for (int width = 1; width < parts; width *= 2) {
+        parallel_for(parts / (width * 2), [&](int j) {
+            int const lo = j * width * 2;
+            std::inplace_merge(first + bounds[lo],
+                               first + bounds[lo + width],
+                               first + bounds[lo + width * 2],
+                               comp);
+        });
+    }
+}
+
+/// Sort row numbers, given in order, by a single member. Values are gathered
+/// next to their rows first, rather than compared through the records. Ties
+/// keep their row order.
+template <class Record, std::size_t I>
+void sort_rows_by(QVector<Record> const& records,
+                  QVector<int>&          order,
+                  bool                   descending) {
+    auto const& m = std::get<I>(Record::meta);
+    using T = std::remove_cvref_t<decltype(m.get(std::declval<Record>()))>;
+
+    if constexpr (std::totally_ordered<T>) {
+        struct Entry {
+            T   value;
+            int row;
+        };
+
+        std::vector<Entry> entries;
+        entries.reserve(records.size());
+        for (int i = 0; i < records.size(); i++) {
+            entries.push_back({ m.get(records[i]), i });
+        }
 
-        throw std::runtime_error("Bad index");
+        parallel_sort(entries.begin(),
+                      entries.end(),
+                      [descending](Entry const& a, Entry const& b) {
+                          if (value_less(a.value, b.value)) return !descending;
+                          if (value_less(b.value, a.value)) return descending;
+                          return a.row < b.row;
+                      });
+
+        for (int i = 0; i < records.size(); i++) {
+            order[i] = entries[i].row;
+        }
+    } else {
+        parallel_sort(
+            order.begin(), order.end(), [&, descending](int a, int b) {
+                auto const& ra = records[a];
+                auto const& rb = records[b];
+                if (column_less<Record, I>(ra, rb)) return !descending;
+                if (column_less<Record, I>(rb, ra)) return descending;
+                return a < b;
+            });
     }
+}
+
+/// Per-record single member sorts, indexed by column
+template <class Record>
+struct SortTable {
+    using Sort = void (*)(QVector<Record> const&, QVector<int>&, bool);
+
+    static constexpr int count =
+        std::tuple_size_v<std::remove_cvref_t<decltype(Record::meta)>>;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_sorts(std::index_sequence<Is...>) {
+        return std::array<Sort, count> { &sort_rows_by<Record, Is>... };
+    }
+
+public:
+    static constexpr std::array<Sort, count> sorts =
+        make_sorts(std::make_index_sequence<count> {});
 };
 
+/// Make room for count more items, growing geometrically so that repeated
+/// calls do not reallocate every time
+template <class T>
+void grow_for(QVector<T>& dest, qsizetype count) {
+    auto const needed = dest.size() + count;
+    if (needed <= dest.capacity()) return;
+    dest.reserve(std::max(needed, dest.capacity() * 2));
+}
 
-template <class Tuple, class Function>
-void tuple_get(Tuple&& t, int index, Function&& f) {
-    using LT = std::remove_cvref_t<Tuple>;
+/// Move the contents of src into dest, starting at the given position. An
+/// empty dest without room of its own takes over src's storage outright.
+template <class T>
+void move_insert(QVector<T>& dest, qsizetype at, QVector<T>&& src) {
+    if (dest.isEmpty() and dest.capacity() < src.size()) {
+        dest = std::move(src);
+        return;
+    }
+
+    auto const old_size = dest.size();
+
+    grow_for(dest, src.size());
 
-    constexpr static auto S = std::tuple_size_v<LT>;
+    for (auto& v : src) {
+        dest.append(std::move(v));
+    }
 
-    _get_by_idx<Tuple, S - 1, Function>::check(t, index, std::move(f));
+    std::rotate(dest.begin() + at, dest.begin() + old_size, dest.end());
 }
 
+/// Column names, built once per record type and shared by every model
+template <class Record>
+QStringList const& get_header() {
+    static QStringList const ret = []() {
+        QStringList build;
+        build.reserve(ColumnTable<Record>::count);
+        for (char const* name : ColumnTable<Record>::names) {
+            build << QString::fromUtf8(name);
+        }
+        return build;
+    }();
+    return ret;
+}
 
+/// Role names, built once per record type. Names point at the meta's string
+/// literals rather than copying them.
 template <class Record>
-QStringList get_header() {
-    QStringList ret;
-    tuple_for_each(Record::meta, [&ret](auto const& m) { ret << m.name; });
+QHash<int, QByteArray> const& get_name_map() {
+    static QHash<int, QByteArray> const ret = []() {
+        QHash<int, QByteArray> build;
+
+        auto const& names = ColumnTable<Record>::names;
+
+        for (int i = 0; i < ColumnTable<Record>::count; i++) {
+            build[Qt::UserRole + i] =
+                QByteArray::fromRawData(names[i], qstrlen(names[i]));
+        }
+        return build;
+    }();
+    return ret;
+}
+
+/// The record type a meta key belongs to. Keys are member pointers, for
+/// MetaMember entries, or getters, for MetaCustom entries.
+template <class Key>
+struct key_record;
+
+template <class Record, class T>
+struct key_record<T Record::*> {
+    using type = Record;
+};
+
+template <class Record, class T>
+struct key_record<T (*)(Record const&)> {
+    using type = Record;
+};
+
+/// Find the column of the meta entry for a key, or -1 if there is none
+template <class Record, class Key>
+constexpr int find_column(Key key) {
+    int ret = -1;
+    int i   = 0;
+
+    tuple_for_each(Record::meta, [&](auto const& thing) {
+        if constexpr (requires { thing.access; }) {
+            if constexpr (std::is_same_v<decltype(thing.access), Key>) {
+                if (ret < 0 and thing.access == key) ret = i;
+            }
+        } else if constexpr (requires { thing.getter; }) {
+            if constexpr (std::is_same_v<decltype(thing.getter), Key>) {
+                if (ret < 0 and thing.getter == key) ret = i;
+            }
+        }
+        i++;
+    });
+
+    return ret;
+}
+
+// Not constexpr, so reaching it during constant evaluation fails the build
+inline void meta_entry_missing() {
+    Q_ASSERT_X(false, "role_for_member", "Key is not in Record::meta");
+}
+
+/// Find the role for a member. This is a compile error on a miss when used as
+/// a constant; at runtime, a miss asserts and returns -1.
+template <class Record, class ReturnType>
+constexpr int role_for_member(ReturnType Record::*ptr) {
+    int column = find_column<Record>(ptr);
+    if (column < 0) {
+        meta_entry_missing();
+        return -1;
+    }
+    return Qt::UserRole + column;
+}
+
+/// Find the role for a custom meta entry, given its getter
+template <class Record, class ReturnType>
+constexpr int role_for_member(ReturnType (*getter)(Record const&)) {
+    int column = find_column<Record>(getter);
+    if (column < 0) {
+        meta_entry_missing();
+        return -1;
+    }
+    return Qt::UserRole + column;
+}
+
+/// The column of a meta entry, always resolved at compile time
+template <auto Key>
+consteval int column_of() {
+    using Record = typename key_record<decltype(Key)>::type;
+
+    constexpr int ret = find_column<Record>(Key);
+    static_assert(ret >= 0, "Key is not in Record::meta");
     return ret;
 }
 
-template <class Record>
-QHash<int, QByteArray> const& get_name_map() {
-    static QHash<int, QByteArray> ret = []() {
-        QHash<int, QByteArray> build;
+/// The role of a meta entry, always resolved at compile time
+template <auto Key>
+consteval int role_of() {
+    return Qt::UserRole + column_of<Key>();
+}
+
+
+template <class Record>
+QVariant record_runtime_get(Record const& r, int i) {
+    using Table = ColumnTable<Record>;
+    if (!Table::in_range(i)) return {};
+    return Table::getters[i](r);
+}
+
+template <class Record>
+bool record_runtime_set(Record& r, int i, QVariant const& v) {
+    using Table = ColumnTable<Record>;
+    if (!Table::in_range(i)) return false;
+    return Table::setters[i](r, v);
+}
+
+template <class Record>
+bool record_runtime_equals(Record const& r, int i, QVariant const& v) {
+    using Table = ColumnTable<Record>;
+    if (!Table::in_range(i)) return false;
+    return Table::equals[i](r, v);
+}
+
+} // namespace struct_model_detail
+
+template <class H, class T>
+struct MetaMember {
+    T H::*      access;
+    char const* name;
+    bool        editable;
+
+    constexpr MetaMember(T H::*      _access,
+                         char const* _name,
+                         bool        _editable = false)
+        : access(_access), name(_name), editable(_editable) { }
+
+    inline T const& get(H const& h) const { return h.*this->access; }
+    inline void     set(H& h, T const& t) const { h.*this->access = t; }
+};
+
+template <class H, class T>
+struct MetaCustom {
+    using Getter = T (*)(H const&);
+    using Setter = void (*)(H&, T&&);
+    Getter      getter;
+    Setter      setter;
+    char const* name;
+    bool        editable;
+
+    constexpr MetaCustom(Getter      _getter,
+                         Setter      _setter,
+                         char const* _name,
+                         bool        _editable = false)
+        : getter(_getter), setter(_setter), name(_name), editable(_editable) { }
+
+    inline T    get(H const& h) const { return std::invoke(getter, h); }
+    inline void set(H& h, T&& t) const { std::invoke(setter, h, std::move(t)); }
+};
+
+#define SM_MAKE_META(...)                                                      \
+    static constexpr inline auto meta = std::tuple(__VA_ARGS__)
+
+#define SM_META(TYPE, NAME) MetaMember(&TYPE ::NAME, #NAME, true)
+
+class StructTableModelBase : public QAbstractTableModel {
+    Q_OBJECT
+
+    struct PendingChange {
+        int row;
+        int column; // -1 for the whole row
+        int role;   // -1 for all roles
+    };
+
+    int                        m_batch_depth = 0;
+    std::vector<PendingChange> m_pending_changes;
+
+    std::vector<StructAggregate*> m_named_aggregates;
+
+    void flush_changes();
+
+protected:
+    bool in_batch() const { return m_batch_depth > 0; }
+
+    /// Report a changed cell. Outside of a batch, this is emitted right away.
+    /// Use -1 for the column to mark the whole row, and -1 for the role to mark
+    /// all roles.
+    void note_changed(int row, int column, int role);
+
+    /// Adjust pending changes for rows inserted at row
+    void shift_pending(int row, int count);
+
+    /// Adjust pending changes for rows removed starting at row
+    void drop_pending(int row, int count);
+
+    /// Adjust pending changes for a row moved from one position to another
+    void move_pending(int from, int to);
+
+    /// Adjust pending changes for a reordering, given the new row of each old
+    /// row
+    void permute_pending(QVector<int> const& new_row);
+
+    /// Forget all pending changes, used when the model is reset
+    void clear_pending();
+
+    /// Emit any row insertions or removals that have been held back
+    virtual void flush_structure() { }
+
+    /// Called once the outermost batch has sent its notifications
+    virtual void batch_finished() { }
+
+    /// Make an aggregate reachable by its column name
+    void register_aggregate(StructAggregate* a) {
+        m_named_aggregates.push_back(a);
+    }
+
+public:
+    using QAbstractTableModel::QAbstractTableModel;
+    virtual ~StructTableModelBase();
+
+    ///
+    /// \brief The Batch class holds a batch open for its lifetime
+    ///
+    class [[nodiscard]] Batch {
+        StructTableModelBase* m_model;
+
+    public:
+        explicit Batch(StructTableModelBase* m) : m_model(m) {
+            m_model->begin_batch();
+        }
+        ~Batch() { m_model->end_batch(); }
+
+        Batch(Batch const&)            = delete;
+        Batch& operator=(Batch const&) = delete;
+    };
+
+    /// A column to sort by, and the direction
+    struct SortKey {
+        int           column;
+        Qt::SortOrder order = Qt::AscendingOrder;
+    };
+
+    /// Start collecting changes instead of emitting them. Batches can nest;
+    /// notifications are sent when the outermost batch ends.
+    ///
+    /// Data changes are merged into as few contiguous dataChanged ranges as
+    /// possible. Neighbouring row inserts or removes are folded into a single
+    /// begin/end pair. Folded rows are held back until the next mutation that
+    /// cannot join them, so the record accessors may lag behind until then.
+    void begin_batch();
+
+    /// Finish a batch, emitting the coalesced notifications
+    void end_batch();
+
+    /// Open a batch for the lifetime of the returned object
+    Batch batch() { return Batch(this); }
+
+    /// Look up the aggregate on a column, by column name
+    ///
+    /// \returns The aggregate, or null if that column has none
+    Q_INVOKABLE StructAggregate* aggregate(QString const& column) const;
+
+    /// The undo history, or null if it has not been enabled
+    Q_INVOKABLE virtual StructJournal* journal() const { return nullptr; }
+};
+
+template <class Record>
+class StructTableModel : public StructTableModelBase {
+    using Table = struct_model_detail::ColumnTable<Record>;
+
+    QVector<Record> m_records;
+
+    // Row changes held back during a batch. Only one of these is open at a
+    // time; rows are in terms of what the caller sees, with the open change
+    // applied.
+    struct PendingInsert {
+        int             row = -1;
+        QVector<Record> records;
+    };
+
+    struct PendingRemove {
+        int row   = -1;
+        int count = 0;
+    };
+
+    PendingInsert m_pending_insert;
+    PendingRemove m_pending_remove;
+
+    using IndexPtr = std::unique_ptr<struct_model_detail::RecordIndex<Record>>;
+
+    std::vector<IndexPtr> m_indexes;
+
+    void invalidate_indexes() {
+        for (auto& i : m_indexes) {
+            i->invalidate();
+        }
+    }
+
+    /// Take a row out of the indexes before it changes. A column limits this
+    /// to indexes on that column.
+    void unlink_indexes(int row, int column = -1) {
+        for (auto& i : m_indexes) {
+            if (column < 0 or i->covers(column)) i->unlink(row, m_records[row]);
+        }
+    }
+
+    /// Put a row back into the indexes after it changed
+    void link_indexes(int row, int column = -1) {
+        for (auto& i : m_indexes) {
+            if (column < 0 or i->covers(column)) i->link(row, m_records[row]);
+        }
+    }
+
+    using Aggregate = struct_model_detail::RecordAggregate<Record>;
+
+    // owned through the QObject tree, so QML can hold on to them
+    std::vector<Aggregate*> m_aggregates;
+
+    /// Count rows into the aggregates. A column limits this to aggregates on
+    /// that column.
+    void add_to_aggregates(int first, int count, int column = -1) {
+        for (auto* a : m_aggregates) {
+            if (column >= 0 and !a->covers(column)) continue;
+            for (int i = first; i < first + count; i++) {
+                a->add(m_records[i]);
+            }
+        }
+    }
+
+    /// Take rows out of the aggregates, before they leave or change
+    void take_from_aggregates(int first, int count, int column = -1) {
+        for (auto* a : m_aggregates) {
+            if (column >= 0 and !a->covers(column)) continue;
+            for (int i = first; i < first + count; i++) {
+                a->take(m_records[i]);
+            }
+        }
+    }
+
+    using Journal = struct_model_detail::RecordJournal<Record>;
+
+    friend Journal;
+
+    // owned through the QObject tree, like the aggregates
+    Journal* m_journal = nullptr;
+
+    /// The journal, if changes should be recorded right now
+    Journal* journaling() const {
+        return m_journal and m_journal->recording() ? m_journal : nullptr;
+    }
+
+    /// Wrap up a change: report totals and close the undo step, unless a batch
+    /// is still open
+    void finish_change() {
+        if (in_batch()) return;
+
+        for (auto* a : m_aggregates) {
+            a->notify();
+        }
+
+        if (m_journal) m_journal->seal();
+    }
+
+    void batch_finished() override { finish_change(); }
+
+    /// A row as the caller sees it, looking through held back changes. The
+    /// held back insert goes in before the held back removal is taken out.
+    Record const& logical_record(int row) const {
+        auto const& removal = m_pending_remove;
+        if (removal.count > 0 and row >= removal.row) row += removal.count;
+
+        auto const& insert = m_pending_insert;
+        if (!insert.records.isEmpty() and row >= insert.row) {
+            int const at = row - insert.row;
+            if (at < insert.records.size()) return insert.records[at];
+            row -= insert.records.size();
+        }
+
+        return m_records[row];
+    }
+
+    /// Copies of rows as the caller sees them. Held back changes stay held
+    /// back, so recording a removal does not break up a batch.
+    QVector<Record> copy_rows(int row, int count) {
+        count = std::min<int>(count, logical_size() - row);
+
+        QVector<Record> ret;
+        ret.reserve(std::max(count, 0));
+        for (int i = row; i < row + count; i++) {
+            ret << logical_record(i);
+        }
+        return ret;
+    }
+
+    /// Write a recorded member value into a row
+    void apply_member(int                                           row,
+                      int                                           column,
+                      struct_model_detail::MemberValue<Record> const& value) {
+        flush_structure();
+
+        unlink_indexes(row, column);
+        take_from_aggregates(row, 1, column);
+
+        value.apply(m_records[row]);
+
+        link_indexes(row, column);
+        add_to_aggregates(row, 1, column);
+
+        note_changed(row, column, -1);
+        finish_change();
+    }
+
+    /// Reset to the given records, handing back the ones they replace
+    QVector<Record> swap_records(QVector<Record> records) {
+        m_pending_insert = {};
+        m_pending_remove = {};
+        clear_pending();
+
+        beginResetModel();
+        std::swap(m_records, records);
+        invalidate_indexes();
+        endResetModel();
+
+        for (auto* a : m_aggregates) {
+            a->rebuild();
+        }
+
+        finish_change();
+
+        return records;
+    }
+
+    template <template <class, class> class Index, class Key>
+    Index<Record, Key>* find_index(Key Record::*member) const {
+        for (auto const& i : m_indexes) {
+            auto* typed = dynamic_cast<Index<Record, Key>*>(i.get());
+            if (typed and typed->member() == member) return typed;
+        }
+        return nullptr;
+    }
+
+    // Records that have been removed, but not yet compacted away, during a
+    // bulk removal. Row lookups skip over this region.
+    struct Gap {
+        int start = 0;
+        int size  = 0;
+    };
+
+    Gap m_gap;
+
+    int physical_row(int row) const {
+        return row < m_gap.start ? row : row + m_gap.size;
+    }
+
+    /// Number of rows as seen by the caller, including held back changes
+    int logical_size() const {
+        return rowCount() + m_pending_insert.records.size() -
+               m_pending_remove.count;
+    }
+
+    /// Remove sorted, non-overlapping runs of rows, emitting one notification
+    /// per run. Each kept record is moved at most once.
+    void remove_runs(QVector<struct_model_detail::RowRun> const& runs) {
+        if (runs.isEmpty()) return;
+
+        flush_structure();
+        invalidate_indexes();
+
+        for (auto const& run : runs) {
+            take_from_aggregates(run.start, run.count);
+        }
+
+        if (auto* j = journaling()) {
+            // as removals one after another, each seeing the ones before
+            int removed = 0;
+            for (auto const& run : runs) {
+                j->record_remove(run.start - removed,
+                                 copy_rows(run.start, run.count));
+                removed += run.count;
+            }
+        }
+
+        int const total = m_records.size();
+
+        int write = 0;
+        int read  = 0;
+
+        for (auto const& run : runs) {
+            Q_ASSERT(run.start >= read);
+
+            // slide the kept rows down against the rows already kept. This
+            // does not change what the model reports. Before the first
+            // removal they are already in place, and moving a record onto
+            // itself may empty it
+            if (write != read) {
+                std::move(m_records.begin() + read,
+                          m_records.begin() + run.start,
+                          m_records.begin() + write);
+            }
+            write += run.start - read;
+            read = run.start;
+
+            m_gap = { write, read - write };
+
+            beginRemoveRows({}, write, write + run.count - 1);
+            read += run.count;
+            m_gap = { write, read - write };
+            endRemoveRows();
+
+            drop_pending(write, run.count);
+        }
+
+        std::move(m_records.begin() + read,
+                  m_records.end(),
+                  m_records.begin() + write);
+        write += total - read;
+
+        m_gap = {};
+        m_records.erase(m_records.begin() + write, m_records.end());
+
+        // in case a lookup was made in the middle
+        invalidate_indexes();
+
+        finish_change();
+    }
+
+    /// Insert runs of rows, emitting one notification per run. Runs are given
+    /// by their final positions, in order, and take their records from
+    /// incoming in sequence. Each existing record is moved at most twice.
+    void insert_runs(QVector<struct_model_detail::RowRun> const& runs,
+                     QVector<Record>&&                           incoming) {
+        if (runs.isEmpty()) return;
+
+        flush_structure();
+        invalidate_indexes();
+
+        if (auto* j = journaling()) {
+            for (auto const& run : runs) {
+                j->record_insert(run.start, run.count);
+            }
+        }
+
+        int const kept  = m_records.size();
+        int const added = incoming.size();
+
+        // push the existing rows to the back, and hide the space in front
+        m_records.resize(kept + added);
+        std::move_backward(m_records.begin(),
+                           m_records.begin() + kept,
+                           m_records.end());
+
+        int write  = 0;
+        int read   = added;
+        int source = 0;
+
+        m_gap = { write, read - write };
+
+        for (auto const& run : runs) {
+            Q_ASSERT(run.start >= write);
+
+            std::move(m_records.begin() + read,
+                      m_records.begin() + read + (run.start - write),
+                      m_records.begin() + write);
+            read += run.start - write;
+            write = run.start;
+
+            m_gap = { write, read - write };
+
+            std::move(incoming.begin() + source,
+                      incoming.begin() + source + run.count,
+                      m_records.begin() + write);
+            source += run.count;
+
+            beginInsertRows({}, write, write + run.count - 1);
+            write += run.count;
+            m_gap = { write, read - write };
+            endInsertRows();
+
+            shift_pending(run.start, run.count);
+        }
+
+        Q_ASSERT(write == read);
+
+        m_gap = {};
+
+        invalidate_indexes();
+
+        for (auto const& run : runs) {
+            add_to_aggregates(run.start, run.count);
+        }
+
+        finish_change();
+    }
+
+    /// Move single rows so that the given keys become ascending. Rows flagged
+    /// in place are left where they are.
+    void move_rows_into_place(QVector<int>& keys, QVector<bool>& in_place) {
+        auto rotate_all = [&](int first, int middle, int last) {
+            std::rotate(m_records.begin() + first,
+                        m_records.begin() + middle,
+                        m_records.begin() + last);
+            std::rotate(keys.begin() + first,
+                        keys.begin() + middle,
+                        keys.begin() + last);
+            std::rotate(in_place.begin() + first,
+                        in_place.begin() + middle,
+                        in_place.begin() + last);
+        };
+
+        while (true) {
+            // take the smallest key still out of place
+            int src = -1;
+            for (int i = 0; i < keys.size(); i++) {
+                if (in_place[i]) continue;
+                if (src < 0 or keys[i] < keys[src]) src = i;
+            }
+
+            if (src < 0) break;
+
+            // and put it in front of the first placed row that is larger
+            int dest = keys.size();
+            for (int i = 0; i < keys.size(); i++) {
+                if (in_place[i] and keys[i] > keys[src]) {
+                    dest = i;
+                    break;
+                }
+            }
+
+            in_place[src] = true;
+
+            if (dest == src or dest == src + 1) continue;
+
+            invalidate_indexes();
+
+            beginMoveRows({}, src, src, {}, dest);
+            if (dest > src) {
+                rotate_all(src, src + 1, dest);
+                move_pending(src, dest - 1);
+            } else {
+                rotate_all(dest, src, src + 1);
+                move_pending(src, dest);
+            }
+            endMoveRows();
+        }
+    }
+
+    /// Rearrange all rows as a single layout change, carrying persistent
+    /// indexes along. Row i takes the record that was at order[i].
+    void layout_rows(QVector<int> const& order) {
+        int const count = order.size();
+
+        QVector<int> new_row(count);
+        for (int i = 0; i < count; i++) {
+            new_row[order[i]] = i;
+        }
+
+        emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+        QVector<Record> sorted;
+        sorted.reserve(count);
+        for (int old : order) {
+            sorted << std::move(m_records[old]);
+        }
+        m_records = std::move(sorted);
+
+        invalidate_indexes();
+
+        auto            from = persistentIndexList();
+        QModelIndexList to;
+        to.reserve(from.size());
+        for (auto const& idx : from) {
+            to << index(new_row[idx.row()], idx.column());
+        }
+        changePersistentIndexList(from, to);
+
+        permute_pending(new_row);
+
+        emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+    }
+
+    /// Put rows into the order a sort produced, unless they already are
+    void apply_sort(QVector<int> const& order) {
+        if (std::is_sorted(order.begin(), order.end())) return;
+
+        layout_rows(order);
+
+        if (auto* j = journaling()) j->record_permute(order);
+
+        finish_change();
+    }
+
+    /// Sort rows by the given keys as a single layout change
+    void layout_rows_into_place(QVector<int>& keys) {
+        QVector<int> order(keys.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) {
+            return keys[a] < keys[b];
+        });
+
+        layout_rows(order);
+
+        std::sort(keys.begin(), keys.end());
+    }
+
+    /// Reorder rows so that the given keys are ascending. A few out of place
+    /// rows are moved individually; anything more becomes one layout change.
+    void reorder_rows(QVector<int>& keys) {
+        static constexpr int max_row_moves = 32;
+
+        auto in_place = struct_model_detail::longest_increasing(keys);
+
+        auto to_move = std::count(in_place.begin(), in_place.end(), false);
+
+        if (to_move == 0) return;
+
+        if (to_move <= max_row_moves) {
+            move_rows_into_place(keys, in_place);
+        } else {
+            layout_rows_into_place(keys);
+        }
+    }
+
+    void commit_insert(int row, QVector<Record>&& records) {
+        int const old_size = m_records.size();
+
+        int const count = records.size();
+
+        beginInsertRows({}, row, row + count - 1);
+        struct_model_detail::move_insert(m_records, row, std::move(records));
+
+        add_to_aggregates(row, count);
+
+        // appends leave existing rows alone, so indexes can keep up
+        if (row == old_size) {
+            for (int i = row; i < m_records.size(); i++) {
+                link_indexes(i);
+            }
+        } else {
+            invalidate_indexes();
+        }
+
+        endInsertRows();
+
+        finish_change();
+    }
+
+    void commit_insert_one(int row, Record&& record) {
+        beginInsertRows({}, row, row);
+        struct_model_detail::grow_for(m_records, 1);
+        m_records.insert(row, std::move(record));
+
+        add_to_aggregates(row, 1);
+
+        if (row == m_records.size() - 1) {
+            link_indexes(row);
+        } else {
+            invalidate_indexes();
+        }
+
+        endInsertRows();
+
+        finish_change();
+    }
 
-        int i = 0;
+    void commit_remove(int row, int count) {
+        take_from_aggregates(row, count);
 
-        tuple_for_each(Record::meta, [&build, &i](auto const& thing) {
-            build[Qt::UserRole + i] = thing.name;
-            i++;
-        });
-        return build;
-    }();
-    return ret;
-}
+        beginRemoveRows({}, row, row + count - 1);
+        m_records.remove(row, count);
+        invalidate_indexes();
+        endRemoveRows();
 
-template <class Record, class ReturnType>
-constexpr int role_for_member(ReturnType Record::*ptr) {
-    // Need to find a nice way to have a compile error on missing meta
-    // this also does not work with custom meta
-    int ret       = -1;
-    using PtrType = decltype(ptr);
-    int i         = 0;
-    tuple_for_each(Record::meta, [&i, &ret, ptr](auto const& thing) {
-        using LT = decltype(thing.access);
+        finish_change();
+    }
 
-        if constexpr (std::is_same_v<LT, PtrType>) {
-            if (thing.access == ptr) ret = Qt::UserRole + i;
+    void flush_structure() override {
+        if (!m_pending_insert.records.isEmpty()) {
+            auto pending = std::exchange(m_pending_insert, {});
+            shift_pending(pending.row, pending.records.size());
+            commit_insert(pending.row, std::move(pending.records));
         }
-        i++;
-    });
 
-    Q_ASSERT(ret >= 0);
-
-    return ret;
-}
+        if (m_pending_remove.count > 0) {
+            auto pending = std::exchange(m_pending_remove, {});
+            drop_pending(pending.row, pending.count);
+            commit_remove(pending.row, pending.count);
+        }
+    }
 
+    void do_insert(int row, QVector<Record>&& records) {
+        if (records.isEmpty()) return;
 
-template <class T>
-constexpr bool is_qobject = std::is_base_of_v<QObject, std::remove_cvref_t<T>>;
+        if (auto* j = journaling()) j->record_insert(row, records.size());
 
-template <class T>
-struct is_shared_qobject {
-    static constexpr bool value = false;
-};
+        if (!in_batch()) {
+            commit_insert(row, std::move(records));
+            return;
+        }
 
-template <class T>
-struct is_shared_qobject<std::shared_ptr<T>> {
-    static constexpr bool value = is_qobject<T>;
-};
+        auto& pending = m_pending_insert;
 
-template <class Record>
-QVariant record_runtime_get(Record const& r, int i) {
-    QVariant ret;
-    tuple_get(Record::meta, i, [&r, &ret](auto const& a) {
-        using DCL = std::remove_cvref_t<decltype(a.get(r))>;
-        if constexpr (is_shared_qobject<DCL>::value) {
-            ret = QVariant::fromValue((a.get(r)).get());
-        } else {
-            ret = QVariant::fromValue(a.get(r));
+        // extend an open insert if the new rows land inside or next to it
+        if (!pending.records.isEmpty() and row >= pending.row and
+            row <= pending.row + pending.records.size()) {
+            struct_model_detail::move_insert(
+                pending.records, row - pending.row, std::move(records));
+            return;
         }
-    });
-    return ret;
-}
 
-template <class Record>
-bool record_runtime_set(Record& r, int i, QVariant const& v) {
-    bool ret = false;
-
-    tuple_get(Record::meta, i, [&v, &ret, &r](auto& _value) {
-        using DCL = std::remove_cvref_t<decltype(_value.get(r))>;
-        if constexpr (is_shared_qobject<DCL>::value) {
-            // editing a shared ptr is not supported at this time
-            qWarning() << "Attempting to write to a shared pointer qobject";
-            ret = false;
-        } else {
-            if (_value.editable) {
-                ret = true;
+        flush_structure();
 
-                using LT = std::remove_cvref_t<decltype(_value.get(r))>;
-                _value.set(r, v.value<LT>());
-            }
-        }
-    });
+        pending.row     = row;
+        pending.records = std::move(records);
+    }
 
-    return ret;
-}
+    /// As do_insert, but for a single record, without building a vector for it
+    void do_insert_one(int row, Record&& record) {
+        if (auto* j = journaling()) j->record_insert(row, 1);
 
-} // namespace struct_model_detail
+        if (!in_batch()) {
+            commit_insert_one(row, std::move(record));
+            return;
+        }
 
-template <class H, class T>
-struct MetaMember {
-    T H::*      access;
-    char const* name;
-    bool        editable;
+        auto& pending = m_pending_insert;
 
-    constexpr MetaMember(T H::*      _access,
-                         char const* _name,
-                         bool        _editable = false)
-        : access(_access), name(_name), editable(_editable) { }
+        if (!pending.records.isEmpty() and row >= pending.row and
+            row <= pending.row + pending.records.size()) {
+            struct_model_detail::grow_for(pending.records, 1);
+            pending.records.insert(row - pending.row, std::move(record));
+            return;
+        }
 
-    inline T const& get(H const& h) const { return h.*this->access; }
-    inline void     set(H& h, T const& t) const { h.*this->access = t; }
-};
+        flush_structure();
 
-template <class H, class T>
-struct MetaCustom {
-    using Getter = T (*)(H const&);
-    using Setter = void (*)(H&, T&&);
-    Getter      getter;
-    Setter      setter;
-    char const* name;
-    bool        editable;
+        pending.row = row;
+        pending.records.append(std::move(record));
+    }
 
-    constexpr MetaCustom(Getter      _getter,
-                         Setter      _setter,
-                         char const* _name,
-                         bool        _editable = false)
-        : getter(_getter), setter(_setter), name(_name), editable(_editable) { }
+    void do_remove(int row, int count) {
+        if (count <= 0) return;
 
-    inline T    get(H const& h) const { return std::invoke(getter, h); }
-    inline void set(H& h, T&& t) const { std::invoke(setter, h, std::move(t)); }
-};
+        if (auto* j = journaling()) {
+            j->record_remove(row, copy_rows(row, count));
+        }
 
-#define SM_MAKE_META(...)                                                      \
-    static constexpr inline auto meta = std::tuple(__VA_ARGS__)
+        if (!in_batch()) {
+            commit_remove(row, count);
+            return;
+        }
 
-#define SM_META(TYPE, NAME) MetaMember(&TYPE ::NAME, #NAME, true)
+        auto& pending = m_pending_remove;
 
-class StructTableModelBase : public QAbstractTableModel {
-    Q_OBJECT
-public:
-    using QAbstractTableModel::QAbstractTableModel;
+        if (pending.count > 0) {
+            // the caller does not see the held back rows; removing at the same
+            // spot takes the rows after them, and removing just before takes
+            // the rows in front
+            if (row == pending.row) {
+                pending.count += count;
+                return;
+            }
 
-    // we used this for some virtual stuff. can still do so in future.
-};
+            if (row + count == pending.row) {
+                pending.row = row;
+                pending.count += count;
+                return;
+            }
+        }
 
-template <class Record>
-class StructTableModel : public StructTableModelBase {
-    QVector<Record> m_records;
+        flush_structure();
 
-    QStringList const m_header;
+        pending.row   = row;
+        pending.count = count;
+    }
 
 public:
     explicit StructTableModel(QObject* parent = nullptr)
-        : StructTableModelBase(parent),
-          m_header(struct_model_detail::get_header<Record>()) { }
+        : StructTableModelBase(parent) { }
 
     // Header:
     QVariant headerData(int             section,
@@ -204,17 +1275,17 @@ public:
         if (orientation != Qt::Orientation::Horizontal) return {};
         if (role != Qt::DisplayRole) return {};
 
-        return m_header.value(section);
+        return struct_model_detail::get_header<Record>().value(section);
     }
 
     int rowCount(QModelIndex const& parent = QModelIndex()) const override {
         if (parent.isValid()) return 0;
-        return m_records.size();
+        return m_records.size() - m_gap.size;
     }
 
     int columnCount(QModelIndex const& parent = QModelIndex()) const override {
         if (parent.isValid()) return 0;
-        return m_header.size();
+        return Table::count;
     }
 
     QVariant data(QModelIndex const& index,
@@ -223,23 +1294,21 @@ public:
         // qDebug() << Q_FUNC_INFO << index << role;
 
         if (!index.isValid()) return {};
-        if (index.row() >= m_records.size()) return {};
+        if (index.row() >= rowCount()) return {};
 
-        auto const& item = m_records[index.row()];
+        auto const& item = m_records[physical_row(index.row())];
 
         if (role == Qt::DisplayRole or role == Qt::EditRole) {
-            return struct_model_detail::record_runtime_get(item,
-                                                           index.column());
+            if (!Table::in_range(index.column())) return {};
+            return Table::getters[index.column()](item);
         }
 
         if (role >= Qt::UserRole) {
             auto local_role = role - Qt::UserRole;
 
-            assert(local_role >= 0);
+            if (!Table::in_range(local_role)) return {};
 
-            if (local_role >= m_header.size()) return {};
-
-            return struct_model_detail::record_runtime_get(item, local_role);
+            return Table::getters[local_role](item);
         }
 
         return {};
@@ -252,9 +1321,12 @@ public:
 
         // qDebug() << Q_FUNC_INFO << index << value << role;
 
-        if (data(index, role) == value) return false;
+        flush_structure();
+
+        if (!index.isValid()) return false;
+        if (index.row() >= rowCount()) return false;
 
-        auto& item = m_records[index.row()];
+        auto& item = m_records[physical_row(index.row())];
 
         int location = -1;
 
@@ -264,153 +1336,571 @@ public:
             location = index.column();
         }
 
-        if (location >= m_header.size()) return false;
+        if (!Table::in_range(location)) return false;
+
+        if (Table::equals[location](item, value)) return false;
+
+        int const row = physical_row(index.row());
 
-        bool ok =
-            struct_model_detail::record_runtime_set(item, location, value);
+        auto before = m_journal ? m_journal->capture(location, item) : nullptr;
+
+        unlink_indexes(row, location);
+        take_from_aggregates(row, 1, location);
+
+        bool ok = Table::setters[location](item, value);
+
+        link_indexes(row, location);
+        add_to_aggregates(row, 1, location);
 
         if (!ok) return false;
 
-        emit dataChanged(index, index, QList<int>() << role);
+        if (auto* j = journaling()) {
+            j->record_edit(row, location, std::move(before), item);
+        }
+
+        note_changed(index.row(), index.column(), role);
+        finish_change();
         return true;
     }
 
     Qt::ItemFlags flags(QModelIndex const& index) const override {
         if (!index.isValid()) return Qt::NoItemFlags;
 
-        bool can_edit = false;
-
-        struct_model_detail::tuple_get(
-            Record::meta, index.column(), [&can_edit](auto const& v) {
-                can_edit = v.editable;
-            });
+        if (!Table::in_range(index.column())) return Qt::NoItemFlags;
 
-        if (!can_edit) return Qt::ItemIsEnabled;
+        if (!Table::editable[index.column()]) return Qt::ItemIsEnabled;
 
         return Qt::ItemIsEditable | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
     }
 
     QHash<int, QByteArray> roleNames() const override {
-        static const auto roles = struct_model_detail::get_name_map<Record>();
-
-        return roles;
+        return struct_model_detail::get_name_map<Record>();
     }
 
     bool insertRows(int                row,
                     int                count,
                     QModelIndex const& p = QModelIndex()) override {
+        if (p.isValid()) return false;
         if (row < 0 or count <= 0) return false;
 
-        beginInsertRows(p, row, row + count - 1);
-        m_records.insert(row, count, Record {});
-        endInsertRows();
+        do_insert(row, QVector<Record>(count));
         return true;
     }
 
     bool removeRows(int                row,
                     int                count,
                     QModelIndex const& p = QModelIndex()) override {
+        if (p.isValid()) return false;
         if (row < 0 or count <= 0) return false;
-        if (count > m_records.size()) return false;
+        if (count > logical_size()) return false;
 
-        beginRemoveRows(p, row, row + count - 1);
-        m_records.remove(row, count);
-        endRemoveRows();
+        do_remove(row, count);
         return true;
     }
 
     void reset(QList<Record> new_records = {}) {
         // qDebug() << Q_FUNC_INFO;
-        beginResetModel();
-        m_records = new_records;
-        endResetModel();
+
+        auto* j = journaling();
+
+        // the journal has already recorded anything held back, so it has to
+        // land before the reset can be undone to it
+        if (j) flush_structure();
+
+        auto old = swap_records(std::move(new_records));
+
+        if (j) {
+            j->record_reset(std::move(old));
+            finish_change();
+        }
     }
 
     // this emits a remove signal, instead of a reset
     void remove_all() {
         // qDebug() << Q_FUNC_INFO;
-        if (m_records.isEmpty()) return;
-        beginRemoveRows(QModelIndex(), 0, std::max(rowCount() - 1, 0));
-        m_records.clear();
-        endRemoveRows();
+        int count = logical_size();
+        if (count <= 0) return;
+        do_remove(0, count);
     }
 
     Record const* get_at(int i) const {
         if (i < 0) return nullptr;
-        if (i >= m_records.size()) return nullptr;
-        return &m_records[i];
+        if (i >= rowCount()) return nullptr;
+        return &m_records[physical_row(i)];
     }
 
-    auto append(Record const& r) {
-        int rc = rowCount();
-        beginInsertRows({}, rc, rc);
-        m_records << r;
-        endInsertRows();
+    /// Make room for at least count rows, so that appending up to that many
+    /// does not reallocate
+    void reserve(int count) { m_records.reserve(count); }
+
+    auto append(Record const& r) { do_insert_one(logical_size(), Record(r)); }
+
+    auto append(Record&& r) { do_insert_one(logical_size(), std::move(r)); }
+
+    /// Construct a record in place at the end of the model
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        do_insert_one(logical_size(), Record(std::forward<Args>(args)...));
     }
 
+    /// Append records. Pass an rvalue to hand over the records without copying
+    /// them; an empty model takes over the vector's storage.
     auto append(QVector<Record> r) {
         if (r.isEmpty()) return;
-        int rc = rowCount();
-        beginInsertRows({}, rc, rc + r.size() - 1);
-        m_records << r;
-        endInsertRows();
+        do_insert(logical_size(), std::move(r));
+    }
+
+    /// Move records out of a span onto the end of the model. The span is left
+    /// with moved-from records.
+    void append_moved(std::span<Record> records) {
+        insert_moved_at(logical_size(), records);
     }
 
     auto replace(QVector<Record> r = {}) {
         remove_all();
-        append(r);
+        append(std::move(r));
+    }
+
+    /// Replace the contents of the model, matching old and new records by a
+    /// key member. Only the differences are reported: rows that are gone are
+    /// removed, new rows are inserted, reordered rows are moved, and members
+    /// that changed get a dataChanged. Surviving rows take the new record
+    /// whole, as with update(). Views keep their state for rows that survive.
+    ///
+    /// The key type needs a qHash overload. If a key appears more than once,
+    /// only the first record with that key is matched.
+    ///
+    /// This cannot be undone; it clears the journal.
+    template <class Key>
+    void replace_by_key(Key Record::*key, QVector<Record> r) {
+        flush_structure();
+
+        if (m_journal) {
+            m_journal->clear();
+            m_journal->set_paused(true);
+        }
+
+        int const old_count = m_records.size();
+        int const new_count = r.size();
+
+        QHash<Key, int> new_rows;
+        new_rows.reserve(new_count);
+
+        for (int i = 0; i < new_count; i++) {
+            auto const& k = r[i].*key;
+            if (!new_rows.contains(k)) new_rows.insert(k, i);
+        }
+
+        // match old rows against the new set
+        QVector<int>  targets; // new row for each surviving old row
+        QVector<bool> matched(new_count, false);
+        QVector<int>  removed;
+
+        targets.reserve(std::min(old_count, new_count));
+
+        for (int i = 0; i < old_count; i++) {
+            auto iter = new_rows.find(m_records[i].*key);
+
+            if (iter == new_rows.end() or matched[iter.value()]) {
+                removed << i;
+                continue;
+            }
+
+            matched[iter.value()] = true;
+            targets << iter.value();
+        }
+
+        remove_runs(struct_model_detail::rows_to_runs(removed));
+
+        reorder_rows(targets);
+
+        // everything not matched is new. Only matched rows are read from r
+        // after this, so the new ones can be moved out.
+        QVector<int>    added_rows;
+        QVector<Record> added;
+
+        added.reserve(new_count - targets.size());
+
+        for (int i = 0; i < new_count; i++) {
+            if (matched[i]) continue;
+            added_rows << i;
+            added << std::move(r[i]);
+        }
+
+        insert_runs(struct_model_detail::rows_to_runs(added_rows),
+                    std::move(added));
+
+        // rows now line up; report members that differ
+        begin_batch();
+
+        for (int i = 0; i < new_count; i++) {
+            if (!matched[i]) continue;
+
+            auto& current = m_records[i];
+            bool  changed = false;
+
+            for (int c = 0; c < Table::count; c++) {
+                if (Table::same[c](current, r[i])) continue;
+
+                note_changed(i, c, Qt::DisplayRole);
+                note_changed(i, c, Qt::EditRole);
+                note_changed(i, c, Qt::UserRole + c);
+                changed = true;
+            }
+
+            // members outside the meta may still differ, so the new record
+            // is always taken; indexes and totals only see the meta
+            if (!changed) {
+                current = std::move(r[i]);
+                continue;
+            }
+
+            unlink_indexes(i);
+            take_from_aggregates(i, 1);
+            current = std::move(r[i]);
+            link_indexes(i);
+            add_to_aggregates(i, 1);
+        }
+
+        end_batch();
+
+        if (m_journal) m_journal->set_paused(false);
     }
 
-    auto update(int i, Record const& r) {
+    auto update(int i, Record r) {
         // qDebug() << Q_FUNC_INFO;
 
+        flush_structure();
+
         if (i < 0) return;
         if (i >= m_records.size()) return;
 
-        m_records[i] = r;
+        if (auto* j = journaling()) {
+            j->record_update(i, m_records[i], r, Table::same);
+        }
+
+        unlink_indexes(i);
+        take_from_aggregates(i, 1);
+        m_records[i] = std::move(r);
+        link_indexes(i);
+        add_to_aggregates(i, 1);
+
+        note_changed(i, -1, -1);
+        finish_change();
+    }
+
+    /// Edit a record through a function taking a Record&. Like update(), but
+    /// without fetching the record first; rows held back by a batch are in
+    /// place before the function runs.
+    template <class Function>
+    void modify(int i, Function&& f) {
+        flush_structure();
+
+        if (i < 0) return;
+        if (i >= m_records.size()) return;
+
+        Record r = m_records[i];
+        f(r);
+        update(i, std::move(r));
+    }
+
+    /// Sort the rows in place by a column, as a single layout change. Members
+    /// are compared as their own types, and large models are sorted in
+    /// parallel. Ties keep their current order, and persistent indexes follow
+    /// their rows, so selections survive.
+    ///
+    /// A sort can be undone like any other change.
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override {
+        if (!Table::in_range(column)) return;
+
+        flush_structure();
+
+        QVector<int> rows(m_records.size());
+        std::iota(rows.begin(), rows.end(), 0);
+
+        struct_model_detail::SortTable<Record>::sorts[column](
+            m_records, rows, order == Qt::DescendingOrder);
+
+        apply_sort(rows);
+    }
+
+    /// Sort the rows by several columns: by the first key, then rows that tie
+    /// on it by the next, and so on. Otherwise as sort().
+    void sort(QVector<SortKey> const& keys) {
+        if (keys.isEmpty()) return;
+
+        for (auto const& k : keys) {
+            if (!Table::in_range(k.column)) return;
+        }
+
+        if (keys.size() == 1) return sort(keys[0].column, keys[0].order);
+
+        flush_structure();
+
+        QVector<int> rows(m_records.size());
+        std::iota(rows.begin(), rows.end(), 0);
+
+        struct_model_detail::parallel_sort(
+            rows.begin(), rows.end(), [this, &keys](int a, int b) {
+                auto const& ra = m_records[a];
+                auto const& rb = m_records[b];
 
-        auto left  = index(i, 0);
-        auto right = index(i, columnCount() - 1);
+                for (auto const& k : keys) {
+                    auto const less = Table::less[k.column];
+                    bool const asc  = k.order == Qt::AscendingOrder;
 
-        emit dataChanged(left, right);
+                    if (less(ra, rb)) return asc;
+                    if (less(rb, ra)) return !asc;
+                }
+
+                return a < b;
+            });
+
+        apply_sort(rows);
     }
 
     void remove_at(int index, int count = 1) {
         if (index < 0) return;
-        if (index >= m_records.size()) return;
+        if (index >= logical_size()) return;
 
-        beginRemoveRows(QModelIndex(), index, index + count - 1);
-        m_records.remove(index, count);
-        endRemoveRows();
+        do_remove(index, count);
     }
 
-    void insert_at(int index, std::span<Record> records) {
-        qDebug() << Q_FUNC_INFO << index << (m_records.size());
+    void insert_at(int index, std::span<Record const> records) {
         if (records.empty()) return;
-        beginInsertRows({}, index, index + records.size() - 1);
-        m_records.insert(index, records.size(), Record {});
-        for (int i = 0; i < records.size(); i++) {
-            m_records[index + i] = records[i];
+        do_insert(index, QVector<Record>(records.begin(), records.end()));
+    }
+
+    void insert_at(int index, QVector<Record>&& records) {
+        if (records.isEmpty()) return;
+        do_insert(index, std::move(records));
+    }
+
+    /// Move records out of a span into the model at an index. The span is left
+    /// with moved-from records.
+    void insert_moved_at(int index, std::span<Record> records) {
+        if (records.empty()) return;
+
+        QVector<Record> moved;
+        moved.reserve(records.size());
+        for (auto& r : records) {
+            moved.append(std::move(r));
         }
-        endInsertRows();
+
+        do_insert(index, std::move(moved));
+    }
+
+    /// Construct a record in place at an index
+    template <class... Args>
+    void emplace_at(int index, Args&&... args) {
+        do_insert_one(index, Record(std::forward<Args>(args)...));
     }
 
 
-    // delete by a predicate
+    // delete by a predicate. Contiguous runs of matching rows are removed
+    // with a single notification each.
     template <class Function>
     void remove_by_predicate(Function&& f) {
-        QVector<int> to_remove;
+        flush_structure();
+
+        QVector<struct_model_detail::RowRun> runs;
 
         for (int i = 0; i < m_records.size(); i++) {
-            if (f(m_records[i])) to_remove << i;
+            if (!f(std::as_const(m_records[i]))) continue;
+
+            if (!runs.isEmpty() and
+                runs.last().start + runs.last().count == i) {
+                runs.last().count++;
+            } else {
+                runs << struct_model_detail::RowRun { i, 1 };
+            }
+        }
+
+        remove_runs(runs);
+    }
+
+    /// Remove a set of rows, given in any order. Out of range and duplicate
+    /// rows are ignored.
+    void remove_indices(std::span<int const> rows) {
+        flush_structure();
+
+        QVector<int> sorted;
+        sorted.reserve(rows.size());
+
+        for (int row : rows) {
+            if (row >= 0 and row < m_records.size()) sorted << row;
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+        remove_runs(struct_model_detail::rows_to_runs(sorted));
+    }
+
+    /// Add a hash index on a member, mapping each key to a single row. If
+    /// records share a key, the first one is found. Members missing from the
+    /// meta are refused.
+    template <class Key>
+    void add_unique_index(Key Record::*member) {
+        if (find_index<struct_model_detail::UniqueIndex>(member)) return;
+
+        // a member missing from the meta asserts in debug builds
+        int const role = struct_model_detail::role_for_member(member);
+        if (role < 0) return;
+
+        m_indexes.push_back(
+            std::make_unique<struct_model_detail::UniqueIndex<Record, Key>>(
+                &m_records, role - Qt::UserRole, member));
+    }
+
+    /// Add an ordered index on a member, which allows duplicate keys and range
+    /// lookups. Members missing from the meta are refused.
+    template <class Key>
+    void add_ordered_index(Key Record::*member) {
+        if (find_index<struct_model_detail::OrderedIndex>(member)) return;
+
+        // a member missing from the meta asserts in debug builds
+        int const role = struct_model_detail::role_for_member(member);
+        if (role < 0) return;
+
+        m_indexes.push_back(
+            std::make_unique<struct_model_detail::OrderedIndex<Record, Key>>(
+                &m_records, role - Qt::UserRole, member));
+    }
+
+    /// Keep running totals of a numeric member: count, sum, min, max and mean.
+    /// The totals follow every change to the model, and are reported once per
+    /// change, or once per batch.
+    ///
+    /// \returns The aggregate, owned by the model, or null if the member is
+    /// not in the meta
+    template <class Value>
+    StructAggregate* add_aggregate(Value Record::*member) {
+        using Typed = struct_model_detail::MemberAggregate<Record, Value>;
+
+        for (auto* a : m_aggregates) {
+            auto* typed = dynamic_cast<Typed*>(a);
+            if (typed and typed->member() == member) return typed;
+        }
+
+        // a member missing from the meta asserts in debug builds
+        int const role = struct_model_detail::role_for_member(member);
+        if (role < 0) return nullptr;
+
+        int const column = role - Qt::UserRole;
+
+        auto* a = new Typed(&m_records,
+                            column,
+                            QString::fromUtf8(Table::names[column]),
+                            member,
+                            this);
+        a->rebuild();
+
+        m_aggregates.push_back(a);
+        register_aggregate(a);
+
+        return a;
+    }
+
+    /// Start recording changes, so they can be undone. Changes made before
+    /// this are not recorded.
+    ///
+    /// \returns The journal, owned by the model
+    StructJournal* enable_journal() {
+        if (!m_journal) m_journal = new Journal(this, this);
+        return m_journal;
+    }
+
+    StructJournal* journal() const override { return m_journal; }
+
+    /// Find the row of a record by key. Uses an index on the member if there
+    /// is one, and a scan otherwise.
+    ///
+    /// \returns The row, or -1 if there is no such record
+    template <class Key>
+    int find_row(Key Record::*member,
+                 std::type_identity_t<Key> const& key) const {
+        if (auto* i = find_index<struct_model_detail::UniqueIndex>(member)) {
+            return i->find(key);
+        }
+
+        if (auto* i = find_index<struct_model_detail::OrderedIndex>(member)) {
+            return i->find(key).value(0, -1);
+        }
+
+        auto iter = std::find_if(
+            m_records.begin(), m_records.end(), [&](Record const& r) {
+                return r.*member == key;
+            });
+
+        if (iter == m_records.end()) return -1;
+        return int(iter - m_records.begin());
+    }
+
+    /// Find all rows holding a key, in ascending order
+    template <class Key>
+    QVector<int> find_rows(Key Record::*member,
+                           std::type_identity_t<Key> const& key) const {
+        if (auto* i = find_index<struct_model_detail::OrderedIndex>(member)) {
+            return i->find(key);
         }
 
-        // sort to high -> low, so indices are preserved
-        std::reverse(to_remove.begin(), to_remove.end());
+        if (auto* i = find_index<struct_model_detail::UniqueIndex>(member)) {
+            int row = i->find(key);
+            if (row < 0) return {};
+            return { row };
+        }
 
-        for (auto i : to_remove) {
-            remove_at(i);
+        QVector<int> ret;
+        for (int i = 0; i < m_records.size(); i++) {
+            if (m_records[i].*member == key) ret << i;
         }
+        return ret;
+    }
+
+    /// Find all rows with keys in [low, high], in ascending order. Needs an
+    /// ordered index on the member.
+    template <class Key>
+    QVector<int>
+    find_rows_between(Key Record::*member,
+                      std::type_identity_t<Key> const& low,
+                      std::type_identity_t<Key> const& high) const {
+        auto* i = find_index<struct_model_detail::OrderedIndex>(member);
+
+        Q_ASSERT(i);
+
+        if (!i) return {};
+
+        return i->find_range(low, high);
+    }
+
+    /// Replace the record with the same key as the given one
+    ///
+    /// \returns True if a record was found
+    template <class Key>
+    bool update_by_key(Key Record::*member, Record const& r) {
+        flush_structure();
+
+        int row = find_row(member, r.*member);
+        if (row < 0) return false;
+
+        update(row, r);
+        return true;
+    }
+
+    /// Remove the record with the given key
+    ///
+    /// \returns True if a record was found
+    template <class Key>
+    bool remove_by_key(Key Record::*member,
+                       std::type_identity_t<Key> const& key) {
+        flush_structure();
+
+        int row = find_row(member, key);
+        if (row < 0) return false;
+
+        remove_at(row);
+        return true;
     }
 
     auto const& vector() const { return m_records; }
@@ -0,0 +1,104 @@
+#include "structmodelfeed.h"
+
+#include <QThread>
+#include <QTimerEvent>
+
+StructModelFeedBase::StructModelFeedBase(QObject* parent) : QObject(parent) { }
+
+StructModelFeedBase::~StructModelFeedBase() = default;
+
+void StructModelFeedBase::set_interval(int ms) {
+    m_interval = std::max(ms, 0);
+
+    if (m_timer_id) {
+        killTimer(m_timer_id);
+        m_timer_id = 0;
+        arm();
+    }
+}
+
+void StructModelFeedBase::set_max_batch(int count) {
+    m_max_batch = std::max(count, 1);
+}
+
+void StructModelFeedBase::set_capacity(qsizetype    capacity,
+                                       Backpressure policy) {
+    m_capacity.store(std::max<qsizetype>(capacity, 0),
+                     std::memory_order_relaxed);
+    m_policy.store(policy, std::memory_order_relaxed);
+
+    // let blocked producers re-check against the new bound
+    m_pending.notify_all();
+}
+
+void StructModelFeedBase::flush() {
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    int count = 0;
+
+    while (true) {
+        int taken = drain(m_max_batch);
+        count += taken;
+        if (taken < m_max_batch) break;
+    }
+
+    if (count) emit drained(count);
+}
+
+bool StructModelFeedBase::reserve_slot() {
+    qsizetype current = m_pending.load();
+
+    while (true) {
+        qsizetype const capacity = m_capacity.load(std::memory_order_relaxed);
+
+        if (capacity > 0 and current >= capacity) {
+            if (m_policy.load(std::memory_order_relaxed) ==
+                Backpressure::DropNewest) {
+                m_dropped.fetch_add(1);
+                return false;
+            }
+
+            m_pending.wait(current);
+            current = m_pending.load();
+            continue;
+        }
+
+        if (m_pending.compare_exchange_weak(current, current + 1)) break;
+    }
+
+    // the first item into an empty queue wakes the model thread up
+    if (current == 0) {
+        QMetaObject::invokeMethod(
+            this, [this]() { arm(); }, Qt::QueuedConnection);
+    }
+
+    return true;
+}
+
+void StructModelFeedBase::release_slots(qsizetype count) {
+    if (count <= 0) return;
+    m_pending.fetch_sub(count);
+    m_pending.notify_all();
+}
+
+void StructModelFeedBase::arm() {
+    if (m_timer_id) return;
+    m_timer_id = startTimer(m_interval, Qt::PreciseTimer);
+}
+
+void StructModelFeedBase::timerEvent(QTimerEvent* event) {
+    if (event->timerId() != m_timer_id) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    int taken = drain(m_max_batch);
+
+    if (taken) emit drained(taken);
+
+    // go idle until the next push into an empty queue
+    if (m_pending.load() == 0) {
+        killTimer(m_timer_id);
+        m_timer_id = 0;
+    }
+}
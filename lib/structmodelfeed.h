@@ -0,0 +1,215 @@
+#pragma once
+
+#include "mpscqueue.h"
+#include "structmodel.h"
+
+#include <QObject>
+#include <QPointer>
+
+#include <atomic>
+#include <functional>
+
+class StructModelFeedBase : public QObject {
+    Q_OBJECT
+public:
+    /// What a producer does when the queue is full
+    enum class Backpressure {
+        /// Drop the new item; the push reports failure
+        DropNewest,
+        /// Wait until the model thread has made room. Never use this from the
+        /// model's own thread.
+        Block,
+    };
+
+private:
+    std::atomic<qsizetype> m_pending { 0 };
+    std::atomic<qsizetype> m_dropped { 0 };
+
+    // read by producers while the model thread may change them
+    std::atomic<qsizetype>    m_capacity { 0 };
+    std::atomic<Backpressure> m_policy { Backpressure::DropNewest };
+
+    int m_timer_id  = 0;
+    int m_interval  = 16;
+    int m_max_batch = 4096;
+
+    void arm();
+
+protected:
+    /// Apply up to max queued items to the model
+    ///
+    /// \returns The number of items taken off the queue
+    virtual int drain(int max) = 0;
+
+    /// Claim a queue slot before pushing, applying the backpressure policy.
+    ///
+    /// \returns False if the item should be dropped
+    bool reserve_slot();
+
+    /// Give back slots for items taken off the queue
+    void release_slots(qsizetype count);
+
+    void timerEvent(QTimerEvent* event) override;
+
+public:
+    explicit StructModelFeedBase(QObject* parent = nullptr);
+    virtual ~StructModelFeedBase();
+
+    /// Set how often, in milliseconds, queued items are applied. The default
+    /// is roughly once per frame.
+    void set_interval(int ms);
+
+    /// Set the most items applied per interval
+    void set_max_batch(int count);
+
+    /// Bound the queue. A capacity of zero means unbounded. Safe to call while
+    /// producers are pushing.
+    void set_capacity(qsizetype capacity, Backpressure policy);
+
+    /// Number of items waiting to be applied
+    qsizetype pending() const { return m_pending.load(); }
+
+    /// Number of items dropped because the queue was full
+    qsizetype dropped() const { return m_dropped.load(); }
+
+    /// Apply everything queued right now, ignoring the batch limit
+    void flush();
+
+signals:
+    /// Emitted after a batch has been applied
+    void drained(int count);
+};
+
+///
+/// \brief The StructModelFeed class lets worker threads feed a
+/// StructTableModel.
+///
+/// Pushes are lock-free and can come from any thread. The feed lives on the
+/// model's thread and applies queued items in bounded batches on a timer.
+/// Each batch goes through a model batch, so a tick's worth of appends becomes
+/// one row insert, and updates become a few coalesced dataChanged.
+///
+template <class Record>
+class StructModelFeed : public StructModelFeedBase {
+public:
+    using Model = StructTableModel<Record>;
+
+private:
+    struct Op {
+        enum Kind {
+            Append,
+            Upsert,
+            Remove,
+        };
+
+        Kind   kind;
+        Record record;
+    };
+
+    MPSCQueue<Op>   m_queue;
+    QPointer<Model> m_model;
+
+    std::function<bool(Model&, Record const&)> m_update;
+    std::function<bool(Model&, Record const&)> m_remove;
+
+    bool enqueue(typename Op::Kind kind, Record&& r) {
+        if (!reserve_slot()) return false;
+        m_queue.push(Op { kind, std::move(r) });
+        return true;
+    }
+
+protected:
+    int drain(int max) override {
+        int taken = 0;
+
+        QVector<Record> appends;
+
+        auto flush_appends = [&]() {
+            if (appends.isEmpty()) return;
+            m_model->append(std::move(appends));
+            appends = {};
+        };
+
+        if (m_model) m_model->begin_batch();
+
+        while (taken < max) {
+            auto op = m_queue.pop();
+            if (!op) break;
+            taken++;
+
+            if (!m_model) continue;
+
+            switch (op->kind) {
+            case Op::Append: appends << std::move(op->record); break;
+            case Op::Upsert:
+                flush_appends();
+                if (!m_update(*m_model, op->record)) {
+                    appends << std::move(op->record);
+                }
+                break;
+            case Op::Remove:
+                flush_appends();
+                m_remove(*m_model, op->record);
+                break;
+            }
+        }
+
+        if (m_model) {
+            flush_appends();
+            m_model->end_batch();
+        }
+
+        release_slots(taken);
+
+        return taken;
+    }
+
+public:
+    explicit StructModelFeed(Model* model, QObject* parent = nullptr)
+        : StructModelFeedBase(parent), m_model(model) { }
+
+    ~StructModelFeed() = default;
+
+    /// Set the member that identifies records, for push_upsert() and
+    /// push_remove(). Set this before producers start.
+    template <class Key>
+    void set_key(Key Record::*member) {
+        m_update = [member](Model& m, Record const& r) {
+            return m.update_by_key(member, r);
+        };
+        m_remove = [member](Model& m, Record const& r) {
+            return m.remove_by_key(member, r.*member);
+        };
+    }
+
+    /// Queue a record to be appended. Safe to call from any thread.
+    ///
+    /// \returns False if the record was dropped because the queue is full
+    bool push(Record r) { return enqueue(Op::Append, std::move(r)); }
+
+    /// Queue a record to replace the one with the same key, or be appended if
+    /// there is none. Needs set_key().
+    ///
+    /// \returns False if the record was dropped because the queue is full, or
+    /// no key is set
+    bool push_upsert(Record r) {
+        if (!m_update) {
+            qWarning() << "Upsert pushed to a feed without a key";
+            return false;
+        }
+        return enqueue(Op::Upsert, std::move(r));
+    }
+
+    /// Queue removal of the record with the same key as the given one. Needs
+    /// set_key().
+    ///
+    /// \returns False if the record was dropped because the queue is full, or
+    /// no key is set
+    bool push_remove(Record r) {
+        if (!m_remove) {
+            qWarning() << "Removal pushed to a feed without a key";
+            return false;
+        }
+        return enqueue(Op::Remove, std::move(r));
+    }
+};
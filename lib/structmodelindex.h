@@ -0,0 +1,189 @@
+#pragma once
+
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
+#include <map>
+
+namespace struct_model_detail {
+
+///
+/// \brief The RecordIndex class is the interface the model uses to keep a
+/// secondary index over its records current.
+///
+/// Appends and edits are applied as they happen. Anything that shifts rows
+/// around marks the index stale, and it is rebuilt on the next lookup.
+///
+template <class Record>
+class RecordIndex {
+protected:
+    QVector<Record> const* m_records;
+    int                    m_column;
+    mutable bool           m_stale = true;
+
+    virtual void clear() const                        = 0;
+    virtual void add(int row, Record const& r) const  = 0;
+    virtual void take(int row, Record const& r) const = 0;
+
+    void ensure() const {
+        if (!m_stale) return;
+        clear();
+        for (int i = 0; i < m_records->size(); i++) {
+            add(i, (*m_records)[i]);
+        }
+        m_stale = false;
+    }
+
+public:
+    RecordIndex(QVector<Record> const* records, int column)
+        : m_records(records), m_column(column) { }
+    virtual ~RecordIndex() = default;
+
+    /// Check if edits to the given column affect this index
+    bool covers(int column) const { return column == m_column; }
+
+    /// Drop the contents; they are rebuilt on the next lookup
+    void invalidate() {
+        m_stale = true;
+        clear();
+    }
+
+    /// A record is about to be changed in place
+    void unlink(int row, Record const& r) {
+        if (!m_stale) take(row, r);
+    }
+
+    /// A record has been changed in place, or appended
+    void link(int row, Record const& r) {
+        if (!m_stale) add(row, r);
+    }
+};
+
+///
+/// \brief The UniqueIndex class maps each key to a single row. If several
+/// records share a key, the first one wins.
+///
+template <class Record, class Key>
+class UniqueIndex : public RecordIndex<Record> {
+    Key Record::*m_member;
+
+    // the first row holding a key, and how many records hold it
+    struct Entry {
+        int row;
+        int count;
+    };
+
+    mutable QHash<Key, Entry> m_rows;
+
+protected:
+    void clear() const override { m_rows.clear(); }
+
+    void add(int row, Record const& r) const override {
+        auto const& key  = r.*m_member;
+        auto        iter = m_rows.find(key);
+
+        if (iter == m_rows.end()) {
+            m_rows.insert(key, { row, 1 });
+            return;
+        }
+
+        iter.value().row = std::min(iter.value().row, row);
+        iter.value().count++;
+    }
+
+    void take(int row, Record const& r) const override {
+        auto iter = m_rows.find(r.*m_member);
+        if (iter == m_rows.end()) return;
+
+        if (iter.value().count == 1) {
+            m_rows.erase(iter);
+            return;
+        }
+
+        // another record holds the key, but which one is not known, so the
+        // index is rebuilt on the next lookup
+        if (iter.value().row == row) {
+            this->m_stale = true;
+            clear();
+            return;
+        }
+
+        iter.value().count--;
+    }
+
+public:
+    UniqueIndex(QVector<Record> const* records,
+                int                    column,
+                Key Record::*member)
+        : RecordIndex<Record>(records, column), m_member(member) { }
+
+    Key Record::*member() const { return m_member; }
+
+    /// \returns The row holding the key, or -1
+    int find(Key const& key) const {
+        this->ensure();
+        auto iter = m_rows.constFind(key);
+        return iter == m_rows.constEnd() ? -1 : iter.value().row;
+    }
+};
+
+///
+/// \brief The OrderedIndex class keeps rows sorted by key, allowing duplicate
+/// keys and range lookups.
+///
+template <class Record, class Key>
+class OrderedIndex : public RecordIndex<Record> {
+    Key Record::*m_member;
+
+    mutable std::multimap<Key, int> m_rows;
+
+    static QVector<int> collect(auto begin, auto end) {
+        QVector<int> ret;
+        for (; begin != end; ++begin) {
+            ret << begin->second;
+        }
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+protected:
+    void clear() const override { m_rows.clear(); }
+
+    void add(int row, Record const& r) const override {
+        m_rows.emplace(r.*m_member, row);
+    }
+
+    void take(int row, Record const& r) const override {
+        auto [begin, end] = m_rows.equal_range(r.*m_member);
+        for (; begin != end; ++begin) {
+            if (begin->second == row) {
+                m_rows.erase(begin);
+                return;
+            }
+        }
+    }
+
+public:
+    OrderedIndex(QVector<Record> const* records,
+                 int                    column,
+                 Key Record::*member)
+        : RecordIndex<Record>(records, column), m_member(member) { }
+
+    Key Record::*member() const { return m_member; }
+
+    /// \returns The rows holding the key, in ascending row order
+    QVector<int> find(Key const& key) const {
+        this->ensure();
+        auto [begin, end] = m_rows.equal_range(key);
+        return collect(begin, end);
+    }
+
+    /// \returns The rows with keys in [low, high], in ascending row order
+    QVector<int> find_range(Key const& low, Key const& high) const {
+        this->ensure();
+        return collect(m_rows.lower_bound(low), m_rows.upper_bound(high));
+    }
+};
+
+} // namespace struct_model_detail
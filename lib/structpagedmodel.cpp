@@ -0,0 +1,45 @@
+#include "structpagedmodel.h"
+
+StructPagedModelBase::StructPagedModelBase(QObject* parent)
+    : QAbstractTableModel(parent), m_mailbox(std::make_shared<Mailbox>()) {
+    m_mailbox->model = this;
+}
+
+StructPagedModelBase::~StructPagedModelBase() {
+    std::scoped_lock lock(m_mailbox->mutex);
+    m_mailbox->model = nullptr;
+}
+
+void StructPagedModelBase::deliver(
+    std::shared_ptr<Mailbox> const&             box,
+    std::function<void(StructPagedModelBase*)> f) {
+    std::scoped_lock lock(box->mutex);
+
+    auto* model = box->model;
+
+    if (!model) return;
+
+    // events posted to a model are dropped if it is destroyed before they run
+    QMetaObject::invokeMethod(
+        model, [model, f = std::move(f)]() { f(model); }, Qt::QueuedConnection);
+}
+
+int StructPagedModelBase::rowCount(QModelIndex const& parent) const {
+    if (parent.isValid()) return 0;
+    return m_exposed;
+}
+
+bool StructPagedModelBase::canFetchMore(QModelIndex const& parent) const {
+    if (parent.isValid()) return false;
+    return m_exposed < m_total;
+}
+
+void StructPagedModelBase::fetchMore(QModelIndex const& parent) {
+    if (!canFetchMore(parent)) return;
+
+    int const next = std::min(m_total, m_exposed + m_page_size);
+
+    beginInsertRows({}, m_exposed, next - 1);
+    m_exposed = next;
+    endInsertRows();
+}
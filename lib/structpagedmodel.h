@@ -0,0 +1,291 @@
+#pragma once
+
+#include "structmodel.h"
+
+#include <QSet>
+#include <QThreadPool>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+///
+/// \brief The StructRecordSource class provides records to a
+/// StructPagedModel on demand.
+///
+template <class Record>
+class StructRecordSource {
+public:
+    virtual ~StructRecordSource() = default;
+
+    /// Total number of records. Called on the model's thread.
+    virtual int count() const = 0;
+
+    /// Fetch count records starting at first. Called from worker threads, and
+    /// possibly from several at once, so this must be thread safe.
+    virtual QVector<Record> fetch(int first, int count) const = 0;
+};
+
+class StructPagedModelBase : public QAbstractTableModel {
+    Q_OBJECT
+
+protected:
+    // Lets worker threads hand results back only while the model is alive
+    struct Mailbox {
+        std::mutex            mutex;
+        StructPagedModelBase* model = nullptr;
+    };
+
+    std::shared_ptr<Mailbox> m_mailbox;
+
+    int m_page_size = 256;
+    int m_max_pages = 64;
+
+    // cached pages are cut to m_page_size, so a new size waits for a reset
+    int m_next_page_size = 256;
+    int m_prefetch  = 2;
+
+    int m_total   = 0; // rows the source has
+    int m_exposed = 0; // rows handed out through fetchMore
+
+    // bumped on reset, so late pages from an old source are ignored
+    quint64 m_generation = 0;
+
+    /// Run f on the model's thread, if the model still exists by then. Safe to
+    /// call from any thread.
+    static void deliver(std::shared_ptr<Mailbox> const&             box,
+                        std::function<void(StructPagedModelBase*)> f);
+
+public:
+    explicit StructPagedModelBase(QObject* parent = nullptr);
+    virtual ~StructPagedModelBase();
+
+    /// Set the number of records per page. Takes effect on the next reset,
+    /// through refresh() or a new source; until then page_size() is the size
+    /// in use.
+    void set_page_size(int count) { m_next_page_size = std::max(count, 1); }
+    int  page_size() const { return m_page_size; }
+
+    /// Set the most pages kept in memory. This should cover the visible rows
+    /// plus the prefetch on either side, or pages will be loaded repeatedly.
+    void set_max_pages(int count) { m_max_pages = std::max(count, 1); }
+    int  max_pages() const { return m_max_pages; }
+
+    /// Set how many pages either side of a requested page are loaded ahead
+    void set_prefetch(int pages) { m_prefetch = std::max(pages, 0); }
+    int  prefetch() const { return m_prefetch; }
+
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override;
+
+    bool canFetchMore(QModelIndex const& parent) const override;
+    void fetchMore(QModelIndex const& parent) override;
+
+signals:
+    /// A page of records arrived and is now readable
+    void page_loaded(int page);
+};
+
+///
+/// \brief The StructPagedModel class is a read-only StructTableModel that
+/// pulls records from a StructRecordSource a page at a time.
+///
+/// Rows are handed to views through canFetchMore()/fetchMore(). Reading a row
+/// whose page is not in memory returns nothing, and loads that page and its
+/// neighbours on the thread pool; a dataChanged follows when they arrive. At
+/// most max_pages() pages are kept, dropping the least recently used, so
+/// memory stays bounded however large the source is.
+///
+template <class Record>
+class StructPagedModel : public StructPagedModelBase {
+public:
+    using Source = StructRecordSource<Record>;
+
+private:
+    using Table = struct_model_detail::ColumnTable<Record>;
+
+    struct Page {
+        QVector<Record>          records;
+        std::list<int>::iterator lru;
+    };
+
+    std::shared_ptr<Source const> m_source;
+
+    mutable QHash<int, Page> m_pages;
+    mutable std::list<int>   m_lru; // most recent first
+    mutable QSet<int>        m_loading;
+    mutable int              m_last_page = -1;
+
+    int page_count() const {
+        return (m_total + m_page_size - 1) / m_page_size;
+    }
+
+    Record const* find(int row) const {
+        auto iter = m_pages.find(row / m_page_size);
+        if (iter == m_pages.end()) return nullptr;
+
+        auto& page = iter.value();
+        m_lru.splice(m_lru.begin(), m_lru, page.lru);
+
+        int offset = row % m_page_size;
+        if (offset >= page.records.size()) return nullptr;
+        return &page.records[offset];
+    }
+
+    void request(int page) const {
+        if (page < 0 or page >= page_count()) return;
+        if (m_pages.contains(page) or m_loading.contains(page)) return;
+
+        m_loading.insert(page);
+
+        int const first = page * m_page_size;
+        int const count = std::min(m_page_size, m_total - first);
+
+        auto source     = m_source;
+        auto box        = m_mailbox;
+        auto generation = m_generation;
+
+        QThreadPool::globalInstance()->start([=]() {
+            auto records = source->fetch(first, count);
+
+            deliver(box, [=](StructPagedModelBase* self) {
+                static_cast<StructPagedModel*>(self)->on_loaded(
+                    generation, page, records);
+            });
+        });
+    }
+
+    void request_around(int page) const {
+        request(page);
+        for (int d = 1; d <= m_prefetch; d++) {
+            request(page + d);
+            request(page - d);
+        }
+    }
+
+    void on_loaded(quint64 generation, int page, QVector<Record> records) {
+        if (generation != m_generation) return;
+
+        m_loading.remove(page);
+
+        m_lru.push_front(page);
+        m_pages.insert(page, Page { std::move(records), m_lru.begin() });
+
+        while (m_pages.size() > m_max_pages) {
+            int old = m_lru.back();
+            m_lru.pop_back();
+            m_pages.remove(old);
+        }
+
+        int const first = page * m_page_size;
+        int const last  = std::min(first + m_page_size, m_exposed) - 1;
+
+        if (first <= last) {
+            emit dataChanged(index(first, 0), index(last, columnCount() - 1));
+        }
+
+        emit page_loaded(page);
+    }
+
+public:
+    explicit StructPagedModel(QObject* parent = nullptr)
+        : StructPagedModelBase(parent) { }
+
+    /// Use a new source, resetting the model
+    void set_source(std::shared_ptr<Source const> source) {
+        m_source = std::move(source);
+        refresh();
+    }
+
+    /// Re-read the source's size and drop every cached page
+    void refresh() {
+        beginResetModel();
+
+        m_generation++;
+        m_pages.clear();
+        m_lru.clear();
+        m_loading.clear();
+        m_last_page = -1;
+        m_page_size = m_next_page_size;
+
+        m_total   = m_source ? m_source->count() : 0;
+        m_exposed = std::min(m_total, m_page_size);
+
+        endResetModel();
+    }
+
+    /// Tell the model which rows are on screen, so their pages and the ones
+    /// around them load ahead of data() calls
+    void set_visible_rows(int first, int last) {
+        if (!m_source) return;
+
+        first = std::max(first, 0);
+        last  = std::min(last, m_exposed - 1);
+
+        for (int p = first / m_page_size; p <= last / m_page_size; p++) {
+            request_around(p);
+        }
+    }
+
+    /// Check if a row's record is in memory right now
+    bool is_loaded(int row) const {
+        return m_pages.contains(row / m_page_size);
+    }
+
+    /// Number of pages in memory
+    int resident_pages() const { return m_pages.size(); }
+
+    // Header:
+    QVariant headerData(int             section,
+                        Qt::Orientation orientation,
+                        int             role = Qt::DisplayRole) const override {
+        if (orientation != Qt::Orientation::Horizontal) return {};
+        if (role != Qt::DisplayRole) return {};
+
+        return struct_model_detail::get_header<Record>().value(section);
+    }
+
+    int columnCount(QModelIndex const& parent = QModelIndex()) const override {
+        if (parent.isValid()) return 0;
+        return Table::count;
+    }
+
+    QVariant data(QModelIndex const& index,
+                  int                role = Qt::DisplayRole) const override {
+        if (!index.isValid()) return {};
+        if (index.row() >= m_exposed) return {};
+
+        int const page = index.row() / m_page_size;
+
+        // only look around when the reader moves to another page
+        if (page != m_last_page) {
+            m_last_page = page;
+            request_around(page);
+        }
+
+        auto const* item = find(index.row());
+
+        if (!item) return {};
+
+        int location = -1;
+
+        if (role == Qt::DisplayRole or role == Qt::EditRole) {
+            location = index.column();
+        } else if (role >= Qt::UserRole) {
+            location = role - Qt::UserRole;
+        }
+
+        if (!Table::in_range(location)) return {};
+
+        return Table::getters[location](*item);
+    }
+
+    Qt::ItemFlags flags(QModelIndex const& index) const override {
+        if (!index.isValid()) return Qt::NoItemFlags;
+        return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    }
+
+    QHash<int, QByteArray> roleNames() const override {
+        return struct_model_detail::get_name_map<Record>();
+    }
+};
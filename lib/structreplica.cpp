@@ -0,0 +1,331 @@
+#include "structreplica.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace struct_replica_detail {
+
+FrameWriter::FrameWriter(Kind kind, quint64 sequence) {
+    m_data.reserve(256);
+    write_value(quint32(0));
+    write_value(sequence);
+    write_value(quint8(kind));
+}
+
+void FrameWriter::write(void const* data, qsizetype size) {
+    m_data.append(static_cast<char const*>(data), size);
+}
+
+QByteArray FrameWriter::finish() {
+    quint32 const size = m_data.size() - sizeof(quint32);
+    std::memcpy(m_data.data(), &size, sizeof(size));
+    return std::move(m_data);
+}
+
+bool FrameReader::read(void* out, qsizetype size) {
+    if (size > remaining()) return false;
+    std::memcpy(out, m_data.data() + m_pos, size);
+    m_pos += size;
+    return true;
+}
+
+bool take_frames(QByteArray& buffer, std::vector<Frame>& out) {
+    qsizetype pos = 0;
+
+    while (buffer.size() - pos >= qsizetype(sizeof(quint32))) {
+        quint32 size;
+        std::memcpy(&size, buffer.constData() + pos, sizeof(size));
+
+        if (size > max_frame) return false;
+        if (size < frame_header - sizeof(quint32)) return false;
+
+        if (buffer.size() - pos - qsizetype(sizeof(quint32)) < size) break;
+
+        char const* p = buffer.constData() + pos + sizeof(quint32);
+
+        Frame f;
+        std::memcpy(&f.sequence, p, sizeof(quint64));
+
+        quint8 kind;
+        std::memcpy(&kind, p + sizeof(quint64), sizeof(kind));
+
+        if (kind > quint8(Kind::Reset)) return false;
+        f.kind = Kind(kind);
+
+        qsizetype const header = frame_header - sizeof(quint32);
+        f.payload              = QByteArray(p + header, size - header);
+
+        out.push_back(std::move(f));
+
+        pos += sizeof(quint32) + size;
+    }
+
+    buffer.remove(0, pos);
+    return true;
+}
+
+} // namespace struct_replica_detail
+
+using namespace struct_replica_detail;
+
+StructReplicaServerBase::StructReplicaServerBase(quint64 schema,
+                                                 QObject* parent)
+    : QObject(parent), m_server(new QLocalServer(this)), m_schema(schema) {
+    connect(m_server,
+            &QLocalServer::newConnection,
+            this,
+            &StructReplicaServerBase::accept);
+}
+
+StructReplicaServerBase::~StructReplicaServerBase() = default;
+
+bool StructReplicaServerBase::listen(QString const& name) {
+    // a server that crashed may have left its socket behind
+    QLocalServer::removeServer(name);
+    return m_server->listen(name);
+}
+
+void StructReplicaServerBase::set_tail_limit(qsizetype bytes) {
+    m_tail_limit = std::max<qsizetype>(bytes, 0);
+    trim_tail();
+}
+
+StructReplicaServerBase::Client*
+StructReplicaServerBase::find_client(QLocalSocket* socket) {
+    for (auto& c : m_clients) {
+        if (c.socket == socket) return &c;
+    }
+    return nullptr;
+}
+
+void StructReplicaServerBase::accept() {
+    while (auto* socket = m_server->nextPendingConnection()) {
+        auto& c  = m_clients.emplace_back();
+        c.socket = socket;
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() {
+            read_from(socket);
+        });
+
+        connect(socket,
+                &QLocalSocket::bytesWritten,
+                this,
+                [this, socket](qint64) { drained(socket); });
+
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            drop(socket);
+        });
+    }
+}
+
+void StructReplicaServerBase::read_from(QLocalSocket* socket) {
+    auto* c = find_client(socket);
+    if (!c) return;
+
+    c->inbox += socket->readAll();
+
+    std::vector<Frame> frames;
+
+    if (!take_frames(c->inbox, frames)) {
+        qWarning() << "Replica sent a malformed frame, dropping it";
+        socket->abort();
+        return;
+    }
+
+    for (auto const& f : frames) {
+        FrameReader in(f.payload);
+
+        quint64 schema, last;
+
+        if (f.kind != Kind::Hello or !in.read_value(schema) or
+            !in.read_value(last)) {
+            qWarning() << "Replica sent an unexpected frame, ignoring it";
+            continue;
+        }
+
+        if (schema != m_schema) {
+            qWarning() << "Replica has a different record layout, dropping it";
+            socket->abort();
+            return;
+        }
+
+        catch_up(*c, last);
+    }
+}
+
+void StructReplicaServerBase::drained(QLocalSocket* socket) {
+    auto* c = find_client(socket);
+    if (!c or !c->behind) return;
+    if (socket->bytesToWrite() > 0) return;
+
+    c->behind = false;
+    catch_up(*c, c->sent);
+}
+
+void StructReplicaServerBase::drop(QLocalSocket* socket) {
+    auto iter = std::find_if(m_clients.begin(),
+                             m_clients.end(),
+                             [socket](auto const& c) {
+                                 return c.socket == socket;
+                             });
+
+    if (iter == m_clients.end()) return;
+
+    m_clients.erase(iter);
+    socket->deleteLater();
+}
+
+void StructReplicaServerBase::catch_up(Client& c, quint64 last) {
+    c.live = true;
+
+    if (last == m_sequence) {
+        c.sent = last;
+        return;
+    }
+
+    // the tail covers what was missed
+    if (last < m_sequence and last + 1 >= m_tail_first) {
+        c.sent = last;
+
+        for (auto i = last + 1 - m_tail_first; i < m_tail.size(); i++) {
+            send(c, m_tail[i], m_tail_first + i);
+            if (c.behind) return;
+        }
+        return;
+    }
+
+    // a reset does not take a number of its own; it brings the replica up to
+    // the last change
+    FrameWriter out(Kind::Reset, m_sequence);
+    auto        s = snapshot();
+    out.write(s.constData(), s.size());
+
+    // sent even if it overruns the backlog, since nothing else can help
+    c.socket->write(out.finish());
+    c.sent = m_sequence;
+
+    if (c.socket->bytesToWrite() > m_backlog_limit) c.behind = true;
+}
+
+void StructReplicaServerBase::send(Client&           c,
+                                   QByteArray const& frame,
+                                   quint64           sequence) {
+    if (!c.live or c.behind) return;
+
+    c.socket->write(frame);
+    c.sent = sequence;
+
+    // stop feeding a replica that does not keep up; it catches up once the
+    // socket drains
+    if (c.socket->bytesToWrite() > m_backlog_limit) c.behind = true;
+}
+
+void StructReplicaServerBase::publish(FrameWriter&& frame) {
+    auto data = frame.finish();
+    m_sequence++;
+
+    for (auto& c : m_clients) {
+        send(c, data, m_sequence);
+    }
+
+    m_tail_bytes += data.size();
+    m_tail.push_back(std::move(data));
+
+    trim_tail();
+}
+
+void StructReplicaServerBase::trim_tail() {
+    while (!m_tail.empty() and m_tail_bytes > m_tail_limit) {
+        m_tail_bytes -= m_tail.front().size();
+        m_tail.pop_front();
+        m_tail_first++;
+    }
+}
+
+StructReplicaBase::StructReplicaBase(quint64 schema, QObject* parent)
+    : QObject(parent), m_socket(new QLocalSocket(this)), m_schema(schema) {
+    connect(
+        m_socket, &QLocalSocket::connected, this, &StructReplicaBase::hello);
+
+    connect(
+        m_socket, &QLocalSocket::readyRead, this, &StructReplicaBase::read);
+
+    connect(m_socket,
+            &QLocalSocket::disconnected,
+            this,
+            &StructReplicaBase::disconnected);
+}
+
+StructReplicaBase::~StructReplicaBase() = default;
+
+void StructReplicaBase::connect_to(QString const& name) {
+    m_socket->abort();
+    m_inbox.clear();
+    m_sequence = unsynced;
+    m_waiting  = false;
+    m_socket->connectToServer(name);
+}
+
+void StructReplicaBase::hello() {
+    FrameWriter out(Kind::Hello, 0);
+    out.write_value(m_schema);
+    out.write_value(m_sequence);
+    m_socket->write(out.finish());
+}
+
+void StructReplicaBase::read() {
+    m_inbox += m_socket->readAll();
+
+    std::vector<Frame> frames;
+
+    bool const ok = take_frames(m_inbox, frames);
+
+    begin_apply();
+
+    bool reset = false;
+
+    for (auto const& f : frames) {
+        // a reset stands on its own
+        bool const next = f.kind == Kind::Reset or
+                          (synced() and f.sequence == m_sequence + 1);
+
+        if (!next) {
+            // after a resync, the server may repeat changes already applied;
+            // without a copy, only a reset is any use
+            if (!synced() or f.sequence <= m_sequence) continue;
+
+            // something went missing; ignore everything until the server
+            // fills the gap
+            if (!m_waiting) {
+                m_waiting = true;
+                hello();
+            }
+            continue;
+        }
+
+        FrameReader in(f.payload);
+
+        if (!apply(f.kind, in)) {
+            qWarning() << "Unreadable change from the server, resyncing";
+
+            // the model may be partly changed; only a snapshot can fix that
+            m_sequence = unsynced;
+            m_waiting  = true;
+            hello();
+            continue;
+        }
+
+        m_sequence = f.sequence;
+        m_waiting  = false;
+        reset |= f.kind == Kind::Reset;
+    }
+
+    end_apply();
+
+    if (reset) emit resynced();
+
+    if (!ok) {
+        qWarning() << "Malformed stream from the server, disconnecting";
+        m_socket->abort();
+    }
+}
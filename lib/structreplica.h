@@ -0,0 +1,546 @@
+#pragma once
+
+#include "structsnapshot.h"
+
+#include <QBuffer>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <deque>
+#include <vector>
+
+namespace struct_replica_detail {
+
+// Frames are in host byte order, like snapshots; both ends are on the same
+// machine.
+//
+//   quint32 size of the rest of the frame
+//   quint64 sequence number
+//   quint8  kind
+//   payload
+//
+// A publisher numbers every change it sends. A reset that resyncs a replica
+// carries the number it brings the replica up to, rather than a new one.
+
+enum class Kind : quint8 {
+    Hello,  // from a replica: quint64 schema, quint64 last sequence seen
+    Insert, // qint32 row, qint32 count, then each record
+    Remove, // qint32 row, qint32 count
+    Update, // qint32 row, qint32 count, qint32 column, qint32 columns, then
+            // those members of each row
+    Reset,  // a snapshot of the whole model
+};
+
+inline constexpr qsizetype frame_header =
+    sizeof(quint32) + sizeof(quint64) + sizeof(quint8);
+
+// frames larger than this are taken as a broken stream
+inline constexpr quint32 max_frame = 1u << 30;
+
+// the last sequence of a replica that needs a snapshot; numbers restart with
+// each server, so that is any replica that has just connected
+inline constexpr quint64 unsynced = ~quint64(0);
+
+/// Builds a frame
+class FrameWriter {
+    QByteArray m_data;
+
+public:
+    FrameWriter(Kind kind, quint64 sequence);
+
+    void write(void const* data, qsizetype size);
+
+    template <class T>
+    void write_value(T const& value) {
+        if constexpr (std::is_same_v<T, QString>) {
+            write_value(quint32(value.size()));
+            write(value.constData(), value.size() * sizeof(char16_t));
+        } else if constexpr (std::is_same_v<T, bool>) {
+            write_value(quint8(value));
+        } else {
+            static_assert(std::is_trivially_copyable_v<T>);
+            write(&value, sizeof(T));
+        }
+    }
+
+    /// Fill in the size, and hand over the finished frame
+    QByteArray finish();
+};
+
+/// Reads the payload of a frame, refusing to run past its end
+class FrameReader {
+    QByteArrayView m_data;
+    qsizetype      m_pos = 0;
+
+public:
+    explicit FrameReader(QByteArrayView payload) : m_data(payload) { }
+
+    /// \returns False, reading nothing, if fewer than size bytes are left
+    bool read(void* out, qsizetype size);
+
+    qsizetype remaining() const { return m_data.size() - m_pos; }
+
+    QByteArrayView rest() const { return m_data.sliced(m_pos); }
+
+    template <class T>
+    bool read_value(T& out) {
+        if constexpr (std::is_same_v<T, QString>) {
+            quint32 size;
+            if (!read_value(size)) return false;
+            if (qsizetype(size) * 2 > remaining()) return false;
+
+            out = QString(size, Qt::Uninitialized);
+            return read(out.data(), size * sizeof(char16_t));
+        } else if constexpr (std::is_same_v<T, bool>) {
+            quint8 v;
+            if (!read_value(v)) return false;
+            out = v != 0;
+            return true;
+        } else {
+            static_assert(std::is_trivially_copyable_v<T>);
+            return read(&out, sizeof(T));
+        }
+    }
+};
+
+struct Frame {
+    Kind       kind;
+    quint64    sequence;
+    QByteArray payload;
+};
+
+/// Split the complete frames off the front of a buffer
+///
+/// \returns False if the buffer holds something that cannot be a frame
+bool take_frames(QByteArray& buffer, std::vector<Frame>& out);
+
+template <class Record, std::size_t I>
+void write_member(FrameWriter& out, Record const& r) {
+    out.write_value(std::get<I>(Record::meta).get(r));
+}
+
+template <class Record, std::size_t I>
+bool read_member(FrameReader& in, Record& r) {
+    auto const& m = std::get<I>(Record::meta);
+
+    struct_snapshot_detail::value_t<Record, std::remove_cvref_t<decltype(m)>>
+        value;
+
+    if (!in.read_value(value)) return false;
+
+    // custom entries without a setter are derived from other members; the
+    // value is only read to get past it
+    if constexpr (requires { m.setter; }) {
+        if (!m.setter) return true;
+    }
+
+    m.set(r, std::move(value));
+    return true;
+}
+
+/// Per-record member encoders, indexed by column
+template <class Record>
+struct MemberCodec {
+    using Writer = void (*)(FrameWriter&, Record const&);
+    using Reader = bool (*)(FrameReader&, Record&);
+
+    static constexpr int count =
+        std::tuple_size_v<std::remove_cvref_t<decltype(Record::meta)>>;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_writers(std::index_sequence<Is...>) {
+        return std::array<Writer, count> { &write_member<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_readers(std::index_sequence<Is...>) {
+        return std::array<Reader, count> { &read_member<Record, Is>... };
+    }
+
+    using Seq = std::make_index_sequence<count>;
+
+public:
+    static constexpr std::array<Writer, count> writers = make_writers(Seq {});
+    static constexpr std::array<Reader, count> readers = make_readers(Seq {});
+
+    static void write_record(FrameWriter& out, Record const& r) {
+        for (auto w : writers) {
+            w(out, r);
+        }
+    }
+
+    static bool read_record(FrameReader& in, Record& r) {
+        for (auto rd : readers) {
+            if (!rd(in, r)) return false;
+        }
+        return true;
+    }
+};
+
+} // namespace struct_replica_detail
+
+///
+/// \brief The StructReplicaServerBase class sends the changes of a model to
+/// replicas in other processes, over a local socket.
+///
+/// Recent changes are kept in a bounded tail. A replica that connects, or
+/// that missed something, says which change it saw last: it gets the rest of
+/// the tail if that still covers the gap, and a snapshot followed by new
+/// changes if not. A replica that reads too slowly is cut off from changes
+/// until its socket drains, and then catches up the same way.
+///
+class StructReplicaServerBase : public QObject {
+    Q_OBJECT
+
+    struct Client {
+        QLocalSocket* socket = nullptr;
+        QByteArray    inbox;
+        quint64       sent   = 0; // last sequence written to the socket
+        bool          live   = false;
+        bool          behind = false;
+    };
+
+    QLocalServer*       m_server;
+    std::vector<Client> m_clients;
+
+    quint64 m_schema;
+    quint64 m_sequence = 0;
+
+    // the last changes sent, numbered from m_tail_first
+    std::deque<QByteArray> m_tail;
+    quint64                m_tail_first = 1;
+    qsizetype              m_tail_bytes = 0;
+    qsizetype              m_tail_limit = 4 * 1024 * 1024;
+
+    qint64 m_backlog_limit = 16 * 1024 * 1024;
+
+    Client* find_client(QLocalSocket* socket);
+
+    void accept();
+    void read_from(QLocalSocket* socket);
+    void drained(QLocalSocket* socket);
+    void drop(QLocalSocket* socket);
+
+    /// Bring a client that saw everything up to last up to date
+    void catch_up(Client& c, quint64 last);
+
+    void send(Client& c, QByteArray const& frame, quint64 sequence);
+
+    void trim_tail();
+
+protected:
+    StructReplicaServerBase(quint64 schema, QObject* parent);
+
+    /// Start a frame for the next change
+    struct_replica_detail::FrameWriter begin(struct_replica_detail::Kind kind) {
+        return { kind, m_sequence + 1 };
+    }
+
+    /// Number a change, and send it to every replica that is keeping up
+    void publish(struct_replica_detail::FrameWriter&& frame);
+
+    /// A snapshot of the whole model, for a reset frame
+    virtual QByteArray snapshot() const = 0;
+
+public:
+    virtual ~StructReplicaServerBase();
+
+    /// Start taking replicas under the given socket name
+    ///
+    /// \returns False if the name could not be used
+    bool listen(QString const& name);
+
+    /// Set how many bytes of recent changes are kept for replicas that fall
+    /// behind. Larger gaps are covered with a snapshot.
+    void set_tail_limit(qsizetype bytes);
+
+    /// Set how much unsent data a replica may pile up before it is cut off
+    void set_backlog_limit(qint64 bytes) { m_backlog_limit = bytes; }
+
+    /// Number of the last change sent
+    quint64 sequence() const { return m_sequence; }
+
+    int replica_count() const { return m_clients.size(); }
+};
+
+///
+/// \brief The StructReplicaServer class publishes a StructTableModel to
+/// StructReplica instances.
+///
+/// Changes are picked up from the model's notifications, so every way of
+/// changing it is covered, and batched changes go out as the batch reports
+/// them. Moves go out as a remove and an insert; layout changes and resets go
+/// out as snapshots.
+///
+/// Members must be QString or trivially copyable, as for snapshots.
+///
+template <class Record>
+class StructReplicaServer : public StructReplicaServerBase {
+    using Kind  = struct_replica_detail::Kind;
+    using Codec = struct_replica_detail::MemberCodec<Record>;
+
+    StructTableModel<Record> const* m_model;
+
+    void send_insert(int first, int count) {
+        auto out = begin(Kind::Insert);
+        out.write_value(qint32(first));
+        out.write_value(qint32(count));
+        for (int i = first; i < first + count; i++) {
+            Codec::write_record(out, *m_model->get_at(i));
+        }
+        publish(std::move(out));
+    }
+
+    void send_remove(int first, int count) {
+        auto out = begin(Kind::Remove);
+        out.write_value(qint32(first));
+        out.write_value(qint32(count));
+        publish(std::move(out));
+    }
+
+    void send_update(QModelIndex const& top_left,
+                     QModelIndex const& bottom_right) {
+        int const first   = top_left.row();
+        int const count   = bottom_right.row() - first + 1;
+        int const column  = top_left.column();
+        int const columns = bottom_right.column() - column + 1;
+
+        auto out = begin(Kind::Update);
+        out.write_value(qint32(first));
+        out.write_value(qint32(count));
+        out.write_value(qint32(column));
+        out.write_value(qint32(columns));
+
+        for (int i = first; i < first + count; i++) {
+            auto const& r = *m_model->get_at(i);
+            for (int c = column; c < column + columns; c++) {
+                Codec::writers[c](out, r);
+            }
+        }
+
+        publish(std::move(out));
+    }
+
+    void send_reset() {
+        auto out = begin(Kind::Reset);
+        auto s   = snapshot();
+        out.write(s.constData(), s.size());
+        publish(std::move(out));
+    }
+
+protected:
+    QByteArray snapshot() const override {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        save_snapshot(*m_model, buffer);
+        return buffer.data();
+    }
+
+public:
+    explicit StructReplicaServer(StructTableModel<Record> const* model,
+                                 QObject* parent = nullptr)
+        : StructReplicaServerBase(snapshot_schema<Record>(), parent),
+          m_model(model) {
+        connect(model,
+                &QAbstractItemModel::rowsInserted,
+                this,
+                [this](QModelIndex const&, int first, int last) {
+                    send_insert(first, last - first + 1);
+                });
+
+        connect(model,
+                &QAbstractItemModel::rowsRemoved,
+                this,
+                [this](QModelIndex const&, int first, int last) {
+                    send_remove(first, last - first + 1);
+                });
+
+        connect(model,
+                &QAbstractItemModel::rowsMoved,
+                this,
+                [this](QModelIndex const&,
+                       int first,
+                       int last,
+                       QModelIndex const&,
+                       int dest) {
+                    int const count = last - first + 1;
+                    send_remove(first, count);
+                    send_insert(dest > first ? dest - count : dest, count);
+                });
+
+        connect(model,
+                &QAbstractItemModel::dataChanged,
+                this,
+                [this](QModelIndex const& top_left,
+                       QModelIndex const& bottom_right) {
+                    send_update(top_left, bottom_right);
+                });
+
+        connect(model, &QAbstractItemModel::modelReset, this, [this]() {
+            send_reset();
+        });
+
+        connect(model, &QAbstractItemModel::layoutChanged, this, [this]() {
+            send_reset();
+        });
+    }
+};
+
+///
+/// \brief The StructReplicaBase class follows a StructReplicaServer over a
+/// local socket.
+///
+/// Each read from the socket is applied as one batch. If a change goes
+/// missing, the replica asks to be caught up and ignores everything until it
+/// is. A stream that cannot be read drops the connection.
+///
+class StructReplicaBase : public QObject {
+    Q_OBJECT
+
+    QLocalSocket* m_socket;
+    QByteArray    m_inbox;
+
+    quint64 m_schema;
+    quint64 m_sequence = struct_replica_detail::unsynced;
+
+    // asked to be caught up, and waiting for it
+    bool m_waiting = false;
+
+    void hello();
+    void read();
+
+protected:
+    StructReplicaBase(quint64 schema, QObject* parent);
+
+    /// Apply one change
+    ///
+    /// \returns False if the change could not be read
+    virtual bool apply(struct_replica_detail::Kind    kind,
+                       struct_replica_detail::FrameReader& in) = 0;
+
+    virtual void begin_apply() = 0;
+    virtual void end_apply()   = 0;
+
+public:
+    virtual ~StructReplicaBase();
+
+    /// Connect to a server by socket name, and catch up with it
+    void connect_to(QString const& name);
+
+    /// Number of the last change applied
+    quint64 sequence() const { return m_sequence; }
+
+    /// Check if the replica holds a copy of the server's model
+    bool synced() const {
+        return m_sequence != struct_replica_detail::unsynced;
+    }
+
+signals:
+    /// The whole model was replaced by a snapshot
+    void resynced();
+
+    /// The connection to the server was lost
+    void disconnected();
+};
+
+///
+/// \brief The StructReplica class keeps a StructTableModel in step with a
+/// StructReplicaServer in another process.
+///
+template <class Record>
+class StructReplica : public StructReplicaBase {
+    using Kind  = struct_replica_detail::Kind;
+    using Codec = struct_replica_detail::MemberCodec<Record>;
+
+    StructTableModel<Record>* m_model;
+
+    // rows as the stream sees them; the model may hold some back in a batch
+    int m_rows = 0;
+
+    bool apply_insert(struct_replica_detail::FrameReader& in) {
+        qint32 row, count;
+        if (!in.read_value(row) or !in.read_value(count)) return false;
+        if (row < 0 or row > m_rows or count <= 0) return false;
+
+        // every record takes at least a byte
+        if (count > in.remaining()) return false;
+
+        QVector<Record> records(count);
+        for (auto& r : records) {
+            if (!Codec::read_record(in, r)) return false;
+        }
+
+        m_model->insert_at(row, std::move(records));
+        m_rows += count;
+        return true;
+    }
+
+    bool apply_remove(struct_replica_detail::FrameReader& in) {
+        qint32 row, count;
+        if (!in.read_value(row) or !in.read_value(count)) return false;
+        if (row < 0 or count <= 0 or row + count > m_rows) return false;
+
+        m_model->remove_at(row, count);
+        m_rows -= count;
+        return true;
+    }
+
+    bool apply_update(struct_replica_detail::FrameReader& in) {
+        qint32 row, count, column, columns;
+        if (!in.read_value(row) or !in.read_value(count) or
+            !in.read_value(column) or !in.read_value(columns)) {
+            return false;
+        }
+
+        if (row < 0 or count <= 0 or row + count > m_rows) return false;
+        if (column < 0 or columns <= 0 or column + columns > Codec::count) {
+            return false;
+        }
+
+        bool ok = true;
+
+        for (int i = row; ok and i < row + count; i++) {
+            m_model->modify(i, [&](Record& r) {
+                for (int c = column; ok and c < column + columns; c++) {
+                    ok = Codec::readers[c](in, r);
+                }
+            });
+        }
+
+        return ok;
+    }
+
+    bool apply_reset(struct_replica_detail::FrameReader& in) {
+        auto records = read_snapshot<Record>(in.rest());
+        if (!records) return false;
+
+        m_rows = records->size();
+        m_model->reset(std::move(*records));
+        return true;
+    }
+
+protected:
+    bool apply(Kind kind, struct_replica_detail::FrameReader& in) override {
+        switch (kind) {
+        case Kind::Insert: return apply_insert(in);
+        case Kind::Remove: return apply_remove(in);
+        case Kind::Update: return apply_update(in);
+        case Kind::Reset: return apply_reset(in);
+        case Kind::Hello: break;
+        }
+        return false;
+    }
+
+    void begin_apply() override { m_model->begin_batch(); }
+    void end_apply() override { m_model->end_batch(); }
+
+public:
+    explicit StructReplica(QObject* parent = nullptr)
+        : StructReplicaBase(snapshot_schema<Record>(), parent),
+          m_model(new StructTableModel<Record>(this)) { }
+
+    /// The replicated model. Changes made to it directly are not sent back,
+    /// and are lost at the next resync.
+    StructTableModel<Record>* model() const { return m_model; }
+};
@@ -0,0 +1,129 @@
+#include "structsnapshot.h"
+
+namespace struct_snapshot_detail {
+
+namespace {
+
+constexpr qsizetype block_alignment = 16;
+constexpr qsizetype write_chunk     = 1 << 16;
+
+quint64 align_up(quint64 v) {
+    return (v + block_alignment - 1) & ~quint64(block_alignment - 1);
+}
+
+} // namespace
+
+Layout plan_layout(qsizetype rows, std::span<qsizetype const> sizes) {
+    Layout ret;
+    ret.offsets.reserve(sizes.size());
+
+    quint64 pos = align_up(sizeof(Header) + sizes.size() * sizeof(quint64));
+
+    for (auto size : sizes) {
+        ret.offsets.push_back(pos);
+        pos = align_up(pos + quint64(rows) * size);
+    }
+
+    ret.pool_offset = pos;
+
+    return ret;
+}
+
+Writer::Writer(QIODevice& device) : m_device(device) {
+    m_buffer.reserve(write_chunk);
+}
+
+void Writer::flush() {
+    if (m_ok and !m_buffer.isEmpty()) {
+        m_ok = m_device.write(m_buffer) == m_buffer.size();
+    }
+    m_buffer.clear();
+}
+
+void Writer::write(void const* data, qsizetype size) {
+    m_buffer.append(static_cast<char const*>(data), size);
+    m_pos += size;
+
+    if (m_buffer.size() >= write_chunk) flush();
+}
+
+void Writer::pad_to(qint64 pos) {
+    Q_ASSERT(pos >= m_pos);
+
+    static constexpr char zeros[block_alignment] = {};
+
+    while (m_pos < pos) {
+        write(zeros, std::min<qint64>(block_alignment, pos - m_pos));
+    }
+}
+
+bool Writer::finish() {
+    flush();
+    return m_ok;
+}
+
+std::optional<View> open_view(QByteArrayView             data,
+                              quint64                    schema,
+                              std::span<qsizetype const> sizes) {
+    Header header;
+
+    if (quint64(data.size()) < sizeof(header)) {
+        qWarning() << "Snapshot is truncated";
+        return std::nullopt;
+    }
+
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        qWarning() << "Not a snapshot";
+        return std::nullopt;
+    }
+
+    if (header.byte_order != byte_order) {
+        qWarning() << "Snapshot was written with another byte order";
+        return std::nullopt;
+    }
+
+    if (header.schema != schema or header.columns != sizes.size()) {
+        qWarning() << "Snapshot schema does not match";
+        return std::nullopt;
+    }
+
+    if (header.rows > quint64(std::numeric_limits<int>::max())) {
+        qWarning() << "Snapshot has too many rows";
+        return std::nullopt;
+    }
+
+    auto const layout = plan_layout(qsizetype(header.rows), sizes);
+
+    quint64 const size = data.size();
+
+    // the pool size is read from the data, so bound it before scaling it
+    if (header.pool_offset != layout.pool_offset or
+        layout.pool_offset > size or
+        header.pool_size > (size - layout.pool_offset) / sizeof(char16_t)) {
+        qWarning() << "Snapshot is truncated";
+        return std::nullopt;
+    }
+
+    View ret;
+    ret.base = reinterpret_cast<uchar const*>(data.data());
+    ret.rows = qsizetype(header.rows);
+    ret.offsets.resize(sizes.size());
+
+    std::memcpy(ret.offsets.data(),
+                ret.base + sizeof(header),
+                sizes.size() * sizeof(quint64));
+
+    if (ret.offsets != layout.offsets) {
+        qWarning() << "Snapshot column table is damaged";
+        return std::nullopt;
+    }
+
+    ret.pool       = ret.base + layout.pool_offset;
+    ret.pool_units = header.pool_size;
+
+    return ret;
+}
+
+} // namespace struct_snapshot_detail
@@ -0,0 +1,419 @@
+#pragma once
+
+#include "structmodel.h"
+#include "type_name.h"
+
+#include <QByteArrayView>
+#include <QFile>
+#include <QIODevice>
+#include <QSaveFile>
+
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace struct_snapshot_detail {
+
+// File layout, all in host byte order:
+//
+//   Header
+//   quint64 offset of each column
+//   column blocks, each 16 byte aligned
+//   string pool, UTF-16
+//
+// A fixed size column is a plain array of the member type. A string column is
+// an array of StringRef into the pool.
+
+struct Header {
+    char    magic[8];
+    quint32 byte_order;
+    quint32 columns;
+    quint64 schema;
+    quint64 rows;
+    quint64 pool_offset;
+    quint64 pool_size; // in UTF-16 units
+};
+
+struct StringRef {
+    quint32 offset; // in UTF-16 units
+    quint32 size;
+};
+
+inline constexpr char magic[8] = { 'S', 'M', 'S', 'N', 'A', 'P', '0', '1' };
+
+inline constexpr quint32 byte_order = 0x01020304;
+
+enum class Kind : quint8 {
+    String,
+    Bool,
+    Signed,
+    Unsigned,
+    Float,
+    Enum,
+    Blob,
+};
+
+template <class T>
+constexpr bool is_storable = std::is_same_v<T, QString> or
+                             (std::is_trivially_copyable_v<T> and
+                              !std::is_pointer_v<T>);
+
+template <class T>
+constexpr Kind kind_of() {
+    if constexpr (std::is_same_v<T, QString>) return Kind::String;
+    else if constexpr (std::is_same_v<T, bool>) return Kind::Bool;
+    else if constexpr (std::is_enum_v<T>) return Kind::Enum;
+    else if constexpr (std::is_floating_point_v<T>) return Kind::Float;
+    else if constexpr (std::is_signed_v<T>) return Kind::Signed;
+    else if constexpr (std::is_unsigned_v<T>) return Kind::Unsigned;
+    else return Kind::Blob;
+}
+
+template <class Record, class M>
+using value_t = std::remove_cvref_t<decltype(std::declval<M const&>().get(
+    std::declval<Record const&>()))>;
+
+template <class T>
+constexpr qsizetype element_size() {
+    if constexpr (std::is_same_v<T, QString>) {
+        return sizeof(StringRef);
+    } else {
+        return sizeof(T);
+    }
+}
+
+constexpr quint64 fnv1a(quint64 h, std::string_view s) {
+    for (char c : s) {
+        h ^= static_cast<quint8>(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+constexpr quint64 fnv1a(quint64 h, quint64 v) {
+    for (int i = 0; i < 8; i++) {
+        h ^= (v >> (i * 8)) & 0xff;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+template <class Record, class M>
+constexpr quint64 mix_column(quint64 h, M const& m) {
+    using T = value_t<Record, M>;
+
+    static_assert(is_storable<T>,
+                  "Snapshots only support QString and trivially copyable "
+                  "members");
+
+    h = fnv1a(h, std::string_view(m.name));
+    h = fnv1a(h, static_cast<quint64>(kind_of<T>()));
+    h = fnv1a(h, static_cast<quint64>(sizeof(T)));
+
+    // plain structs change layout without changing size
+    if constexpr (kind_of<T>() == Kind::Blob) h = fnv1a(h, type_name<T>());
+
+    return h;
+}
+
+template <class Record>
+constexpr quint64 schema_hash() {
+    quint64 h = 0xcbf29ce484222325ull;
+    std::apply(
+        [&h](auto const&... m) { (..., (h = mix_column<Record>(h, m))); },
+        Record::meta);
+    return h;
+}
+
+template <class Record, class M>
+constexpr qsizetype meta_element_size(M const&) {
+    return element_size<value_t<Record, M>>();
+}
+
+template <class Record>
+auto element_sizes() {
+    return std::apply(
+        [](auto const&... m) {
+            return std::array<qsizetype, sizeof...(m)> {
+                meta_element_size<Record>(m)...
+            };
+        },
+        Record::meta);
+}
+
+/// Where everything goes for a given number of rows
+struct Layout {
+    std::vector<quint64> offsets;
+    quint64              pool_offset;
+};
+
+Layout plan_layout(qsizetype rows, std::span<qsizetype const> sizes);
+
+/// Buffers writes to a device, remembering if any failed
+class Writer {
+    QIODevice& m_device;
+    QByteArray m_buffer;
+    qint64     m_pos = 0;
+    bool       m_ok  = true;
+
+    void flush();
+
+public:
+    explicit Writer(QIODevice& device);
+
+    void write(void const* data, qsizetype size);
+
+    template <class T>
+    void write_value(T const& value) {
+        write(&value, sizeof(T));
+    }
+
+    /// Write zeros up to an absolute position
+    void pad_to(qint64 pos);
+
+    /// \returns False if any write failed
+    bool finish();
+};
+
+/// A validated snapshot in memory
+struct View {
+    uchar const*         base = nullptr;
+    qsizetype            rows = 0;
+    std::vector<quint64> offsets;
+    uchar const*         pool       = nullptr;
+    quint64              pool_units = 0;
+
+    uchar const* column(int i) const { return base + offsets[i]; }
+};
+
+/// Check a snapshot against the expected schema, and that every block lies
+/// within the data
+std::optional<View> open_view(QByteArrayView             data,
+                              quint64                    schema,
+                              std::span<qsizetype const> sizes);
+
+template <class Record, class M>
+bool read_column(M const& m, View const& view, int i, QVector<Record>& out) {
+    using T = value_t<Record, M>;
+
+    // custom entries without a setter are derived from other members; they
+    // are still written, for other readers of the file
+    if constexpr (requires { m.setter; }) {
+        if (!m.setter) return true;
+    }
+
+    uchar const* src = view.column(i);
+
+    for (qsizetype row = 0; row < out.size(); row++) {
+        if constexpr (std::is_same_v<T, QString>) {
+            StringRef ref;
+            std::memcpy(&ref, src + row * sizeof(ref), sizeof(ref));
+
+            if (quint64(ref.offset) + ref.size > view.pool_units) return false;
+
+            QString s(ref.size, Qt::Uninitialized);
+            std::memcpy(s.data(),
+                        view.pool + quint64(ref.offset) * sizeof(char16_t),
+                        ref.size * sizeof(char16_t));
+            m.set(out[row], std::move(s));
+        } else if constexpr (std::is_same_v<T, bool>) {
+            // a stray byte would not be a valid bool
+            m.set(out[row], src[row] != 0);
+        } else {
+            T value;
+            std::memcpy(&value, src + row * sizeof(T), sizeof(T));
+            m.set(out[row], std::move(value));
+        }
+    }
+
+    return true;
+}
+
+template <class Record, class At>
+bool write_snapshot(qsizetype rows, At&& at, QIODevice& device) {
+    constexpr auto count = std::tuple_size_v<decltype(Record::meta)>;
+
+    auto const sizes  = element_sizes<Record>();
+    auto const layout = plan_layout(rows, sizes);
+
+    // strings go out after the columns, so gather them first
+    QString                                   pool;
+    std::array<std::vector<StringRef>, count> refs;
+
+    constexpr auto pool_limit = std::numeric_limits<quint32>::max();
+
+    bool fits = true;
+
+    int i = 0;
+    struct_model_detail::tuple_for_each(Record::meta, [&](auto const& m) {
+        using T = value_t<Record, std::remove_cvref_t<decltype(m)>>;
+
+        if constexpr (std::is_same_v<T, QString>) {
+            refs[i].reserve(rows);
+            for (qsizetype row = 0; row < rows; row++) {
+                auto const& s = m.get(at(row));
+                if (pool.size() + s.size() > pool_limit) fits = false;
+                refs[i].push_back({ quint32(pool.size()), quint32(s.size()) });
+                pool += s;
+            }
+        }
+        i++;
+    });
+
+    if (!fits) {
+        qWarning() << "Snapshot string pool is too large";
+        return false;
+    }
+
+    Header header {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.byte_order  = byte_order;
+    header.columns     = count;
+    header.schema      = schema_hash<Record>();
+    header.rows        = rows;
+    header.pool_offset = layout.pool_offset;
+    header.pool_size   = pool.size();
+
+    Writer out(device);
+
+    out.write_value(header);
+    out.write(layout.offsets.data(), layout.offsets.size() * sizeof(quint64));
+
+    i = 0;
+    struct_model_detail::tuple_for_each(Record::meta, [&](auto const& m) {
+        using T = value_t<Record, std::remove_cvref_t<decltype(m)>>;
+
+        out.pad_to(layout.offsets[i]);
+
+        if constexpr (std::is_same_v<T, QString>) {
+            out.write(refs[i].data(), refs[i].size() * sizeof(StringRef));
+        } else {
+            for (qsizetype row = 0; row < rows; row++) {
+                out.write_value<T>(m.get(at(row)));
+            }
+        }
+        i++;
+    });
+
+    out.pad_to(layout.pool_offset);
+    out.write(pool.constData(), pool.size() * sizeof(char16_t));
+
+    return out.finish();
+}
+
+} // namespace struct_snapshot_detail
+
+///
+/// \brief The schema hash a snapshot of Record is tagged with.
+///
+/// This covers the name, kind and size of every member in Record::meta, so
+/// adding, removing, renaming, reordering or retyping a member invalidates
+/// older snapshots.
+///
+template <class Record>
+constexpr quint64 snapshot_schema() {
+    return struct_snapshot_detail::schema_hash<Record>();
+}
+
+/// Write the records of a model to a device as a binary snapshot. Members must
+/// be QString or trivially copyable.
+///
+/// Snapshots are meant as a local cache: they are in host byte order, and are
+/// refused on a machine with the other order.
+///
+/// \returns False if writing failed
+template <class Record>
+bool save_snapshot(StructTableModel<Record> const& model, QIODevice& device) {
+    return struct_snapshot_detail::write_snapshot<Record>(
+        model.rowCount(),
+        [&model](qsizetype row) -> Record const& {
+            return *model.get_at(row);
+        },
+        device);
+}
+
+/// Write a snapshot to a file. The file is only replaced once the snapshot is
+/// complete.
+template <class Record>
+bool save_snapshot(StructTableModel<Record> const& model, QString const& path) {
+    QSaveFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to open snapshot for writing" << path;
+        return false;
+    }
+
+    if (!save_snapshot(model, file)) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+/// Read records from a snapshot already in memory, such as a mapped file.
+/// Each column is copied out with one pass over its array; nothing goes
+/// through QVariant.
+///
+/// \returns Nothing if the snapshot is damaged or has a different schema
+template <class Record>
+std::optional<QVector<Record>> read_snapshot(QByteArrayView data) {
+    using namespace struct_snapshot_detail;
+
+    auto const sizes = element_sizes<Record>();
+    auto const view  = open_view(data, schema_hash<Record>(), sizes);
+
+    if (!view) return std::nullopt;
+
+    QVector<Record> ret(view->rows);
+
+    bool ok = true;
+    int  i  = 0;
+
+    struct_model_detail::tuple_for_each(Record::meta, [&](auto const& m) {
+        if (ok) ok = read_column(m, *view, i, ret);
+        i++;
+    });
+
+    if (!ok) {
+        qWarning() << "Snapshot has a string outside of its pool";
+        return std::nullopt;
+    }
+
+    return ret;
+}
+
+/// Replace the contents of a model with a snapshot file. The file is mapped,
+/// not read. Views see a single reset.
+///
+/// \returns False if the file is missing, damaged, or has a different schema.
+/// The model is left alone in that case.
+template <class Record>
+bool load_snapshot(StructTableModel<Record>& model, QString const& path) {
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    auto const size = file.size();
+
+    if (size <= 0) return false;
+
+    uchar* mapped = file.map(0, size);
+
+    if (!mapped) {
+        qWarning() << "Unable to map snapshot" << path;
+        return false;
+    }
+
+    auto records = read_snapshot<Record>(QByteArrayView(mapped, size));
+
+    file.unmap(mapped);
+
+    if (!records) return false;
+
+    model.reset(std::move(*records));
+    return true;
+}
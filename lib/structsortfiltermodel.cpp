@@ -0,0 +1,71 @@
+#include "structsortfiltermodel.h"
+
+StructSortFilterModelBase::~StructSortFilterModelBase() = default;
+
+void StructSortFilterModelBase::rebuild_source_map() {
+    int const count = sourceModel() ? sourceModel()->rowCount() : 0;
+
+    m_source_to_proxy.fill(-1, count);
+
+    for (int p = 0; p < m_proxy_to_source.size(); p++) {
+        int s = m_proxy_to_source[p];
+        if (s >= 0 and s < count) m_source_to_proxy[s] = p;
+    }
+}
+
+QModelIndex StructSortFilterModelBase::index(int                row,
+                                             int                column,
+                                             QModelIndex const& parent) const {
+    if (parent.isValid()) return {};
+    if (row < 0 or row >= m_proxy_to_source.size()) return {};
+    if (column < 0 or column >= columnCount()) return {};
+
+    return createIndex(row, column);
+}
+
+QModelIndex StructSortFilterModelBase::parent(QModelIndex const&) const {
+    return {};
+}
+
+QModelIndex StructSortFilterModelBase::sibling(int row,
+                                               int column,
+                                               QModelIndex const&) const {
+    return index(row, column);
+}
+
+bool StructSortFilterModelBase::hasChildren(QModelIndex const& parent) const {
+    if (parent.isValid()) return false;
+    return !m_proxy_to_source.isEmpty();
+}
+
+int StructSortFilterModelBase::rowCount(QModelIndex const& parent) const {
+    if (parent.isValid()) return 0;
+    return m_proxy_to_source.size();
+}
+
+int StructSortFilterModelBase::columnCount(QModelIndex const& parent) const {
+    if (parent.isValid() or !sourceModel()) return 0;
+    return sourceModel()->columnCount();
+}
+
+QModelIndex
+StructSortFilterModelBase::mapToSource(QModelIndex const& proxy_index) const {
+    if (!proxy_index.isValid() or !sourceModel()) return {};
+
+    int row = m_proxy_to_source.value(proxy_index.row(), -1);
+
+    if (row < 0) return {};
+
+    return sourceModel()->index(row, proxy_index.column());
+}
+
+QModelIndex StructSortFilterModelBase::mapFromSource(
+    QModelIndex const& source_index) const {
+    if (!source_index.isValid()) return {};
+
+    int row = m_source_to_proxy.value(source_index.row(), -1);
+
+    if (row < 0) return {};
+
+    return createIndex(row, source_index.column());
+}
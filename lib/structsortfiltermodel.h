@@ -0,0 +1,559 @@
+#pragma once
+
+#include "structmodel.h"
+
+#include <QAbstractProxyModel>
+#include <QPersistentModelIndex>
+#include <QPointer>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+class StructSortFilterModelBase : public QAbstractProxyModel {
+    Q_OBJECT
+protected:
+    // proxy row -> source row
+    QVector<int> m_proxy_to_source;
+    // source row -> proxy row, or -1 if filtered out
+    QVector<int> m_source_to_proxy;
+
+    int           m_sort_column = -1;
+    Qt::SortOrder m_sort_order  = Qt::AscendingOrder;
+
+    /// Recompute the source to proxy mapping from the proxy to source mapping
+    void rebuild_source_map();
+
+public:
+    using QAbstractProxyModel::QAbstractProxyModel;
+    virtual ~StructSortFilterModelBase();
+
+    QModelIndex index(int                row,
+                      int                column,
+                      QModelIndex const& parent = QModelIndex()) const override;
+    QModelIndex parent(QModelIndex const& child) const override;
+    QModelIndex
+    sibling(int row, int column, QModelIndex const& idx) const override;
+
+    bool hasChildren(QModelIndex const& parent = QModelIndex()) const override;
+
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override;
+    int columnCount(QModelIndex const& parent = QModelIndex()) const override;
+
+    QModelIndex mapToSource(QModelIndex const& proxy_index) const override;
+    QModelIndex mapFromSource(QModelIndex const& source_index) const override;
+
+    int           sort_column() const { return m_sort_column; }
+    Qt::SortOrder sort_order() const { return m_sort_order; }
+};
+
+///
+/// \brief The StructSortFilterModel class sorts and filters a StructTableModel
+/// by comparing record members directly, without going through QVariant.
+///
+/// Source inserts, removes and data changes are folded into the existing
+/// mapping instead of sorting everything again.
+///
+template <class Record>
+class StructSortFilterModel : public StructSortFilterModelBase {
+public:
+    using Filter = std::function<bool(Record const&)>;
+
+private:
+    using Table  = struct_model_detail::ColumnTable<Record>;
+    using Source = StructTableModel<Record>;
+
+    QPointer<Source> m_source;
+    Filter           m_filter;
+
+    QList<QMetaObject::Connection> m_connections;
+
+    // source indexes for persistent indexes, held over a source layout change
+    QModelIndexList              m_layout_from;
+    QList<QPersistentModelIndex> m_layout_sources;
+
+    Record const& record(int source_row) const {
+        return *m_source->get_at(source_row);
+    }
+
+    bool accepts(int source_row) const {
+        return !m_filter or m_filter(record(source_row));
+    }
+
+    /// Ordering of source rows. Ties fall back to the source order, so the
+    /// sort is stable.
+    bool less(int a, int b) const {
+        if (Table::in_range(m_sort_column)) {
+            auto const& ra = record(a);
+            auto const& rb = record(b);
+            auto const  f  = Table::less[m_sort_column];
+
+            bool const asc = m_sort_order == Qt::AscendingOrder;
+
+            if (asc ? f(ra, rb) : f(rb, ra)) return true;
+            if (asc ? f(rb, ra) : f(ra, rb)) return false;
+        }
+        return a < b;
+    }
+
+    auto less_fn() const {
+        return [this](int a, int b) { return less(a, b); };
+    }
+
+    void sort_mapping() {
+        if (Table::in_range(m_sort_column)) {
+            std::sort(
+                m_proxy_to_source.begin(), m_proxy_to_source.end(), less_fn());
+        } else {
+            std::sort(m_proxy_to_source.begin(), m_proxy_to_source.end());
+        }
+
+        rebuild_source_map();
+    }
+
+    void build() {
+        m_proxy_to_source.clear();
+
+        if (m_source) {
+            int const count = m_source->rowCount();
+
+            m_proxy_to_source.reserve(count);
+
+            for (int i = 0; i < count; i++) {
+                if (accepts(i)) m_proxy_to_source << i;
+            }
+        }
+
+        sort_mapping();
+    }
+
+    /// Reorder the mapping with reorder() as a layout change, carrying
+    /// persistent indexes along
+    template <class Reorder>
+    void relayout_with(Reorder&& reorder) {
+        emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+        auto         from = persistentIndexList();
+        QVector<int> sources;
+        sources.reserve(from.size());
+        for (auto const& idx : from) {
+            sources << m_proxy_to_source.value(idx.row(), -1);
+        }
+
+        reorder();
+
+        QModelIndexList to;
+        to.reserve(from.size());
+        for (int i = 0; i < from.size(); i++) {
+            int row = sources[i] < 0 ? -1 : m_source_to_proxy[sources[i]];
+            to << (row < 0 ? QModelIndex() : index(row, from[i].column()));
+        }
+        changePersistentIndexList(from, to);
+
+        emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+    }
+
+    /// Re-sort the rows shown as a layout change
+    void relayout() {
+        relayout_with([this]() { sort_mapping(); });
+    }
+
+    /// Put source rows whose sort keys changed back in order, as one layout
+    /// change. The other rows are still sorted among themselves, so the moved
+    /// rows are taken out and merged back in.
+    void reposition(QVector<int> moved) {
+        std::sort(moved.begin(), moved.end(), less_fn());
+
+        relayout_with([&]() {
+            std::vector<bool> taken(m_proxy_to_source.size());
+            for (int s : moved) {
+                taken[m_source_to_proxy[s]] = true;
+            }
+
+            QVector<int> kept;
+            kept.reserve(m_proxy_to_source.size() - moved.size());
+            for (int p = 0; p < m_proxy_to_source.size(); p++) {
+                if (!taken[p]) kept << m_proxy_to_source[p];
+            }
+
+            std::merge(kept.cbegin(),
+                       kept.cend(),
+                       moved.cbegin(),
+                       moved.cend(),
+                       m_proxy_to_source.begin(),
+                       less_fn());
+
+            rebuild_source_map();
+        });
+    }
+
+    /// Remove proxy rows, given in ascending order
+    void remove_proxy_rows(QVector<int> const& rows) {
+        if (rows.isEmpty()) return;
+
+        auto runs = struct_model_detail::rows_to_runs(rows);
+
+        // back to front, so earlier rows keep their positions
+        for (auto iter = runs.rbegin(); iter != runs.rend(); ++iter) {
+            beginRemoveRows({}, iter->start, iter->start + iter->count - 1);
+            m_proxy_to_source.remove(iter->start, iter->count);
+            endRemoveRows();
+        }
+
+        rebuild_source_map();
+    }
+
+    /// Insert source rows that are not yet mapped
+    void insert_source_rows(QVector<int> rows) {
+        if (rows.isEmpty()) return;
+
+        std::sort(rows.begin(), rows.end(), less_fn());
+
+        // find where each new row lands in the merged result
+        QVector<int> final_rows;
+        final_rows.reserve(rows.size());
+
+        auto lower = m_proxy_to_source.cbegin();
+        for (int i = 0; i < rows.size(); i++) {
+            lower = std::lower_bound(
+                lower, m_proxy_to_source.cend(), rows[i], less_fn());
+            final_rows << int(lower - m_proxy_to_source.cbegin()) + i;
+        }
+
+        auto runs = struct_model_detail::rows_to_runs(final_rows);
+
+        int taken = 0;
+        for (auto const& run : runs) {
+            QVector<int> part(rows.begin() + taken,
+                              rows.begin() + taken + run.count);
+            taken += run.count;
+
+            beginInsertRows({}, run.start, run.start + run.count - 1);
+            struct_model_detail::move_insert(
+                m_proxy_to_source, run.start, std::move(part));
+            endInsertRows();
+        }
+
+        rebuild_source_map();
+    }
+
+    /// Move a proxy row to where it belongs after its sort key changed. Every
+    /// other row must be in order.
+    void fix_position(int row) {
+        int const source = m_proxy_to_source[row];
+        auto      begin  = m_proxy_to_source.cbegin();
+        auto      end    = m_proxy_to_source.cend();
+
+        int dest = row;
+
+        if (row > 0 and less(source, m_proxy_to_source[row - 1])) {
+            dest = std::upper_bound(begin, begin + row, source, less_fn()) -
+                   begin;
+        } else if (row + 1 < m_proxy_to_source.size() and
+                   less(m_proxy_to_source[row + 1], source)) {
+            dest = std::lower_bound(begin + row + 1, end, source, less_fn()) -
+                   begin;
+        }
+
+        if (dest == row or dest == row + 1) return;
+
+        auto first = m_proxy_to_source.begin();
+
+        beginMoveRows({}, row, row, {}, dest);
+        if (dest > row) {
+            std::rotate(first + row, first + row + 1, first + dest);
+        } else {
+            std::rotate(first + dest, first + row, first + row + 1);
+        }
+        rebuild_source_map();
+        endMoveRows();
+    }
+
+    bool sort_affected(int left, int right, QList<int> const& roles) const {
+        if (!Table::in_range(m_sort_column)) return false;
+
+        bool const in_columns =
+            m_sort_column >= left and m_sort_column <= right;
+
+        if (roles.isEmpty()) return in_columns;
+
+        // data roles name the member directly, whatever the column
+        if (roles.contains(Qt::UserRole + m_sort_column)) return true;
+
+        return in_columns and (roles.contains(Qt::DisplayRole) or
+                               roles.contains(Qt::EditRole));
+    }
+
+    void on_rows_inserted(QModelIndex const& parent, int first, int last) {
+        if (parent.isValid()) return;
+
+        int const count = last - first + 1;
+
+        for (auto& s : m_proxy_to_source) {
+            if (s >= first) s += count;
+        }
+
+        rebuild_source_map();
+
+        QVector<int> added;
+        for (int i = first; i <= last; i++) {
+            if (accepts(i)) added << i;
+        }
+
+        insert_source_rows(std::move(added));
+    }
+
+    void on_rows_about_to_be_removed(QModelIndex const& parent,
+                                     int                first,
+                                     int                last) {
+        if (parent.isValid()) return;
+
+        QVector<int> rows;
+        for (int i = first; i <= last; i++) {
+            int p = m_source_to_proxy.value(i, -1);
+            if (p >= 0) rows << p;
+        }
+
+        std::sort(rows.begin(), rows.end());
+
+        remove_proxy_rows(rows);
+    }
+
+    void on_rows_removed(QModelIndex const& parent, int first, int last) {
+        if (parent.isValid()) return;
+
+        int const count = last - first + 1;
+
+        for (auto& s : m_proxy_to_source) {
+            if (s > last) s -= count;
+        }
+
+        rebuild_source_map();
+    }
+
+    void on_data_changed(QModelIndex const& top_left,
+                         QModelIndex const& bottom_right,
+                         QList<int> const&  roles) {
+        if (!top_left.isValid() or top_left.parent().isValid()) return;
+
+        int const first = top_left.row();
+        int const last  = bottom_right.row();
+
+        QVector<int> gone;
+        QVector<int> added;
+
+        for (int i = first; i <= last; i++) {
+            bool const present = m_source_to_proxy.value(i, -1) >= 0;
+            bool const wanted  = accepts(i);
+
+            if (present and !wanted) gone << m_source_to_proxy[i];
+            if (!present and wanted) added << i;
+        }
+
+        std::sort(gone.begin(), gone.end());
+        remove_proxy_rows(gone);
+
+        // past a handful of rows, one sort beats moving rows one at a time
+        static constexpr int max_row_moves = 32;
+
+        if (sort_affected(top_left.column(), bottom_right.column(), roles)) {
+            if (last - first + 1 > max_row_moves) {
+                relayout();
+            } else {
+                QVector<int> moved;
+                for (int i = first; i <= last; i++) {
+                    if (m_source_to_proxy.value(i, -1) >= 0) moved << i;
+                }
+
+                // rows searched against must be in order, which only holds
+                // when a single row changed
+                if (moved.size() == 1) {
+                    fix_position(m_source_to_proxy[moved[0]]);
+                } else if (moved.size() > 1) {
+                    reposition(std::move(moved));
+                }
+            }
+        }
+
+        // forward the change for rows that were already here
+        QVector<int> changed;
+        for (int i = first; i <= last; i++) {
+            if (m_source_to_proxy.value(i, -1) >= 0) changed << i;
+        }
+
+        insert_source_rows(std::move(added));
+
+        for (auto& row : changed) {
+            row = m_source_to_proxy[row];
+        }
+
+        std::sort(changed.begin(), changed.end());
+
+        for (auto const& run : struct_model_detail::rows_to_runs(changed)) {
+            emit dataChanged(index(run.start, top_left.column()),
+                             index(run.start + run.count - 1,
+                                   bottom_right.column()),
+                             roles);
+        }
+    }
+
+    void on_layout_about_to_be_changed() {
+        emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+        m_layout_from = persistentIndexList();
+        m_layout_sources.clear();
+        m_layout_sources.reserve(m_layout_from.size());
+        for (auto const& idx : m_layout_from) {
+            m_layout_sources << QPersistentModelIndex(mapToSource(idx));
+        }
+    }
+
+    void on_layout_changed() {
+        build();
+
+        QModelIndexList to;
+        to.reserve(m_layout_from.size());
+        for (auto const& src : m_layout_sources) {
+            to << mapFromSource(src);
+        }
+        changePersistentIndexList(m_layout_from, to);
+
+        m_layout_from.clear();
+        m_layout_sources.clear();
+
+        emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+    }
+
+    void disconnect_source() {
+        for (auto const& c : m_connections) {
+            disconnect(c);
+        }
+        m_connections.clear();
+    }
+
+    void connect_source() {
+        auto* s = m_source.data();
+
+        auto on_inserted = [this](QModelIndex const& p, int f, int l) {
+            on_rows_inserted(p, f, l);
+        };
+        auto on_about_to_remove = [this](QModelIndex const& p, int f, int l) {
+            on_rows_about_to_be_removed(p, f, l);
+        };
+        auto on_removed = [this](QModelIndex const& p, int f, int l) {
+            on_rows_removed(p, f, l);
+        };
+        auto on_changed = [this](QModelIndex const& tl,
+                                 QModelIndex const& br,
+                                 QList<int> const&  roles) {
+            on_data_changed(tl, br, roles);
+        };
+        auto on_about_to_layout = [this]() { on_layout_about_to_be_changed(); };
+        auto on_layout          = [this]() { on_layout_changed(); };
+        auto on_about_to_reset  = [this]() { beginResetModel(); };
+        auto on_reset           = [this]() {
+            build();
+            endResetModel();
+        };
+
+        m_connections = {
+            connect(s, &Source::rowsInserted, this, on_inserted),
+            connect(s, &Source::rowsAboutToBeRemoved, this, on_about_to_remove),
+            connect(s, &Source::rowsRemoved, this, on_removed),
+            connect(s, &Source::dataChanged, this, on_changed),
+            connect(
+                s, &Source::layoutAboutToBeChanged, this, on_about_to_layout),
+            connect(s, &Source::layoutChanged, this, on_layout),
+            // moves change source rows but not what is shown; treat them as a
+            // layout change
+            connect(s, &Source::rowsAboutToBeMoved, this, on_about_to_layout),
+            connect(s, &Source::rowsMoved, this, on_layout),
+            connect(s, &Source::modelAboutToBeReset, this, on_about_to_reset),
+            connect(s, &Source::modelReset, this, on_reset),
+        };
+    }
+
+public:
+    explicit StructSortFilterModel(QObject* parent = nullptr)
+        : StructSortFilterModelBase(parent) { }
+
+    explicit StructSortFilterModel(Source* source, QObject* parent = nullptr)
+        : StructSortFilterModelBase(parent) {
+        set_source(source);
+    }
+
+    ~StructSortFilterModel() { disconnect_source(); }
+
+    void set_source(Source* source) {
+        beginResetModel();
+
+        disconnect_source();
+
+        m_source = source;
+
+        QAbstractProxyModel::setSourceModel(source);
+
+        if (m_source) connect_source();
+
+        build();
+
+        endResetModel();
+    }
+
+    /// Only StructTableModels of the same record type can be used as a source
+    void setSourceModel(QAbstractItemModel* source) override {
+        auto* typed = dynamic_cast<Source*>(source);
+
+        if (source and !typed) {
+            qWarning() << "StructSortFilterModel needs a StructTableModel of "
+                          "the same record type";
+        }
+
+        set_source(typed);
+    }
+
+    Source* source() const { return m_source; }
+
+    /// Sort by a column, comparing the record members directly. A column of
+    /// -1 restores the source order.
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override {
+        if (column == m_sort_column and order == m_sort_order) return;
+
+        m_sort_column = column;
+        m_sort_order  = order;
+
+        relayout();
+    }
+
+    /// Set a predicate that decides which records are shown
+    void set_filter(Filter f) {
+        m_filter = std::move(f);
+        invalidate_filter();
+    }
+
+    /// Re-apply the filter, for when the predicate depends on outside state
+    /// that changed
+    void invalidate_filter() {
+        if (!m_source) return;
+
+        QVector<int> gone;
+        for (int p = 0; p < m_proxy_to_source.size(); p++) {
+            if (!accepts(m_proxy_to_source[p])) gone << p;
+        }
+
+        remove_proxy_rows(gone);
+
+        QVector<int> added;
+        for (int i = 0; i < m_source->rowCount(); i++) {
+            if (m_source_to_proxy[i] < 0 and accepts(i)) added << i;
+        }
+
+        insert_source_rows(std::move(added));
+    }
+
+    /// Obtain the record shown at a proxy row
+    Record const* get_at(int row) const {
+        if (!m_source) return nullptr;
+        return m_source->get_at(m_proxy_to_source.value(row, -1));
+    }
+};
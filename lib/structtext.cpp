@@ -0,0 +1,559 @@
+#include "structtext.h"
+
+#include <QThread>
+
+#include <algorithm>
+
+namespace struct_text_detail {
+
+namespace {
+
+// chunks are at least this large, so small files are not split at all
+constexpr std::size_t min_chunk = 1 << 20;
+
+int chunk_count(std::size_t size) {
+    auto const most = std::max(QThread::idealThreadCount(), 1) * 4;
+    return int(std::clamp<std::size_t>(size / min_chunk, 1, most));
+}
+
+// nominal start of a chunk, before it is moved to the next record
+std::size_t nominal(std::size_t size, int count, int k) {
+    return size * k / count;
+}
+
+bool is_space(char c) {
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+}
+
+// a quote after an odd run of backslashes is part of a JSON string
+bool is_escaped(std::string_view data, std::size_t pos) {
+    std::size_t run = 0;
+    while (pos > run and data[pos - run - 1] == '\\') {
+        run++;
+    }
+    return run % 2 == 1;
+}
+
+bool needs_csv_quotes(QByteArray const& utf8) {
+    for (char c : utf8) {
+        if (c == ',' or c == '"' or c == '\n' or c == '\r') return true;
+    }
+    return false;
+}
+
+void append_utf8(std::string& out, char32_t c) {
+    if (c < 0x80) {
+        out += char(c);
+    } else if (c < 0x800) {
+        out += char(0xc0 | (c >> 6));
+        out += char(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += char(0xe0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    } else {
+        out += char(0xf0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3f));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    }
+}
+
+bool parse_hex4(std::string_view text, char32_t& out) {
+    if (text.size() < 4) return false;
+
+    out = 0;
+    for (char c : text.substr(0, 4)) {
+        out <<= 4;
+        if (c >= '0' and c <= '9') out |= c - '0';
+        else if (c >= 'a' and c <= 'f') out |= c - 'a' + 10;
+        else if (c >= 'A' and c <= 'F') out |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+} // namespace
+
+void append_csv_string(QByteArray& out, QString const& s) {
+    auto const utf8 = s.toUtf8();
+
+    if (!needs_csv_quotes(utf8)) {
+        out.append(utf8);
+        return;
+    }
+
+    out.append('"');
+    for (char c : utf8) {
+        if (c == '"') out.append('"');
+        out.append(c);
+    }
+    out.append('"');
+}
+
+void append_json_string(QByteArray& out, QString const& s) {
+    static constexpr char hex[] = "0123456789abcdef";
+
+    out.append('"');
+
+    for (char c : s.toUtf8()) {
+        switch (c) {
+        case '"': out.append("\\\"", 2); break;
+        case '\\': out.append("\\\\", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        default:
+            if (uchar(c) < 0x20) {
+                char const escape[] = {
+                    '\\', 'u', '0', '0', hex[uchar(c) >> 4], hex[c & 0xf]
+                };
+                out.append(escape, sizeof(escape));
+            } else {
+                out.append(c);
+            }
+        }
+    }
+
+    out.append('"');
+}
+
+bool CsvReader::read_row(std::vector<std::string_view>& fields) {
+    fields.clear();
+    m_scratch.clear();
+
+    if (at_end()) return false;
+
+    while (true) {
+        std::string_view field;
+
+        if (m_data[m_pos] == '"') {
+            std::size_t start = ++m_pos;
+            std::string* unescaped = nullptr;
+
+            while (true) {
+                auto const quote = m_data.find('"', m_pos);
+                if (quote == std::string_view::npos) return false;
+
+                // a doubled quote stands for one
+                if (quote + 1 < m_data.size() and m_data[quote + 1] == '"') {
+                    if (!unescaped) unescaped = &m_scratch.emplace_back();
+                    unescaped->append(m_data.substr(start, quote + 1 - start));
+                    m_pos = start = quote + 2;
+                    continue;
+                }
+
+                if (unescaped) {
+                    unescaped->append(m_data.substr(start, quote - start));
+                    field = *unescaped;
+                } else {
+                    field = m_data.substr(start, quote - start);
+                }
+
+                m_pos = quote + 1;
+                break;
+            }
+        } else {
+            auto end = m_data.find_first_of(",\n", m_pos);
+            if (end == std::string_view::npos) end = m_data.size();
+
+            field = m_data.substr(m_pos, end - m_pos);
+            m_pos = end;
+
+            if (!field.empty() and field.back() == '\r') {
+                field.remove_suffix(1);
+            }
+        }
+
+        fields.push_back(field);
+
+        if (at_end()) return true;
+
+        switch (m_data[m_pos]) {
+        case ',':
+            m_pos++;
+            if (at_end()) {
+                fields.emplace_back();
+                return true;
+            }
+            continue;
+        case '\r':
+            if (m_pos + 1 < m_data.size() and m_data[m_pos + 1] == '\n') {
+                m_pos += 2;
+                return true;
+            }
+            return false;
+        case '\n': m_pos++; return true;
+        default:
+            // text after a closing quote
+            return false;
+        }
+    }
+}
+
+void JsonReader::skip_space() {
+    while (m_pos < m_data.size() and is_space(m_data[m_pos])) {
+        m_pos++;
+    }
+}
+
+bool JsonReader::read_string(std::string_view& out) {
+    if (m_pos >= m_data.size() or m_data[m_pos] != '"') return false;
+
+    std::size_t  start     = ++m_pos;
+    std::string* unescaped = nullptr;
+
+    while (true) {
+        auto const stop = m_data.find_first_of("\"\\", m_pos);
+        if (stop == std::string_view::npos) return false;
+
+        if (m_data[stop] == '"') {
+            if (unescaped) {
+                unescaped->append(m_data.substr(start, stop - start));
+                out = *unescaped;
+            } else {
+                out = m_data.substr(start, stop - start);
+            }
+            m_pos = stop + 1;
+            return true;
+        }
+
+        if (!unescaped) unescaped = &m_scratch.emplace_back();
+        unescaped->append(m_data.substr(start, stop - start));
+
+        if (stop + 1 >= m_data.size()) return false;
+
+        char const c = m_data[stop + 1];
+        m_pos        = stop + 2;
+
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/': *unescaped += c; break;
+        case 'b': *unescaped += '\b'; break;
+        case 'f': *unescaped += '\f'; break;
+        case 'n': *unescaped += '\n'; break;
+        case 'r': *unescaped += '\r'; break;
+        case 't': *unescaped += '\t'; break;
+        case 'u': {
+            char32_t code;
+            if (!parse_hex4(m_data.substr(m_pos), code)) return false;
+            m_pos += 4;
+
+            // a surrogate pair spells one code point
+            if (code >= 0xd800 and code < 0xdc00) {
+                char32_t low;
+                if (m_data.substr(m_pos, 2) != "\\u" or
+                    !parse_hex4(m_data.substr(m_pos + 2), low) or
+                    low < 0xdc00 or low >= 0xe000) {
+                    return false;
+                }
+                m_pos += 6;
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            append_utf8(*unescaped, code);
+            break;
+        }
+        default: return false;
+        }
+
+        start = m_pos;
+    }
+}
+
+bool JsonReader::read_value(std::string_view& out) {
+    if (m_pos >= m_data.size()) return false;
+
+    if (m_data[m_pos] == '"') return read_string(out);
+
+    auto const rest = m_data.substr(m_pos);
+
+    for (std::string_view word : { "true", "false" }) {
+        if (rest.starts_with(word)) {
+            out = rest.substr(0, word.size());
+            m_pos += word.size();
+            return true;
+        }
+    }
+
+    if (rest.starts_with("null")) {
+        out = {};
+        m_pos += 4;
+        return true;
+    }
+
+    std::size_t end = 0;
+    while (end < rest.size()) {
+        char const c = rest[end];
+        bool const number_char = (c >= '0' and c <= '9') or c == '-' or
+                                 c == '+' or c == '.' or c == 'e' or c == 'E';
+        if (!number_char) break;
+        end++;
+    }
+
+    if (end == 0) return false;
+
+    out = rest.substr(0, end);
+    m_pos += end;
+    return true;
+}
+
+bool JsonReader::skip_nested() {
+    int depth = 0;
+
+    while (m_pos < m_data.size()) {
+        char const c = m_data[m_pos];
+
+        if (c == '"') {
+            std::string_view ignored;
+            if (!read_string(ignored)) return false;
+            continue;
+        }
+
+        m_pos++;
+
+        if (c == '{' or c == '[') {
+            depth++;
+        } else if (c == '}' or c == ']') {
+            if (--depth == 0) return true;
+        }
+    }
+
+    return false;
+}
+
+int JsonReader::column_of(std::string_view key, std::size_t position) {
+    // objects usually list their keys in the same order
+    if (position < m_last_columns.size()) {
+        int const c = m_last_columns[position];
+        if (c >= 0 and key == m_names[c]) return c;
+    } else {
+        m_last_columns.resize(position + 1, -1);
+    }
+
+    int found = -1;
+    for (std::size_t c = 0; c < m_names.size(); c++) {
+        if (key == m_names[c]) {
+            found = int(c);
+            break;
+        }
+    }
+
+    m_last_columns[position] = found;
+    return found;
+}
+
+bool JsonReader::read_object(std::vector<Field>& fields, bool& error) {
+    fields.clear();
+    m_scratch.clear();
+
+    skip_space();
+    if (m_pos < m_data.size() and m_data[m_pos] == ',') {
+        m_pos++;
+        skip_space();
+    }
+
+    if (m_pos >= m_data.size()) return false;
+
+    auto fail = [&error]() {
+        error = true;
+        return false;
+    };
+
+    if (m_data[m_pos] != '{') return fail();
+    m_pos++;
+
+    skip_space();
+    if (m_pos < m_data.size() and m_data[m_pos] == '}') {
+        m_pos++;
+        return true;
+    }
+
+    for (std::size_t n = 0;; n++) {
+        std::string_view key;
+
+        skip_space();
+        if (!read_string(key)) return fail();
+
+        skip_space();
+        if (m_pos >= m_data.size() or m_data[m_pos] != ':') return fail();
+        m_pos++;
+        skip_space();
+
+        if (m_pos >= m_data.size()) return fail();
+
+        char const c = m_data[m_pos];
+
+        if (c == '{' or c == '[') {
+            if (!skip_nested()) return fail();
+        } else {
+            std::string_view value;
+            if (!read_value(value)) return fail();
+
+            int const column = column_of(key, n);
+            if (column >= 0) fields.push_back({ column, value });
+        }
+
+        skip_space();
+        if (m_pos >= m_data.size()) return fail();
+
+        if (m_data[m_pos] == ',') {
+            m_pos++;
+            continue;
+        }
+
+        if (m_data[m_pos] == '}') {
+            m_pos++;
+            return true;
+        }
+
+        return fail();
+    }
+}
+
+std::vector<std::string_view> split_csv(std::string_view body) {
+    int const n = chunk_count(body.size());
+
+    if (n == 1) return { body };
+
+    // the quotes before a point say if it falls inside a quoted field
+    std::vector<std::size_t> quotes(n);
+
+    struct_model_detail::parallel_for(n, [&](int k) {
+        auto const begin = body.begin() + nominal(body.size(), n, k);
+        auto const end   = body.begin() + nominal(body.size(), n, k + 1);
+        quotes[k]        = std::count(begin, end, '"');
+    });
+
+    std::vector<std::size_t> starts { 0 };
+    std::size_t              before = 0;
+
+    for (int k = 1; k < n; k++) {
+        before += quotes[k - 1];
+
+        bool        quoted = before % 2 == 1;
+        std::size_t pos    = nominal(body.size(), n, k);
+
+        // move on to the start of the next row
+        for (; pos < body.size(); pos++) {
+            char const c = body[pos];
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (c == '\n' and !quoted) {
+                pos++;
+                break;
+            }
+        }
+
+        if (pos > starts.back() and pos < body.size()) starts.push_back(pos);
+    }
+
+    std::vector<std::string_view> ret;
+    starts.push_back(body.size());
+
+    for (std::size_t i = 0; i + 1 < starts.size(); i++) {
+        ret.push_back(body.substr(starts[i], starts[i + 1] - starts[i]));
+    }
+
+    return ret;
+}
+
+std::vector<std::string_view> split_json(std::string_view body) {
+    int const n = chunk_count(body.size());
+
+    if (n == 1) return { body };
+
+    auto const begin_of = [&](int k) { return nominal(body.size(), n, k); };
+
+    // first pass: string quotes, to know which points fall inside a string
+    std::vector<std::size_t> quotes(n);
+
+    struct_model_detail::parallel_for(n, [&](int k) {
+        std::size_t count = 0;
+        for (auto i = begin_of(k); i < begin_of(k + 1); i++) {
+            if (body[i] == '"' and !is_escaped(body, i)) count++;
+        }
+        quotes[k] = count;
+    });
+
+    std::vector<char> in_string(n, false);
+    std::size_t       before = 0;
+
+    for (int k = 1; k < n; k++) {
+        before += quotes[k - 1];
+        in_string[k] = before % 2 == 1;
+    }
+
+    // second pass: nesting outside of strings, to know which points fall
+    // inside a record
+    std::vector<int> depth_change(n);
+
+    struct_model_detail::parallel_for(n, [&](int k) {
+        bool quoted = in_string[k];
+        int  depth  = 0;
+
+        for (auto i = begin_of(k); i < begin_of(k + 1); i++) {
+            char const c = body[i];
+            if (c == '"' and !is_escaped(body, i)) {
+                quoted = !quoted;
+            } else if (!quoted) {
+                if (c == '{' or c == '[') depth++;
+                if (c == '}' or c == ']') depth--;
+            }
+        }
+
+        depth_change[k] = depth;
+    });
+
+    std::vector<std::size_t> starts { 0 };
+    int                      depth = 0;
+
+    for (int k = 1; k < n; k++) {
+        depth += depth_change[k - 1];
+
+        bool        quoted = in_string[k];
+        int         d      = depth;
+        std::size_t pos    = begin_of(k);
+
+        // move on to the start of the next record
+        for (; pos < body.size(); pos++) {
+            char const c = body[pos];
+            if (c == '"' and !is_escaped(body, pos)) {
+                quoted = !quoted;
+            } else if (!quoted) {
+                if (c == '{' and d == 0) break;
+                if (c == '{' or c == '[') d++;
+                if (c == '}' or c == ']') d--;
+            }
+        }
+
+        if (pos > starts.back() and pos < body.size()) starts.push_back(pos);
+    }
+
+    std::vector<std::string_view> ret;
+    starts.push_back(body.size());
+
+    for (std::size_t i = 0; i + 1 < starts.size(); i++) {
+        ret.push_back(body.substr(starts[i], starts[i + 1] - starts[i]));
+    }
+
+    return ret;
+}
+
+std::optional<std::string_view> json_body(std::string_view document) {
+    auto const first = document.find_first_not_of(" \t\r\n");
+    auto const last  = document.find_last_not_of(" \t\r\n");
+
+    if (first == std::string_view::npos) return std::nullopt;
+    if (document[first] != '[' or document[last] != ']') return std::nullopt;
+
+    return document.substr(first + 1, last - first - 1);
+}
+
+std::string_view skip_bom(std::string_view data) {
+    if (data.starts_with("\xef\xbb\xbf")) data.remove_prefix(3);
+    return data;
+}
+
+} // namespace struct_text_detail
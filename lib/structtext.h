@@ -0,0 +1,616 @@
+#pragma once
+
+#include "structsnapshot.h"
+
+#include <charconv>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <string_view>
+
+namespace struct_text_detail {
+
+// Both formats use the names in Record::meta: CSV has them as a header row,
+// JSON as the keys of one flat object per record, inside a top level array.
+//
+// Members may be QString, bool, arithmetic or enum types. Text is UTF-8.
+
+template <class T>
+constexpr bool is_text_value =
+    std::is_same_v<T, QString> or std::is_arithmetic_v<T> or std::is_enum_v<T>;
+
+/// Parse a value from its text. Empty text gives the default value.
+template <class T>
+bool parse_value(std::string_view text, T& out) {
+    if constexpr (std::is_same_v<T, QString>) {
+        out = QString::fromUtf8(text.data(), text.size());
+        return true;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if (text.empty() or text == "false" or text == "0") {
+            out = false;
+        } else if (text == "true" or text == "1") {
+            out = true;
+        } else {
+            return false;
+        }
+        return true;
+    } else if constexpr (std::is_enum_v<T>) {
+        std::underlying_type_t<T> v {};
+        if (!parse_value(text, v)) return false;
+        out = T(v);
+        return true;
+    } else {
+        if (text.empty()) {
+            out = T {};
+            return true;
+        }
+
+        // from_chars does not take a leading plus
+        if (text.front() == '+') text.remove_prefix(1);
+
+        auto const end = text.data() + text.size();
+        auto const r   = std::from_chars(text.data(), end, out);
+
+        return r.ec == std::errc() and r.ptr == end;
+    }
+}
+
+/// Append the text of a number or bool
+template <class T>
+void append_number(QByteArray& out, T value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        out.append(value ? "true" : "false");
+    } else if constexpr (std::is_enum_v<T>) {
+        append_number(out, std::underlying_type_t<T>(value));
+    } else {
+        char buffer[64];
+        auto r = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, r.ptr - buffer);
+    }
+}
+
+void append_csv_string(QByteArray& out, QString const& s);
+void append_json_string(QByteArray& out, QString const& s);
+
+template <class Record, std::size_t I>
+bool read_member(std::string_view text, Record& r) {
+    auto const& m = std::get<I>(Record::meta);
+
+    using M = std::remove_cvref_t<decltype(m)>;
+    using T = struct_snapshot_detail::value_t<Record, M>;
+
+    static_assert(is_text_value<T>,
+                  "CSV and JSON only support QString, bool, arithmetic and "
+                  "enum members");
+
+    // custom entries without a setter are derived from other members
+    if constexpr (requires { m.setter; }) {
+        if (!m.setter) return true;
+    }
+
+    T value {};
+
+    if (!parse_value(text, value)) return false;
+
+    m.set(r, std::move(value));
+    return true;
+}
+
+template <class Record, std::size_t I>
+void write_csv_member(QByteArray& out, Record const& r) {
+    auto const& value = std::get<I>(Record::meta).get(r);
+
+    using T = std::remove_cvref_t<decltype(value)>;
+
+    if constexpr (std::is_same_v<T, QString>) {
+        append_csv_string(out, value);
+    } else {
+        append_number(out, value);
+    }
+}
+
+template <class Record, std::size_t I>
+void write_json_member(QByteArray& out, Record const& r) {
+    auto const& value = std::get<I>(Record::meta).get(r);
+
+    using T = std::remove_cvref_t<decltype(value)>;
+
+    if constexpr (std::is_same_v<T, QString>) {
+        append_json_string(out, value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        // JSON has no spelling for these
+        if (std::isfinite(value)) {
+            append_number(out, value);
+        } else {
+            out.append("null");
+        }
+    } else {
+        append_number(out, value);
+    }
+}
+
+/// Per-record text converters, indexed by column
+template <class Record>
+struct TextTable {
+    using Reader = bool (*)(std::string_view, Record&);
+    using Writer = void (*)(QByteArray&, Record const&);
+
+    static constexpr int count =
+        std::tuple_size_v<std::remove_cvref_t<decltype(Record::meta)>>;
+
+private:
+    template <std::size_t... Is>
+    static constexpr auto make_readers(std::index_sequence<Is...>) {
+        return std::array<Reader, count> { &read_member<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_csv(std::index_sequence<Is...>) {
+        return std::array<Writer, count> { &write_csv_member<Record, Is>... };
+    }
+
+    template <std::size_t... Is>
+    static constexpr auto make_json(std::index_sequence<Is...>) {
+        return std::array<Writer, count> { &write_json_member<Record, Is>... };
+    }
+
+    using Seq = std::make_index_sequence<count>;
+
+public:
+    static constexpr std::array<Reader, count> readers = make_readers(Seq {});
+    static constexpr std::array<Writer, count> csv     = make_csv(Seq {});
+    static constexpr std::array<Writer, count> json    = make_json(Seq {});
+};
+
+/// A parsed field: its column and text
+struct Field {
+    int              column;
+    std::string_view text;
+};
+
+/// Splits CSV rows into fields
+class CsvReader {
+    std::string_view m_data;
+    std::size_t      m_pos = 0;
+
+    // unescaped quoted fields of the current row; a deque, so views into it
+    // stay put
+    std::deque<std::string> m_scratch;
+
+public:
+    explicit CsvReader(std::string_view data) : m_data(data) { }
+
+    std::size_t position() const { return m_pos; }
+
+    bool at_end() const { return m_pos >= m_data.size(); }
+
+    /// Read the fields of the next row
+    ///
+    /// \returns False if the row is malformed
+    bool read_row(std::vector<std::string_view>& fields);
+};
+
+/// Reads flat JSON objects from the body of a top level array
+class JsonReader {
+    std::string_view m_data;
+    std::size_t      m_pos = 0;
+
+    std::deque<std::string> m_scratch;
+
+    // the column of each key, by position, from the last object
+    std::vector<int> m_last_columns;
+
+    std::span<char const* const> m_names;
+
+    void skip_space();
+    bool read_string(std::string_view& out);
+    bool read_value(std::string_view& out);
+    bool skip_nested();
+    int  column_of(std::string_view key, std::size_t position);
+
+public:
+    JsonReader(std::string_view data, std::span<char const* const> names)
+        : m_data(data), m_names(names) { }
+
+    std::size_t position() const { return m_pos; }
+
+    /// Read the next object. Keys that are not columns are skipped, and so
+    /// are nested values.
+    ///
+    /// \returns False at the end of the data, or with error set if the object
+    /// is malformed
+    bool read_object(std::vector<Field>& fields, bool& error);
+};
+
+/// Split the rows of a CSV body into chunks that can be parsed on their own
+std::vector<std::string_view> split_csv(std::string_view body);
+
+/// Split the objects of a JSON array body into chunks that can be parsed on
+/// their own
+std::vector<std::string_view> split_json(std::string_view body);
+
+/// Find the body of a JSON document holding a top level array
+std::optional<std::string_view> json_body(std::string_view document);
+
+/// Skip a UTF-8 byte order mark
+std::string_view skip_bom(std::string_view data);
+
+/// Join parsed chunks, in order, into one vector
+template <class Record>
+QVector<Record> join_chunks(std::vector<QVector<Record>>& chunks) {
+    if (chunks.size() == 1) return std::move(chunks.front());
+
+    qsizetype total = 0;
+    for (auto const& c : chunks) {
+        total += c.size();
+    }
+
+    QVector<Record> ret;
+    ret.reserve(total);
+
+    for (auto& c : chunks) {
+        std::move(c.begin(), c.end(), std::back_inserter(ret));
+        c = {};
+    }
+
+    return ret;
+}
+
+template <class Record>
+std::optional<std::vector<QVector<Record>>>
+parse_csv(std::string_view document) {
+    using Table = TextTable<Record>;
+
+    auto const& names = struct_model_detail::ColumnTable<Record>::names;
+
+    document = skip_bom(document);
+
+    CsvReader                     header_reader(document);
+    std::vector<std::string_view> header;
+
+    if (!header_reader.read_row(header)) {
+        qWarning() << "CSV header is malformed";
+        return std::nullopt;
+    }
+
+    // the column for each field, or -1 to ignore it
+    std::vector<int> columns;
+    bool             any = false;
+
+    for (auto name : header) {
+        int column = -1;
+        for (int c = 0; c < Table::count; c++) {
+            if (name == names[c]) column = c;
+        }
+        columns.push_back(column);
+        any |= column >= 0;
+    }
+
+    if (!any) {
+        qWarning() << "CSV header has none of the record's members";
+        return std::nullopt;
+    }
+
+    auto const chunks = split_csv(document.substr(header_reader.position()));
+
+    std::vector<QVector<Record>> out(chunks.size());
+    std::vector<char>            failed(chunks.size(), false);
+
+    struct_model_detail::parallel_for(chunks.size(), [&](int i) {
+        CsvReader                     reader(chunks[i]);
+        std::vector<std::string_view> fields;
+
+        auto& records = out[i];
+
+        while (!reader.at_end()) {
+            if (!reader.read_row(fields)) {
+                failed[i] = true;
+                return;
+            }
+
+            // blank lines carry nothing
+            if (fields.size() == 1 and fields.front().empty()) continue;
+
+            Record r {};
+
+            auto const n = std::min(fields.size(), columns.size());
+            for (std::size_t f = 0; f < n; f++) {
+                int const c = columns[f];
+                if (c < 0) continue;
+                if (!Table::readers[c](fields[f], r)) {
+                    failed[i] = true;
+                    return;
+                }
+            }
+
+            records.push_back(std::move(r));
+        }
+    });
+
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        if (!failed[i]) continue;
+
+        // one bad chunk spoils the import
+        qWarning() << "CSV has a malformed row or value after byte"
+                   << (chunks[i].data() - document.data());
+        return std::nullopt;
+    }
+
+    return out;
+}
+
+template <class Record>
+std::optional<std::vector<QVector<Record>>>
+parse_json(std::string_view document) {
+    using Table = TextTable<Record>;
+
+    auto const body = json_body(skip_bom(document));
+
+    if (!body) {
+        qWarning() << "JSON is not an array of records";
+        return std::nullopt;
+    }
+
+    auto const chunks = split_json(*body);
+
+    std::vector<QVector<Record>> out(chunks.size());
+    std::vector<char>            failed(chunks.size(), false);
+
+    struct_model_detail::parallel_for(chunks.size(), [&](int i) {
+        JsonReader reader(chunks[i],
+                          struct_model_detail::ColumnTable<Record>::names);
+
+        std::vector<Field> fields;
+        bool               error = false;
+
+        auto& records = out[i];
+
+        while (reader.read_object(fields, error)) {
+            Record r {};
+
+            for (auto const& f : fields) {
+                if (!Table::readers[f.column](f.text, r)) {
+                    failed[i] = true;
+                    return;
+                }
+            }
+
+            records.push_back(std::move(r));
+        }
+
+        if (error) failed[i] = true;
+    });
+
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        if (!failed[i]) continue;
+
+        qWarning() << "JSON has a malformed record or value after byte"
+                   << (chunks[i].data() - document.data());
+        return std::nullopt;
+    }
+
+    return out;
+}
+
+template <class Record, class At>
+bool write_csv(qsizetype rows, At&& at, QIODevice& device) {
+    using Table = TextTable<Record>;
+
+    auto const& names = struct_model_detail::ColumnTable<Record>::names;
+
+    struct_snapshot_detail::Writer out(device);
+    QByteArray                     line;
+
+    for (int c = 0; c < Table::count; c++) {
+        if (c) line.append(',');
+        append_csv_string(line, QString::fromUtf8(names[c]));
+    }
+    line.append('\n');
+
+    out.write(line.constData(), line.size());
+
+    for (qsizetype row = 0; row < rows; row++) {
+        line.clear();
+
+        auto const& r = at(row);
+
+        for (int c = 0; c < Table::count; c++) {
+            if (c) line.append(',');
+            Table::csv[c](line, r);
+        }
+        line.append('\n');
+
+        out.write(line.constData(), line.size());
+    }
+
+    return out.finish();
+}
+
+template <class Record, class At>
+bool write_json(qsizetype rows, At&& at, QIODevice& device) {
+    using Table = TextTable<Record>;
+
+    auto const& names = struct_model_detail::ColumnTable<Record>::names;
+
+    // keys are the same for every row
+    std::array<QByteArray, Table::count> keys;
+
+    for (int c = 0; c < Table::count; c++) {
+        keys[c].append(c ? ',' : '{');
+        append_json_string(keys[c], QString::fromUtf8(names[c]));
+        keys[c].append(':');
+    }
+
+    struct_snapshot_detail::Writer out(device);
+    QByteArray                     line;
+
+    out.write("[", 1);
+
+    for (qsizetype row = 0; row < rows; row++) {
+        line.clear();
+        line.append(row ? ",\n" : "\n");
+
+        auto const& r = at(row);
+
+        for (int c = 0; c < Table::count; c++) {
+            line.append(keys[c]);
+            Table::json[c](line, r);
+        }
+        line.append('}');
+
+        out.write(line.constData(), line.size());
+    }
+
+    out.write("\n]\n", 3);
+
+    return out.finish();
+}
+
+/// Map a file and parse it with one of the parsers above, then append the
+/// records to a model in one batch
+template <class Record, class Parse>
+bool import_file(StructTableModel<Record>& model,
+                 QString const&            path,
+                 Parse&&                   parse) {
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open for import" << path;
+        return false;
+    }
+
+    auto const size = file.size();
+
+    if (size <= 0) return false;
+
+    uchar* mapped = file.map(0, size);
+
+    if (!mapped) {
+        qWarning() << "Unable to map for import" << path;
+        return false;
+    }
+
+    auto chunks =
+        parse(std::string_view(reinterpret_cast<char const*>(mapped), size));
+
+    file.unmap(mapped);
+
+    if (!chunks) return false;
+
+    auto batch = model.batch();
+
+    for (auto& c : *chunks) {
+        if (!c.isEmpty()) model.append(std::move(c));
+    }
+
+    return true;
+}
+
+/// Write a model to a file through one of the writers above. The file is only
+/// replaced once writing is complete.
+template <class Record, class Write>
+bool export_file(StructTableModel<Record> const& model,
+                 QString const&                  path,
+                 Write&&                         write) {
+    QSaveFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to open for export" << path;
+        return false;
+    }
+
+    if (!write(file)) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+} // namespace struct_text_detail
+
+/// Read records from CSV already in memory. The first row names the members;
+/// columns are matched by name, in any order, and unknown columns are
+/// skipped. Members without a column keep their default value.
+///
+/// Rows are parsed in parallel chunks, straight into records; nothing goes
+/// through QVariant.
+///
+/// \returns Nothing if the CSV is malformed, or a value does not parse
+template <class Record>
+std::optional<QVector<Record>> read_csv(QByteArrayView data) {
+    auto chunks = struct_text_detail::parse_csv<Record>(
+        std::string_view(data.data(), data.size()));
+
+    if (!chunks) return std::nullopt;
+
+    return struct_text_detail::join_chunks(*chunks);
+}
+
+/// Read records from JSON already in memory: a top level array of objects,
+/// keyed by member name. Parsed in parallel like read_csv().
+template <class Record>
+std::optional<QVector<Record>> read_json(QByteArrayView data) {
+    auto chunks = struct_text_detail::parse_json<Record>(
+        std::string_view(data.data(), data.size()));
+
+    if (!chunks) return std::nullopt;
+
+    return struct_text_detail::join_chunks(*chunks);
+}
+
+/// Append the records of a CSV file to a model. The file is mapped, not read,
+/// and parsed as by read_csv(). Views see a single insert.
+///
+/// \returns False if the file is missing or malformed. The model is left
+/// alone in that case.
+template <class Record>
+bool import_csv(StructTableModel<Record>& model, QString const& path) {
+    return struct_text_detail::import_file(
+        model, path, &struct_text_detail::parse_csv<Record>);
+}
+
+/// Append the records of a JSON file to a model, as import_csv()
+template <class Record>
+bool import_json(StructTableModel<Record>& model, QString const& path) {
+    return struct_text_detail::import_file(
+        model, path, &struct_text_detail::parse_json<Record>);
+}
+
+/// Write the records of a model to a device as CSV, with a header row of
+/// member names. Rows are streamed out in blocks.
+///
+/// \returns False if writing failed
+template <class Record>
+bool export_csv(StructTableModel<Record> const& model, QIODevice& device) {
+    return struct_text_detail::write_csv<Record>(
+        model.rowCount(),
+        [&model](qsizetype row) -> Record const& {
+            return *model.get_at(row);
+        },
+        device);
+}
+
+template <class Record>
+bool export_csv(StructTableModel<Record> const& model, QString const& path) {
+    return struct_text_detail::export_file(
+        model, path, [&model](QIODevice& d) { return export_csv(model, d); });
+}
+
+/// Write the records of a model to a device as a JSON array of objects, one
+/// per line. Non-finite numbers are written as null.
+template <class Record>
+bool export_json(StructTableModel<Record> const& model, QIODevice& device) {
+    return struct_text_detail::write_json<Record>(
+        model.rowCount(),
+        [&model](qsizetype row) -> Record const& {
+            return *model.get_at(row);
+        },
+        device);
+}
+
+template <class Record>
+bool export_json(StructTableModel<Record> const& model, QString const& path) {
+    return struct_text_detail::export_file(
+        model, path, [&model](QIODevice& d) { return export_json(model, d); });
+}
@@ -0,0 +1,13 @@
+#include "structtreemodel.h"
+
+StructTreeModelBase::~StructTreeModelBase() = default;
+
+QModelIndex StructTreeModelBase::parent(QModelIndex const& index) const {
+    if (!index.isValid()) return {};
+
+    auto* owner = block_of(index);
+
+    if (!owner->parent) return {};
+
+    return createIndex(owner->row, 0, owner->parent);
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include "structmodel.h"
+
+#include <QAbstractItemModel>
+
+#include <memory>
+#include <vector>
+
+///
+/// \brief The StructTreeSource class provides the children of a
+/// StructTreeModel's nodes when they are first expanded.
+///
+template <class Record>
+class StructTreeSource {
+public:
+    virtual ~StructTreeSource() = default;
+
+    /// Check if a record has children, without loading them. Asked before a
+    /// node is expanded, so this should be cheap.
+    virtual bool has_children(Record const&) const { return true; }
+
+    /// Load the children of a record, or the top level records for null
+    virtual QVector<Record> children(Record const* parent) const = 0;
+};
+
+///
+/// \brief A record and its descendants, for inserting whole subtrees
+///
+template <class Record>
+struct StructSubtree {
+    Record                     record;
+    std::vector<StructSubtree> children;
+};
+
+class StructTreeModelBase : public QAbstractItemModel {
+    Q_OBJECT
+
+protected:
+    // Each parent keeps its children in one block, which is addressed by model
+    // indexes. A block knows where its owner is, so parent() needs nothing
+    // from the records.
+    struct BlockHeader {
+        BlockHeader* parent = nullptr; // block holding the owner, null at top
+        int          row    = -1;      // owner's row in that block
+    };
+
+    /// The block an index lives in
+    static BlockHeader* block_of(QModelIndex const& index) {
+        return static_cast<BlockHeader*>(index.internalPointer());
+    }
+
+public:
+    using QAbstractItemModel::QAbstractItemModel;
+    virtual ~StructTreeModelBase();
+
+    QModelIndex parent(QModelIndex const& index) const override;
+
+signals:
+    /// The children of a node were loaded from the source
+    void children_loaded(QModelIndex const& parent);
+};
+
+///
+/// \brief The StructTreeModel class is a tree of records, described by the
+/// same Record::meta as StructTableModel.
+///
+/// The children of each node live in a contiguous block of their own, so
+/// changing one node's children never reallocates or moves those of another.
+/// With a StructTreeSource, children are loaded the first time a view asks
+/// for them through fetchMore(); nodes report hasChildren() before that
+/// without loading anything.
+///
+/// Subtrees are inserted and removed with a single notification per call,
+/// however deep they are.
+///
+template <class Record>
+class StructTreeModel : public StructTreeModelBase {
+public:
+    using Source  = StructTreeSource<Record>;
+    using Subtree = StructSubtree<Record>;
+
+private:
+    using Table = struct_model_detail::ColumnTable<Record>;
+
+    struct Block;
+
+    struct Node {
+        Record                 record;
+        std::unique_ptr<Block> children; // null until there are any
+        bool                   fetched = true;
+    };
+
+    struct Block : BlockHeader {
+        std::vector<Node> nodes;
+    };
+
+    Block m_root;
+    bool  m_root_fetched = true;
+
+    std::shared_ptr<Source const> m_source;
+
+    static Block* cast(BlockHeader* b) { return static_cast<Block*>(b); }
+
+    Node* node_at(QModelIndex const& index) const {
+        if (!index.isValid()) return nullptr;
+
+        auto* block = cast(block_of(index));
+        if (index.row() >= int(block->nodes.size())) return nullptr;
+
+        return &block->nodes[index.row()];
+    }
+
+    /// The children of an index, if that block exists yet
+    Block* block_for(QModelIndex const& parent) const {
+        if (!parent.isValid()) return const_cast<Block*>(&m_root);
+
+        auto* n = node_at(parent);
+        return n ? n->children.get() : nullptr;
+    }
+
+    /// The children of an index, creating the block if needed
+    Block& make_block(QModelIndex const& parent) {
+        if (!parent.isValid()) return m_root;
+
+        auto* n = node_at(parent);
+        Q_ASSERT(n);
+
+        if (!n->children) {
+            n->children         = std::make_unique<Block>();
+            n->children->parent = block_of(parent);
+            n->children->row    = parent.row();
+        }
+
+        return *n->children;
+    }
+
+    bool& fetched_flag(QModelIndex const& parent) {
+        if (!parent.isValid()) return m_root_fetched;
+        return node_at(parent)->fetched;
+    }
+
+    /// Point the child blocks of rows from first on back at their owners,
+    /// after rows moved within a block
+    static void renumber(Block& block, int first) {
+        for (int i = first; i < int(block.nodes.size()); i++) {
+            if (auto& c = block.nodes[i].children) c->row = i;
+        }
+    }
+
+    /// Turn a subtree into a node, with its whole subtree attached
+    static Node make_node(Subtree&& s) {
+        Node ret { std::move(s.record), nullptr, true };
+
+        if (!s.children.empty()) {
+            ret.children = std::make_unique<Block>();
+            ret.children->nodes.reserve(s.children.size());
+
+            for (auto& c : s.children) {
+                ret.children->nodes.push_back(make_node(std::move(c)));
+            }
+
+            adopt(*ret.children, 0);
+        }
+
+        return ret;
+    }
+
+    /// Set the parent links of child blocks owned by rows from first on
+    static void adopt(Block& block, int first) {
+        for (int i = first; i < int(block.nodes.size()); i++) {
+            if (auto& c = block.nodes[i].children) {
+                c->parent = &block;
+                c->row    = i;
+            }
+        }
+    }
+
+    /// Put nodes into a block with a single notification
+    void insert_nodes(QModelIndex const& parent,
+                      int                row,
+                      std::vector<Node>  nodes) {
+        if (nodes.empty()) return;
+
+        ensure_fetched(parent);
+
+        auto& block = make_block(parent);
+
+        row = std::clamp(row, 0, int(block.nodes.size()));
+
+        int const count = nodes.size();
+
+        beginInsertRows(parent, row, row + count - 1);
+
+        block.nodes.insert(block.nodes.begin() + row,
+                           std::make_move_iterator(nodes.begin()),
+                           std::make_move_iterator(nodes.end()));
+
+        // new blocks need their parent, shifted ones their row
+        adopt(block, row);
+
+        endInsertRows();
+    }
+
+    /// Load children from the source, if that has not happened yet
+    void ensure_fetched(QModelIndex const& parent) {
+        bool& fetched = fetched_flag(parent);
+        if (fetched) return;
+
+        fetched = true;
+
+        auto* n       = node_at(parent);
+        auto  records = m_source->children(n ? &n->record : nullptr);
+
+        if (records.isEmpty()) return;
+
+        auto& block = make_block(parent);
+
+        Q_ASSERT(block.nodes.empty());
+
+        beginInsertRows(parent, 0, records.size() - 1);
+
+        block.nodes.reserve(records.size());
+        for (auto& r : records) {
+            block.nodes.push_back(Node { std::move(r), nullptr, false });
+        }
+
+        endInsertRows();
+
+        emit children_loaded(parent);
+    }
+
+public:
+    explicit StructTreeModel(QObject* parent = nullptr)
+        : StructTreeModelBase(parent) { }
+
+    /// Use a new source, resetting the model. Top level records are loaded
+    /// when first asked for.
+    void set_source(std::shared_ptr<Source const> source) {
+        beginResetModel();
+        m_source       = std::move(source);
+        m_root.nodes.clear();
+        m_root_fetched = !m_source;
+        endResetModel();
+    }
+
+    /// Replace the whole tree. Nodes given here are never loaded from the
+    /// source; their children are exactly those given.
+    void reset(std::vector<Subtree> roots = {}) {
+        beginResetModel();
+
+        m_root.nodes.clear();
+        m_root.nodes.reserve(roots.size());
+        for (auto& s : roots) {
+            m_root.nodes.push_back(make_node(std::move(s)));
+        }
+        adopt(m_root, 0);
+        m_root_fetched = true;
+
+        endResetModel();
+    }
+
+    // Structure:
+    QModelIndex
+    index(int row, int column, QModelIndex const& parent = {}) const override {
+        if (column < 0 or column >= Table::count) return {};
+
+        auto* block = block_for(parent);
+        if (!block) return {};
+        if (row < 0 or row >= int(block->nodes.size())) return {};
+
+        return createIndex(row, column, static_cast<BlockHeader*>(block));
+    }
+
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override {
+        if (parent.column() > 0) return 0;
+
+        auto* block = block_for(parent);
+        return block ? int(block->nodes.size()) : 0;
+    }
+
+    int columnCount(QModelIndex const& = QModelIndex()) const override {
+        return Table::count;
+    }
+
+    bool hasChildren(QModelIndex const& parent = QModelIndex()) const override {
+        if (parent.column() > 0) return false;
+
+        if (rowCount(parent) > 0) return true;
+
+        if (!m_source) return false;
+
+        if (!parent.isValid()) return !m_root_fetched;
+
+        auto* n = node_at(parent);
+        return !n->fetched and m_source->has_children(n->record);
+    }
+
+    bool canFetchMore(QModelIndex const& parent) const override {
+        if (!m_source or parent.column() > 0) return false;
+        if (!parent.isValid()) return !m_root_fetched;
+
+        auto* n = node_at(parent);
+        return n and !n->fetched;
+    }
+
+    void fetchMore(QModelIndex const& parent) override {
+        if (!canFetchMore(parent)) return;
+        ensure_fetched(parent);
+    }
+
+    // Header:
+    QVariant headerData(int             section,
+                        Qt::Orientation orientation,
+                        int             role = Qt::DisplayRole) const override {
+        if (orientation != Qt::Orientation::Horizontal) return {};
+        if (role != Qt::DisplayRole) return {};
+
+        return struct_model_detail::get_header<Record>().value(section);
+    }
+
+    // Data:
+    QVariant data(QModelIndex const& index,
+                  int                role = Qt::DisplayRole) const override {
+        auto* n = node_at(index);
+        if (!n) return {};
+
+        if (role == Qt::DisplayRole or role == Qt::EditRole) {
+            return struct_model_detail::record_runtime_get(n->record,
+                                                           index.column());
+        }
+
+        if (role >= Qt::UserRole) {
+            return struct_model_detail::record_runtime_get(
+                n->record, role - Qt::UserRole);
+        }
+
+        return {};
+    }
+
+    bool setData(QModelIndex const& index,
+                 QVariant const&    value,
+                 int                role = Qt::EditRole) override {
+        auto* n = node_at(index);
+        if (!n) return false;
+
+        int const location =
+            role >= Qt::UserRole ? role - Qt::UserRole : index.column();
+
+        if (!Table::in_range(location)) return false;
+
+        if (Table::equals[location](n->record, value)) return false;
+
+        if (!Table::setters[location](n->record, value)) return false;
+
+        emit dataChanged(index, index, { role });
+        return true;
+    }
+
+    Qt::ItemFlags flags(QModelIndex const& index) const override {
+        if (!index.isValid()) return Qt::NoItemFlags;
+
+        if (!Table::in_range(index.column())) return Qt::NoItemFlags;
+
+        if (!Table::editable[index.column()]) return Qt::ItemIsEnabled;
+
+        return Qt::ItemIsEditable | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+    }
+
+    QHash<int, QByteArray> roleNames() const override {
+        return struct_model_detail::get_name_map<Record>();
+    }
+
+    // Records:
+
+    /// The record at an index, or null
+    Record const* get(QModelIndex const& index) const {
+        auto* n = node_at(index);
+        return n ? &n->record : nullptr;
+    }
+
+    /// Replace the record at an index, keeping its children
+    void update(QModelIndex const& index, Record r) {
+        auto* n = node_at(index);
+        if (!n) return;
+
+        n->record = std::move(r);
+
+        emit dataChanged(this->index(index.row(), 0, index.parent()),
+                         this->index(index.row(), Table::count - 1,
+                                     index.parent()));
+    }
+
+    /// Insert leaf records under a parent, before the given row. A parent that
+    /// has not been loaded from the source is loaded first.
+    void insert_children(QModelIndex const& parent,
+                         int                row,
+                         QVector<Record>    records) {
+        std::vector<Node> nodes;
+        nodes.reserve(records.size());
+        for (auto& r : records) {
+            nodes.push_back(Node { std::move(r), nullptr, true });
+        }
+
+        insert_nodes(parent, row, std::move(nodes));
+    }
+
+    /// Append leaf records under a parent
+    void append_children(QModelIndex const& parent, QVector<Record> records) {
+        insert_children(parent, rowCount(parent), std::move(records));
+    }
+
+    /// Insert whole subtrees under a parent, before the given row, as one
+    /// notification
+    void insert_subtrees(QModelIndex const&   parent,
+                         int                  row,
+                         std::vector<Subtree> subtrees) {
+        std::vector<Node> nodes;
+        nodes.reserve(subtrees.size());
+        for (auto& s : subtrees) {
+            nodes.push_back(make_node(std::move(s)));
+        }
+
+        insert_nodes(parent, row, std::move(nodes));
+    }
+
+    /// Remove rows under a parent, and everything below them, as one
+    /// notification
+    void remove_children(QModelIndex const& parent, int row, int count = 1) {
+        auto* block = block_for(parent);
+        if (!block) return;
+
+        int const size = block->nodes.size();
+
+        if (row < 0 or row >= size or count <= 0) return;
+        count = std::min(count, size - row);
+
+        beginRemoveRows(parent, row, row + count - 1);
+
+        block->nodes.erase(block->nodes.begin() + row,
+                           block->nodes.begin() + row + count);
+        renumber(*block, row);
+
+        endRemoveRows();
+    }
+
+    /// Drop the loaded children of a node, so they are fetched from the source
+    /// again when next asked for
+    void unload_children(QModelIndex const& parent) {
+        if (!m_source) return;
+
+        remove_children(parent, 0, rowCount(parent));
+        fetched_flag(parent) = false;
+    }
+};